@@ -0,0 +1,53 @@
+#ifndef __BENCH_INCLUDED__
+#define __BENCH_INCLUDED__
+
+#include <stdint.h>
+#include "crc32.h"
+#include "histogram.h"
+#include "engine.h"
+
+/*
+ * Benchmark of the protocol on a pair of connected ports: one side sends
+ * a frame (signature, payload, trailer) and waits for the answer, the
+ * other one answers from its own thread (the echo of the frame, or only
+ * ACK/NAK with a CRC). Every round trip goes in a histogram.
+ * The ports must already be at the baud rate of the step. Best on a
+ * virtual link (pty, null:paced) so it runs on any machine.
+ */
+
+#define BENCH_MAX_PAYLOAD	4096
+#define BENCH_MAX_PAIRS		64
+
+typedef struct {
+	int baudrate;
+	int payload;
+	t_crc_type crc;
+	uint64_t frames;        // answered correctly
+	uint64_t timeouts;
+	uint64_t errors;        // wrong answer, NAK
+	double seconds;
+	double goodput;         // payload bytes/s of the answered frames
+	double efficiency;      // goodput in % of the line rate (8N1)
+	t_histogram rtt;        // usecs from the send to the whole answer
+} t_bench_result;
+
+// Runs for 'seconds', < 0 if error. baudrate is only used for the efficiency.
+extern int bench_step(int master, int slave, int baudrate, int payload,
+	t_crc_type crc, int seconds, t_bench_result *res);
+
+// Adds the run src to dst (same baud rate and payload)
+extern void bench_merge(t_bench_result *dst, const t_bench_result *src);
+
+extern void bench_print_header(void);
+extern void bench_print(const t_bench_result *res);
+
+/*
+ * Scaling of the protocol engine: 1, 2, 4... maxpairs pairs of engines,
+ * one thread each, on maxpairs virtual links named link. Every step runs
+ * for 'seconds' and prints the frames, the CPU time of the process and
+ * the CPU per frame: flat CPU-us/FRAME means no per-port overhead.
+ * tmpl gives baud rate, payload, window, CRC and timeout of every engine.
+ */
+extern int bench_engines(const char *link, int maxpairs, int seconds, const t_engine_config *tmpl);
+
+#endif
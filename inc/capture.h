@@ -0,0 +1,94 @@
+#ifndef __CAPTURE_INCLUDED__
+#define __CAPTURE_INCLUDED__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+/*
+ * Wire capture: every chunk read from or written to a port, with its
+ * CLOCK_MONOTONIC timestamp, direction and port id, is appended to a
+ * fixed size ring in a file mapped in memory. When the ring is full the
+ * oldest records are overwritten, so the file always holds the last
+ * minutes before a problem, and being a shared mapping it survives a
+ * crash of the program. Records are never split: one that does not fit
+ * before the end of the ring leaves a pad record and starts over.
+ * The serial_*() functions capture the ports registered with
+ * capture_port(); with no capture open the cost is one load and a branch.
+ */
+
+#define CAPTURE_MAGIC		"SERCAP1"
+#define CAPTURE_VERSION		1
+#define CAPTURE_HDR_SIZE	4096     // the data ring starts at this offset
+#define CAPTURE_ALIGN		16       // records start and end on this boundary
+#define CAPTURE_MAX_PORTS	16
+#define CAPTURE_MIN_SIZE	(64 * 1024)
+
+typedef enum {
+	CAPTURE_RX,
+	CAPTURE_TX,
+	CAPTURE_BREAK,          // a break sent, no data
+	CAPTURE_PAD,            // filler up to the end of the ring
+} t_capture_dir;
+
+#define CAPTURE_F_CLIPPED	0x0001   // the chunk was longer than len
+
+typedef struct {
+	int64_t ts_ns;          // CLOCK_MONOTONIC
+	uint32_t len;           // data bytes after this header
+	uint8_t dir;            // t_capture_dir
+	uint8_t port;
+	uint16_t flags;
+} t_capture_record;
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t crc;           // t_crc_type of the run: frames carry a trailer
+	uint64_t capacity;      // bytes of the data ring
+	uint64_t head;          // free running offsets: end of the newest record
+	uint64_t tail;          // and start of the oldest one
+	uint64_t records;
+	uint64_t overwritten;
+	int64_t start_ns;
+	uint32_t nports;
+	uint32_t reserved;
+	int32_t baudrate[CAPTURE_MAX_PORTS];
+	char port_name[CAPTURE_MAX_PORTS][32];
+} t_capture_header;
+
+// size is the data ring, rounded to CAPTURE_ALIGN. < 0 if error.
+extern int capture_open(const char *path, uint64_t size, uint32_t crc);
+extern void capture_close(void);
+// Captures fd from now on, < 0 if error or no capture is open
+extern int capture_port(int fd, const char *name, int baudrate);
+
+// Any thread: len bytes from the iov (at most the sum of its lengths)
+extern void capture_iov(int fd, t_capture_dir dir, const struct iovec *iov, int iovcnt, size_t len);
+extern void capture_data(int fd, t_capture_dir dir, const void *buf, size_t len);
+
+extern int capture_enabled;
+
+static inline int capture_active(void)
+{
+	return __atomic_load_n(&capture_enabled, __ATOMIC_RELAXED);
+}
+
+/*
+ * Reading back a capture (replay)
+ */
+typedef struct {
+	int fd;
+	size_t length;
+	const t_capture_header *hdr;
+	const unsigned char *ring;
+	uint64_t pos;           // next record, free running like head and tail
+} t_capture_reader;
+
+extern int capture_reader_open(t_capture_reader *r, const char *path);
+extern void capture_reader_close(t_capture_reader *r);
+extern void capture_reader_rewind(t_capture_reader *r);
+// The next record (pads skipped) and its data, NULL at the end
+extern const t_capture_record *capture_reader_next(t_capture_reader *r, const unsigned char **data);
+
+#endif
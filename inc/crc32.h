@@ -0,0 +1,28 @@
+#ifndef __CRC32_INCLUDED__
+#define __CRC32_INCLUDED__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * CRC32 (IEEE 802.3) and CRC32C (Castagnoli) with the zlib convention:
+ * start with crc = 0 and chain the calls to checksum several buffers.
+ * Both run slice-by-8 in software; CRC32C uses the CPU instruction
+ * (SSE4.2 on x86, CRC extension on ARMv8) when available.
+ */
+
+typedef enum {
+	CRC_NONE = 0,
+	CRC_32,
+	CRC_32C,
+} t_crc_type;
+
+extern uint32_t crc32_ieee(uint32_t crc, const void *buf, size_t len);
+extern uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
+extern uint32_t crc_compute(t_crc_type type, uint32_t crc, const void *buf, size_t len);
+
+// 1 if crc32c() runs on the CPU instruction
+extern int crc32c_hw_available(void);
+extern const char *crc_name(t_crc_type type);
+
+#endif
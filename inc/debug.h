@@ -7,6 +7,7 @@
 #include <stdio.h>
 #include <sys/time.h>
 #include <unistd.h>
+#include "log.h"
 
 /* ANSI Eye-Candy ;-) */
 #define ANSI_RED    "\x1b[31m"
@@ -18,321 +19,108 @@
 #define WITH_TIMESTAMP
 //#undef  WITH_TIMESTAMP
 
+#define DBG_ERROR   0
+#define DBG_INFO    1
+#define DBG_VERBOSE 2
+#define DBG_NOISY   3
+
+/*
+ * Livello massimo compilato: le chiamate sopra DBG_BUILD_LEVEL spariscono
+ * del tutto, niente confronto e niente valutazione degli argomenti.
+ * Per una release: make clean; make DBG_BUILD_LEVEL=DBG_INFO
+ */
+#ifndef DBG_BUILD_LEVEL
+	#define DBG_BUILD_LEVEL DBG_NOISY
+#endif
+#define DBG_ENABLED(var, level)	(DBG_BUILD_LEVEL >= (level) && (var) >= (level))
+
+/*
+ * Variabile del livello di un modulo, registrata nel logger per poterla
+ * cambiare a runtime (vedi log_levels_request())
+ */
+#define DBG_MODULE(var, name, level) \
+	static int var = level; \
+	__attribute__ ((constructor)) static void var##_register(void) \
+	{ \
+		log_module(name, &var); \
+	}
+
+/*
+ * Tutte le macro passano dal logger asincrono (log.h): il thread che
+ * scrive mette solo formato e argomenti nel suo ring, la formattazione e
+ * la fflush() le fa il thread del logger.
+ */
+#ifdef WITH_TIMESTAMP
+	#define LOG_FLAGS	LOG_F_TIMESTAMP
+#else
+	#define LOG_FLAGS	0
+#endif
+
 #define printR(fmt, args...) \
 	{ \
-		fprintf(stdout, fmt, ## args); \
+		log_write(LOG_F_RAW, "", "", __FILE__, __func__, fmt, ## args); \
 	}
 
-#define printRaw(type, fmt, args...) \
+#define printRaw(color, type, fmt, args...) \
 	{ \
-		fprintf(stdout, "%s " type " (%s): " fmt, __FILE__, __func__, ## args); \
+		log_write(LOG_FLAGS, color, type, __FILE__, __func__, fmt, ## args); \
 	}
 
-#define printRaw_E(type, fmt, args...) \
+#define printRaw_E(color, type, fmt, args...) \
 	{ \
-		fprintf(stderr, "%s " type " (%s): " fmt, __FILE__, __func__, ## args); \
+		log_write(LOG_FLAGS | LOG_F_STDERR, color, type, __FILE__, __func__, fmt, ## args); \
 	}
 
 
 // /////////////////////
 // APPLICATION DEBUGGING
 // /////////////////////
-#ifdef WITH_TIMESTAMP
-	#define DBG_N(fmt, args...) \
-	  { if (debuglevel >= DBG_NOISY) {\
-			struct timeval t; \
-			gettimeofday(&t, NULL); \
-			fprintf(stdout, ANSI_YELLOW); \
-			fprintf(stdout, "[%08ld:%06ld] ", t.tv_sec, t.tv_usec); \
-			printRaw("NOISY", fmt,## args); \
-			fprintf(stdout, ANSI_RESET); \
-			fflush(stdout); \
-		} \
-	  }
-#else
-	#define DBG_N(fmt, args...) \
-	  { if (debuglevel >= DBG_NOISY) {\
-			fprintf(stdout, ANSI_YELLOW); \
-			printRaw("NOISY", fmt,## args); \
-			fprintf(stdout, ANSI_RESET); \
-			fflush(stdout); \
-		} \
-	  }
-#endif
+#define DBG_N(fmt, args...) \
+	{ if (DBG_ENABLED(debuglevel, DBG_NOISY)) printRaw(ANSI_YELLOW, "NOISY", fmt, ## args); }
 
-#ifdef WITH_TIMESTAMP
-	#define DBG_V(fmt, args...) \
-	  { if (debuglevel >= DBG_VERBOSE) {\
-			struct timeval t; \
-			gettimeofday(&t, NULL); \
-			fprintf(stdout, ANSI_BLUE); \
-			fprintf(stdout, "[%08ld:%06ld] ", t.tv_sec, t.tv_usec); \
-			printRaw("VERBOSE", fmt,## args); \
-			fprintf(stdout, ANSI_RESET); \
-			fflush(stdout); \
-		} \
-	  }
-#else
 #define DBG_V(fmt, args...) \
-	  { if (debuglevel >= DBG_VERBOSE) {\
-			fprintf(stdout, ANSI_BLUE); \
-			printRaw("VERBOSE", fmt,## args); \
-			fprintf(stdout, ANSI_RESET); \
-			fflush(stdout); \
-		} \
-	  }
-#endif
+	{ if (DBG_ENABLED(debuglevel, DBG_VERBOSE)) printRaw(ANSI_BLUE, "VERBOSE", fmt, ## args); }
 
-#ifdef WITH_TIMESTAMP
-	#define DBG_I(fmt, args...) \
-	  { if (debuglevel >= DBG_INFO) {\
-			struct timeval t; \
-			gettimeofday(&t, NULL); \
-			fprintf(stdout, ANSI_GREEN); \
-			fprintf(stdout, "[%08ld:%06ld] ", t.tv_sec, t.tv_usec); \
-			printRaw("INFO", fmt,## args); \
-			fprintf(stdout, ANSI_RESET); \
-			fflush(stdout); \
-		} \
-	  }
-#else
-	#define DBG_I(fmt, args...) \
-	  { if (debuglevel >= DBG_INFO) {\
-			fprintf(stdout, ANSI_GREEN); \
-			printRaw("INFO", fmt,## args); \
-			fprintf(stdout, ANSI_RESET); \
-			fflush(stdout); \
-		} \
-	  }
-#endif
+#define DBG_I(fmt, args...) \
+	{ if (DBG_ENABLED(debuglevel, DBG_INFO)) printRaw(ANSI_GREEN, "INFO", fmt, ## args); }
 
 #ifdef WITH_TIMESTAMP
 	#define DBG_E(fmt, args...) \
-	  { \
-		struct timeval t; \
-		gettimeofday(&t, NULL); \
-		fprintf(stdout, ANSI_RED); \
-		fprintf(stdout, "[%08ld:%06ld] ", t.tv_sec, t.tv_usec); \
-		printRaw("ERROR", fmt,## args); \
-		fprintf(stdout, ANSI_RESET); \
-		fflush(stdout); \
-	  }
+		printRaw(ANSI_RED, "ERROR", fmt, ## args)
 #else
 	#define DBG_E(fmt, args...) \
-	  { \
-		fprintf(stderr, ANSI_RED); \
-		printRaw_E("ERROR", fmt, ## args); \
-		fprintf(stderr, ANSI_RESET); \
-		fflush(stderr); \
-	  }
+		printRaw_E(ANSI_RED, "ERROR", fmt, ## args)
 #endif
 
 // /////////////////////
 // THREAD      DEBUGGING
 // /////////////////////
+#define THREAD_NOISY(fmt, args...) \
+	{ if (DBG_ENABLED(debuglevelThread, DBG_NOISY)) printRaw(ANSI_YELLOW, "THREAD NOISY ", fmt, ## args); }
 
-#ifdef WITH_TIMESTAMP
-	#define THREAD_NOISY(fmt, args...) \
-	{\
-		if (debuglevelThread >= DBG_NOISY) {\
-			struct timeval t; \
-			gettimeofday(&t, NULL); \
-			fprintf(stdout, ANSI_YELLOW); \
-			fprintf(stdout, "[%08ld:%06ld] ", t.tv_sec, t.tv_usec); \
-			printRaw("THREAD NOISY ", fmt,## args); \
-			fprintf(stdout, ANSI_RESET); \
-			fflush(stdout); \
-		}\
-	}
-#else
-	#define THREAD_NOISY(fmt, args...) \
-	{\
-		if (debuglevelThread >= DBG_NOISY) {\
-			fprintf(stdout, ANSI_YELLOW); \
-			printRaw("THREAD NOISY ", fmt,## args); \
-			fprintf(stdout, ANSI_RESET); \
-			fflush(stdout); \
-		}\
-	}
-#endif
-
-
-#ifdef WITH_TIMESTAMP
-	#define THREAD_VERBOSE(fmt, args...) \
-	{\
-		if (debuglevelThread >= DBG_VERBOSE) {\
-			struct timeval t; \
-			gettimeofday(&t, NULL); \
-			fprintf(stdout, ANSI_BLUE); \
-			fprintf(stdout, "[%08ld:%06ld] ", t.tv_sec, t.tv_usec); \
-			printRaw("THREAD VERBOSE ", fmt,## args); \
-			fprintf(stdout, ANSI_RESET); \
-			fflush(stdout); \
-		}\
-	}
-#else
-	#define THREAD_VERBOSE(fmt, args...) \
-	{\
-		if (debuglevelThread >= DBG_VERBOSE) {\
-			fprintf(stdout, ANSI_BLUE); \
-			printRaw("THREAD VERBOSE ", fmt,## args); \
-			fprintf(stdout, ANSI_RESET); \
-			fflush(stdout); \
-		}\
-	}
-#endif
+#define THREAD_VERBOSE(fmt, args...) \
+	{ if (DBG_ENABLED(debuglevelThread, DBG_VERBOSE)) printRaw(ANSI_BLUE, "THREAD VERBOSE ", fmt, ## args); }
 
-#ifdef WITH_TIMESTAMP
-	#define THREAD_PRINT(fmt, args...) \
-	{\
-		if (debuglevelThread >= DBG_INFO) {\
-			struct timeval t; \
-			gettimeofday(&t, NULL); \
-			fprintf(stdout, ANSI_GREEN); \
-			fprintf(stdout, "[%08ld:%06ld] ", t.tv_sec, t.tv_usec); \
-			printRaw("THREAD PRINT ", fmt,## args); \
-			fprintf(stdout, ANSI_RESET); \
-			fflush(stdout); \
-		}\
-	}
-#else
-	#define THREAD_PRINT(fmt, args...) \
-	{\
-		if (debuglevelThread >= DBG_INFO) {\
-			fprintf(stdout, ANSI_GREEN); \
-			printRaw("THREAD PRINT ", fmt,## args); \
-			fprintf(stdout, ANSI_RESET); \
-			fflush(stdout); \
-		}\
-	}
-#endif
+#define THREAD_PRINT(fmt, args...) \
+	{ if (DBG_ENABLED(debuglevelThread, DBG_INFO)) printRaw(ANSI_GREEN, "THREAD PRINT ", fmt, ## args); }
 
-#ifdef WITH_TIMESTAMP
-	#define THREAD_ERROR(fmt, args...) \
-	{\
-		struct timeval t; \
-		gettimeofday(&t, NULL); \
-		fprintf(stdout, ANSI_RED); \
-		fprintf(stdout, "[%08ld:%06ld] ", t.tv_sec, t.tv_usec); \
-		printRaw("THREAD ERROR ", fmt,## args); \
-		fprintf(stdout, ANSI_RESET); \
-		fflush(stdout); \
-	}
-#else
-	#define THREAD_ERROR(fmt, args...) \
-	{\
-		fprintf(stdout, ANSI_RED); \
-		printRaw("THREAD ERROR", fmt,## args); \
-		fprintf(stdout, ANSI_RESET); \
-		fflush(stdout); \
-	}
-#endif
+#define THREAD_ERROR(fmt, args...) \
+	printRaw(ANSI_RED, "THREAD ERROR ", fmt, ## args)
 
 // /////////////////////
 // DRIVER      DEBUGGING
 // /////////////////////
+#define DRIVER_NOISY(fmt, args...) \
+	{ if (DBG_ENABLED(debuglevelDriver, DBG_NOISY)) printRaw(ANSI_YELLOW, "DRIVER NOISY ", fmt, ## args); }
 
-#ifdef WITH_TIMESTAMP
-	#define DRIVER_NOISY(fmt, args...) \
-	{\
-		if (debuglevelDriver >= DBG_NOISY) {\
-			struct timeval t; \
-			gettimeofday(&t, NULL); \
-			fprintf(stdout, ANSI_YELLOW); \
-			fprintf(stdout, "[%08ld:%06ld] ", t.tv_sec, t.tv_usec); \
-			printRaw("DRIVER NOISY ", fmt,## args); \
-			fprintf(stdout, ANSI_RESET); \
-			fflush(stdout); \
-		}\
-	}
-#else
-	#define DRIVER_NOISY(fmt, args...) \
-	{\
-		if (debuglevelDriver >= DBG_NOISY) {\
-			fprintf(stdout, ANSI_YELLOW); \
-			printRaw("DRIVER NOISY ", fmt,## args); \
-			fprintf(stdout, ANSI_RESET); \
-			fflush(stdout); \
-		}\
-	}
-#endif
+#define DRIVER_VERBOSE(fmt, args...) \
+	{ if (DBG_ENABLED(debuglevelDriver, DBG_VERBOSE)) printRaw(ANSI_BLUE, "DRIVER VERBOSE ", fmt, ## args); }
 
+#define DRIVER_PRINT(fmt, args...) \
+	{ if (DBG_ENABLED(debuglevelDriver, DBG_INFO)) printRaw(ANSI_GREEN, "DRIVER PRINT ", fmt, ## args); }
 
-#ifdef WITH_TIMESTAMP
-	#define DRIVER_VERBOSE(fmt, args...) \
-	{\
-		if (debuglevelDriver >= DBG_VERBOSE) {\
-			struct timeval t; \
-			gettimeofday(&t, NULL); \
-			fprintf(stdout, ANSI_BLUE); \
-			fprintf(stdout, "[%08ld:%06ld] ", t.tv_sec, t.tv_usec); \
-			printRaw("DRIVER VERBOSE ", fmt,## args); \
-			fprintf(stdout, ANSI_RESET); \
-			fflush(stdout); \
-		}\
-	}
-#else
-	#define DRIVER_VERBOSE(fmt, args...) \
-	{\
-		if (debuglevelDriver >= DBG_VERBOSE) {\
-			fprintf(stdout, ANSI_BLUE); \
-			printRaw("DRIVER VERBOSE ", fmt,## args); \
-			fprintf(stdout, ANSI_RESET); \
-			fflush(stdout); \
-		}\
-	}
-#endif
-
-#ifdef WITH_TIMESTAMP
-	#define DRIVER_PRINT(fmt, args...) \
-	{\
-		if (debuglevelDriver >= DBG_INFO) {\
-			struct timeval t; \
-			gettimeofday(&t, NULL); \
-			fprintf(stdout, ANSI_GREEN); \
-			fprintf(stdout, "[%08ld:%06ld] ", t.tv_sec, t.tv_usec); \
-			printRaw("DRIVER PRINT ", fmt,## args); \
-			fprintf(stdout, ANSI_RESET); \
-			fflush(stdout); \
-		}\
-	}
-#else
-	#define DRIVER_PRINT(fmt, args...) \
-	{\
-		if (debuglevelDriver >= DBG_INFO) {\
-			fprintf(stdout, ANSI_GREEN); \
-			printRaw("DRIVER PRINT ", fmt,## args); \
-			fprintf(stdout, ANSI_RESET); \
-			fflush(stdout); \
-		}\
-	}
-#endif
+#define DRIVER_ERROR(fmt, args...) \
+	printRaw(ANSI_RED, "DRIVER ERROR ", fmt, ## args)
 
-#ifdef WITH_TIMESTAMP
-	#define DRIVER_ERROR(fmt, args...) \
-	{\
-		struct timeval t; \
-		gettimeofday(&t, NULL); \
-		fprintf(stdout, ANSI_RED); \
-		fprintf(stdout, "[%08ld:%06ld] ", t.tv_sec, t.tv_usec); \
-		printRaw("DRIVER ERROR ", fmt,## args); \
-		fprintf(stdout, ANSI_RESET); \
-		fflush(stdout); \
-	}
-#else
-	#define DRIVER_ERROR(fmt, args...) \
-	{\
-		fprintf(stdout, ANSI_RED); \
-		printRaw("DRIVER ERROR", fmt,## args); \
-		fprintf(stdout, ANSI_RESET); \
-		fflush(stdout); \
-	}
-#endif
-
-
-#define DBG_ERROR   0
-#define DBG_INFO    1
-#define DBG_VERBOSE 2
-#define DBG_NOISY   3
 
 #endif
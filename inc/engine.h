@@ -0,0 +1,127 @@
+#ifndef __ENGINE_INCLUDED__
+#define __ENGINE_INCLUDED__
+
+#include <stdint.h>
+#include <pthread.h>
+#include "protocol.h"
+#include "ringbuf.h"
+#include "window.h"
+#include "crc32.h"
+#include "prbs.h"
+#include "portstats.h"
+#include "statetime.h"
+
+/*
+ * Protocol engine of one port: the master/slave state machine of the
+ * test with everything it needs (state, buffers, receive ring, window,
+ * timers, statistics) in one object, so any number of ports can run in
+ * the same process. Both ends of a link start as slaves waiting for
+ * DOSLAVE; the first one whose wait expires sends a break and becomes
+ * the master.
+ * engine_step() runs one pass through the current state and returns:
+ * the states wait for their I/O with a deadline, so a pass never blocks
+ * longer than the command timeout. engine_run() is the loop of a thread
+ * dedicated to the port.
+ */
+
+#define ENGINE_BUFFER_SIZE	4096
+#define ENGINE_RX_RING_SIZE	(16 * 1024)   // at least a couple of whole frames
+
+typedef enum {
+	STATE_START = 0,
+
+	// SLAVE STATES
+	STATE_WAIT_COMMAND,
+	STATE_COMMAND_RECEIVED,
+	STATE_SEND_COMMAND_ACK,
+	STATE_WAIT_SERIAL_PACKET_SIGNATURE,
+	STATE_READ_SERIAL_PACKET,
+	STATE_WRITE_SERIAL_PACKET_ACK,
+	STATE_WRITE_SERIAL_PACKET_SIGNATURE_SLAVE,
+	STATE_WINDOW_RECEIVE,
+
+	// MASTER STATES
+	STATE_SEND_COMMAND,
+	STATE_SEND_BREAK,
+	STATE_WAIT_COMMAND_ACK,
+	STATE_WRITE_SERIAL_PACKET,
+	STATE_WAIT_SERIAL_PACKET_ACK,
+	STATE_WRITE_SERIAL_PACKET_SIGNATURE_MASTER,
+	STATE_WAIT_SERIAL_PACKET_ACK_SIGNATURE,
+	STATE_WINDOW_SEND,
+
+	// ISSUE STATES
+	STATE_RESYNC,
+	STATE_RESET_SERIAL,
+	STATE_RESET,
+	STATE_LAST, // Deve essere l'ultimo!
+} t_state;
+
+// [STATE_LAST + 1], for the messages and statetime_attach()
+extern const char *const engine_state_name[];
+
+typedef struct {
+	int fd;
+	const char *name;       // in the messages of the port
+	int baudrate;           // set again by STATE_RESET_SERIAL
+	int pre;
+	int post;
+	int payload;            // bytes of every frame sent as master
+	long command_timeout;   // msecs waiting for DOSLAVE before turning master
+	int window;             // frames in flight (-w), 0: stop-and-wait
+	t_crc_type crc;
+	long pace_us;           // sleep between two states (-p, -t), 0: none
+	t_prbs_type prbs;       // PRBS payload (-P), stop-and-wait only. PRBS_NONE: str
+} t_engine_config;
+
+typedef struct {
+	t_engine_config cfg;
+	char name[32];
+	t_state state;
+	t_state state_next;
+	long timeout;
+	int stop;
+	int goodpackettx;
+	int goodpacketrx;
+	t_signature sigread;
+	t_signature sigwrite;
+	t_trailer trailer;
+	const unsigned char *txpayload;  // the shared payload template, read only
+	uint32_t txcrc;                 // CRC of the master frame, computed once
+	// PRBS payload: the sequence sent as master, the one checked on receive
+	t_prbs prbs_tx;
+	t_prbs_check prbs_rx;
+	unsigned char *prbsbuf;
+	// Resynchronization: the signature looked for and where to go back
+	t_state resync_state;
+	uint32_t resync_word;
+	uint32_t resync_mask;
+	uint32_t resync_dropped;
+	int64_t resync_deadline;
+	t_ringbuf rxring;
+	t_window win;
+	t_portstats *stats;     // the table block of the fd, or own_stats
+	t_statetime *times;     // NULL if the fd was not attached
+	t_portstats own_stats;
+	// A frame that wraps the ring is copied here with its trailer
+	unsigned char bufread[ENGINE_BUFFER_SIZE + sizeof(t_trailer)];
+} t_engine;
+
+// After portstats_attach() and statetime_attach() of the fd. NULL if no memory.
+extern t_engine *engine_create(const t_engine_config *cfg);
+extern void engine_destroy(t_engine *e);
+
+// One pass through the current state. < 0 when the port is lost.
+extern int engine_step(t_engine *e);
+// Thread start routine: engine_step() until an error or engine_stop()
+extern void *engine_run(void *data);
+// Any thread: engine_run() returns at the end of the current pass
+extern void engine_stop(t_engine *e);
+// Stops and joins the engine_run() threads: the masters first, so they
+// end the frame in flight while their slaves still answer
+extern void engine_stop_join(t_engine *const engines[], const pthread_t threads[], int count);
+
+// Payload of the test frames at baudrate
+extern int engine_payload_len(int baudrate);
+
+#endif
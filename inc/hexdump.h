@@ -0,0 +1,32 @@
+#ifndef __HEXDUMP_INCLUDED__
+#define __HEXDUMP_INCLUDED__
+
+#include <stddef.h>
+
+/*
+ * Hex dump in the classic layout, 16 bytes per line:
+ *
+ *	00010   41 42 43 44 45 46 47 48  49 4a 4b 4c 4d 4e 4f 50    ABCDEFGHIJKLMNOP
+ *
+ * Every line is rendered with table lookups in a buffer and the lines
+ * go out a block at a time, one printR() (one logger record) every
+ * HEXDUMP_BLOCK_LINES lines instead of a few calls per byte, so a dump
+ * on the I/O thread costs about as much as copying the text.
+ * With a limit only the first and the last limit bytes of a longer
+ * buffer are printed, with one line counting the bytes skipped: the
+ * diagnostics can stay on in the field with big frames.
+ */
+
+#define HEXDUMP_WIDTH		16
+#define HEXDUMP_LINE_MAX	84     // offset up to 8 digits, newline and nul
+#define HEXDUMP_BLOCK_LINES	12     // a block fits in one record of the logger
+
+// Renders one line of at most HEXDUMP_WIDTH bytes, newline included. Returns its length.
+extern size_t hexdump_line(char *out, const unsigned char *data, int len, unsigned int offset);
+extern void hexdump(const unsigned char *data, int len);
+
+// 0 (default) dumps everything
+extern void hexdump_set_limit(int bytes);
+extern int hexdump_get_limit(void);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef __HISTOGRAM_INCLUDED__
+#define __HISTOGRAM_INCLUDED__
+
+#include <stdint.h>
+
+/*
+ * Log-linear (HDR style) histogram of non negative integer values, e.g.
+ * latencies in usecs. Values below 2^HIST_SUB_BITS are exact, above
+ * every power of two is split in 2^(HIST_SUB_BITS - 1) linear buckets:
+ * the relative error is below 1/2^(HIST_SUB_BITS - 1) (1.6%) over the
+ * whole range. Recording is O(1) with no allocation.
+ */
+
+#define HIST_SUB_BITS	7
+#define HIST_MAX_BITS	40      // values up to 2^40 - 1 (12 days in usecs)
+#define HIST_BUCKETS	((1 << HIST_SUB_BITS) + \
+				(HIST_MAX_BITS - HIST_SUB_BITS) * (1 << (HIST_SUB_BITS - 1)))
+
+typedef struct {
+	uint64_t count;
+	uint64_t min;
+	uint64_t max;
+	uint64_t sum;
+	uint32_t buckets[HIST_BUCKETS];
+} t_histogram;
+
+extern void hist_reset(t_histogram *h);
+extern void hist_record(t_histogram *h, uint64_t value);
+// Adds the samples of src to dst
+extern void hist_merge(t_histogram *dst, const t_histogram *src);
+// Highest value of the bucket holding the percentile p (0-100), 0 if empty
+extern uint64_t hist_percentile(const t_histogram *h, double p);
+extern double hist_mean(const t_histogram *h);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef __LOG_INCLUDED__
+#define __LOG_INCLUDED__
+
+/*
+ * Asynchronous logger behind the debug.h macros. The calling thread only
+ * takes a timestamp and copies the format pointer and the arguments into
+ * a ring of its own (single producer, no locks); a background thread
+ * merges the rings in time order, formats the lines and writes them.
+ * When a ring is full the message is dropped and counted: logging never
+ * stalls the serial I/O behind a slow console or pipe.
+ * The format is used later, so it must be a string literal. The %s
+ * arguments are copied (truncated to LOG_DATA_MAX), %n is not supported.
+ */
+
+#define LOG_F_TIMESTAMP	0x01    // "[sec:usec] " before the line
+#define LOG_F_STDERR	0x02
+#define LOG_F_RAW	0x04    // only the formatted text (printR)
+
+extern void log_write(unsigned int flags, const char *color, const char *type,
+	const char *file, const char *func, const char *fmt, ...)
+	__attribute__ ((format(printf, 6, 7)));
+
+// Writes out everything queued so far. Also called at exit().
+extern void log_flush(void);
+// Messages lost because a ring was full
+extern unsigned long log_dropped(void);
+
+/*
+ * Runtime levels per module: every debuglevel* variable of debug.h is
+ * registered with its module name (DBG_MODULE). On log_levels_request()
+ * the logger thread reads the levels file, lines "MODULE LEVEL" where
+ * LEVEL is 0-3 or error/info/verbose/noisy and MODULE "all" is every
+ * module, and applies it.
+ */
+extern void log_module(const char *name, int *level);
+extern void log_levels_file(const char *path);
+// Sets the level of a module, returns the previous one or < 0 if unknown
+extern int log_module_level(const char *name, int level);
+// Async-signal-safe
+extern void log_levels_request(void);
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef __MULTIPORT_INCLUDED__
+#define __MULTIPORT_INCLUDED__
+
+#include "engine.h"
+
+/*
+ * Test of many ports at once, described by a config file with one port
+ * per line:
+ *
+ *	# NAME  DEVICE        BAUD    PEER  [PRE [POST]]
+ *	a0      /dev/ttyS0    115200  b0    0   0
+ *	b0      /dev/ttyUSB3  115200  a0
+ *
+ * Every port names its peer, the other end of the cable; the two must
+ * name each other. PRE and POST are the RS485 RTS delays in msecs.
+ * Both ends on the same DEVICE is a virtual link (pty, null...).
+ * The ports are opened in parallel by a bounded pool of workers, then
+ * every port gets a protocol engine and its thread; all the engines
+ * wait on a barrier and start together, so the load is simultaneous.
+ */
+
+#define MULTIPORT_MAX_PORTS	64
+#define MULTIPORT_WORKERS	8      // default size of the pool opening the ports
+
+typedef struct {
+	char name[32];
+	char device[256];
+	char peer_name[32];
+	int baudrate;
+	int pre;
+	int post;
+	int peer;               // index of the peer
+	int line;               // in the config file
+} t_multiport_port;
+
+typedef struct {
+	int nports;
+	t_multiport_port ports[MULTIPORT_MAX_PORTS];
+} t_multiport_config;
+
+// < 0 if the file cannot be read or a line is wrong
+extern int multiport_load(t_multiport_config *cfg, const char *path);
+
+/*
+ * Runs every pair for 'seconds' (0: until a signal) and prints the
+ * results. tmpl gives window, CRC, pacing and command timeout of every
+ * engine; the payload follows the slower port of each pair.
+ * Returns the total of the errors, < 0 if the ports cannot be started.
+ */
+extern int multiport_run(const t_multiport_config *cfg, const t_engine_config *tmpl,
+	int workers, int seconds);
+
+// Per-port and total throughput and errors; from any thread while running
+extern void multiport_print(void);
+
+#endif
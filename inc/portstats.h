@@ -0,0 +1,106 @@
+#ifndef __PORTSTATS_INCLUDED__
+#define __PORTSTATS_INCLUDED__
+
+#include <stdint.h>
+#include "transport.h"
+#include "histogram.h"
+
+/*
+ * Per-port statistics of the protocol. Every port has its own block on
+ * its own cache lines: the thread running the port is the only writer of
+ * the counters and updates them with relaxed stores (no locked
+ * instruction on the hot path), any other thread (a monitor, the signal
+ * thread) reads them with relaxed loads and never takes a lock.
+ * Counters are word sized so loads and stores are single instructions on
+ * every target, 32 bit ARM included.
+ * The recovery time is the time from the first error to the next good
+ * frame: how long a fault keeps the link down, reset or resync included.
+ */
+
+#define PORTSTATS_CACHELINE	64
+#define PORTSTATS_MAX		64
+
+typedef unsigned long t_portstats_cnt;
+
+typedef enum {
+	PORTSTATS_ERR_IO,         // read/write/poll failed
+	PORTSTATS_ERR_TIMEOUT,    // the peer did not answer in time
+	PORTSTATS_ERR_SHORT,      // frame or write shorter than expected
+	PORTSTATS_ERR_SIGNATURE,  // bad signature, resynchronization started
+	PORTSTATS_ERR_PAYLOAD,    // echo mismatch, CRC error or NAK
+	PORTSTATS_ERR_COMMAND,    // junk instead of the expected command
+	PORTSTATS_ERR_LAST
+} t_portstats_err;
+
+typedef struct {
+	t_portstats_cnt frames_tx;      // good frames sent (acknowledged)
+	t_portstats_cnt frames_rx;      // good frames received
+	t_portstats_cnt bytes_tx;       // payload of the good frames
+	t_portstats_cnt bytes_rx;
+	t_portstats_cnt errors[PORTSTATS_ERR_LAST];
+	t_portstats_cnt resets;
+	t_portstats_cnt resyncs;        // recovered without a reset
+	t_portstats_cnt resync_bytes;   // dropped while resynchronizing
+	// PRBS payload (-P): bits checked while locked, wrong ones, locks lost
+	t_portstats_cnt prbs_bits;
+	t_portstats_cnt prbs_errors;
+	t_portstats_cnt prbs_losses;
+	// TIOCGICOUNT since portstats_attach(), refreshed by serial_device_status()
+	t_portstats_cnt line_rx;
+	t_portstats_cnt line_tx;
+	t_portstats_cnt frame;
+	t_portstats_cnt overrun;
+	t_portstats_cnt parity;
+	t_portstats_cnt brk;            // breaks seen
+	t_portstats_cnt buf_overrun;
+	// Copied from the shared line by portstats_read()
+	t_portstats_cnt breaks_sent;
+} t_portstats_counters;
+
+typedef struct {
+	// Owner thread only
+	t_portstats_counters c __attribute__ ((aligned(PORTSTATS_CACHELINE)));
+	int64_t fault_us;               // first error not yet recovered, 0: none
+	t_histogram recovery;           // usecs, read only when the owner stopped
+	// Any thread: the break injector sends breaks on both ports
+	t_portstats_cnt breaks_sent __attribute__ ((aligned(PORTSTATS_CACHELINE)));
+	// Set once by portstats_attach()
+	int fd __attribute__ ((aligned(PORTSTATS_CACHELINE)));
+	char name[32];
+	t_transport_stats base;
+} t_portstats;
+
+// Owner thread only: one relaxed store, no read-modify-write on the bus
+#define PORTSTATS_ADD(ps, field, n) \
+	__atomic_store_n(&(ps)->c.field, (ps)->c.field + (n), __ATOMIC_RELAXED)
+#define PORTSTATS_INC(ps, field)	PORTSTATS_ADD(ps, field, 1)
+#define PORTSTATS_ERROR(ps, cls) \
+	do { PORTSTATS_INC(ps, errors[cls]); portstats_fault(ps); } while (0)
+// After the counters of a good frame: closes the open fault, if any
+#define PORTSTATS_GOOD(ps) \
+	do { if ((ps)->fault_us != 0) portstats_recovered(ps); } while (0)
+
+// Before the port threads start. NULL if the table is full.
+extern t_portstats *portstats_attach(int fd, const char *name);
+// NULL if fd was not attached
+extern t_portstats *portstats_of(int fd);
+extern int portstats_count(void);
+extern t_portstats *portstats_at(int idx);
+
+// Owner thread only, through PORTSTATS_ERROR and PORTSTATS_GOOD
+extern void portstats_fault(t_portstats *ps);
+extern void portstats_recovered(t_portstats *ps);
+
+// Any thread
+extern void portstats_break_sent(int fd);
+// Line counters of the port minus the ones at portstats_attach()
+extern void portstats_line(int fd, const t_transport_stats *st);
+
+// Lock-free snapshot, from any thread
+extern void portstats_read(const t_portstats *ps, t_portstats_counters *out);
+extern t_portstats_cnt portstats_errors(const t_portstats_counters *c);
+// Name and value of the idx-th counter, NULL past the last one
+extern const char *portstats_field(const t_portstats_counters *c, int idx, t_portstats_cnt *value);
+extern const char *portstats_err_name(t_portstats_err cls);
+
+#endif
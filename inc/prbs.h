@@ -0,0 +1,63 @@
+#ifndef __PRBS_INCLUDED__
+#define __PRBS_INCLUDED__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Pseudo random bit sequences of ITU-T O.150 for the payload:
+ * PRBS-7 (x^7 + x^6 + 1), PRBS-15 (x^15 + x^14 + 1) and PRBS-31
+ * (x^31 + x^28 + 1). The bits go in every byte LSB first, the order
+ * of the UART on the line. The sequence runs on across the frames.
+ * The checker needs no copy of what was sent: it loads its register
+ * from the first bits received, and once they predict PRBS_LOCK_BITS
+ * bits in a row it is locked and compares every following bit with
+ * its own copy of the sequence, so one wrong bit is one error. The
+ * memory is O(1) whatever the length of the stream. With
+ * PRBS_LOSS_ERRORS errors in the last 64 bits (a lost frame, a slip)
+ * the lock is lost: those bits are taken out of the count and the
+ * checker locks again on the following bits.
+ */
+
+#define PRBS_LOCK_BITS		32
+#define PRBS_LOSS_ERRORS	16
+
+typedef enum {
+	PRBS_NONE = 0,
+	PRBS_7 = 7,
+	PRBS_15 = 15,
+	PRBS_31 = 31,
+} t_prbs_type;
+
+typedef struct {
+	t_prbs_type type;
+	uint32_t state;         // the last 'type' bits, the newest in bit 0
+} t_prbs;
+
+typedef struct {
+	t_prbs gen;             // received bits while locking, then the local sequence
+	int locked;
+	int fill;               // bits loaded in the register while not locked
+	int run;                // bits predicted in a row while locking
+	uint64_t recent;        // errors of the last 64 bits checked
+	uint64_t since;         // bits checked since the lock
+	uint64_t bits;          // bits checked while locked
+	uint64_t errors;
+	uint64_t losses;        // locks lost
+} t_prbs_check;
+
+// PRBS_NONE if order is not 7, 15 or 31
+extern t_prbs_type prbs_type(int order);
+extern const char *prbs_name(t_prbs_type type);
+
+extern void prbs_init(t_prbs *g, t_prbs_type type);
+// The next len bytes of the sequence
+extern void prbs_fill(t_prbs *g, unsigned char *buf, size_t len);
+
+extern void prbs_check_init(t_prbs_check *v, t_prbs_type type);
+// Checks the next len bytes received. Returns the wrong bits among them.
+extern int prbs_check(t_prbs_check *v, const unsigned char *buf, size_t len);
+// Bit error rate of the bits checked, 0 if none
+extern double prbs_ber(const t_prbs_check *v);
+
+#endif
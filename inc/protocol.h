@@ -0,0 +1,56 @@
+#ifndef __PROTOCOL_INCLUDED__
+#define __PROTOCOL_INCLUDED__
+
+#include <stdint.h>
+#include "crc32.h"
+
+/*
+ * Frame signature exchanged before every payload by the test protocol
+ */
+#define SERIAL_SIGNATURE_HEADER  0x12345678
+#define SERIAL_SIGNATURE_FOOTER  0xdeadbeef
+typedef struct {
+	uint32_t header;
+	uint32_t len;
+	uint32_t footer;
+} t_signature;
+
+/*
+ * Checksum mode: the frame carries a CRC of signature and payload in a
+ * trailer and the slave answers with a signature holding ACK or NAK in
+ * the header (same len) instead of echoing the whole packet.
+ */
+#define SERIAL_SIGNATURE_ACK     0x1234567b
+#define SERIAL_SIGNATURE_NAK     0x1234567c
+// All the headers of the protocol (ACK and NAK too) differ only in the low byte
+#define SERIAL_SIGNATURE_REPLY_MASK 0xffffff00
+typedef struct {
+	uint32_t crc;
+} t_trailer;
+
+/*
+ * Windowed (pipelined) mode: data frames carry a sequence number, the
+ * receiver answers with cumulative ACKs carrying the next sequence
+ * number it expects (len is 0).
+ */
+#define SERIAL_WINDOW_DATA_HEADER  0x12345679
+#define SERIAL_WINDOW_ACK_HEADER   0x1234567a
+typedef struct {
+	uint32_t header;
+	uint32_t seq;
+	uint32_t len;
+	uint32_t footer;
+} t_window_signature;
+
+/*
+ * Checks shared by the engine, the benchmark, the windowed mode and the
+ * replay of a capture, so they all accept the same frames.
+ */
+// 1 if the header matches on the bits of mask, the footer is right and len <= maxlen
+extern int protocol_signature_ok(const t_signature *sig, uint32_t header, uint32_t mask, uint32_t maxlen);
+// CRC of signature and payload: the trailer of the frame
+extern uint32_t protocol_frame_crc(t_crc_type type, const t_signature *sig, const void *payload, uint32_t len);
+// 1 if the trailer after the len bytes of frame (signature included) matches
+extern int protocol_trailer_ok(t_crc_type type, const unsigned char *frame, uint32_t len);
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef __REACTOR_INCLUDED__
+#define __REACTOR_INCLUDED__
+
+#include <stdint.h>
+
+/*
+ * Single threaded event loop (epoll) for the reactor benchmark only.
+ * Every fd registers together with a handler: the reactor calls the
+ * handler with the events that occurred, so every link can run its own
+ * state machine without a dedicated thread. The handlers do raw
+ * read()/write() on the fds; testunit does not use it, its ports go
+ * through serial.h with a thread per port.
+ */
+
+#define REACTOR_EV_READABLE	0x01
+#define REACTOR_EV_WRITABLE	0x02
+#define REACTOR_EV_TIMEOUT	0x04
+#define REACTOR_EV_ERROR	0x08
+
+typedef struct t_reactor t_reactor;
+typedef struct t_reactor_port t_reactor_port;
+
+// Returning < 0 from the handler removes the port from the reactor
+typedef int (*t_reactor_handler)(t_reactor_port *port, int events);
+
+struct t_reactor_port {
+	int fd;
+	int interest;              // REACTOR_EV_READABLE | REACTOR_EV_WRITABLE
+	int64_t deadline_ms;       // CLOCK_MONOTONIC, 0 = no timeout
+	t_reactor_handler handler;
+	void *priv;                // protocol state machine data
+	t_reactor *reactor;        // owned by the reactor, do not touch
+	int slot;                  // owned by the reactor, do not touch
+};
+
+extern t_reactor *reactor_create(int maxports);
+extern void reactor_destroy(t_reactor *r);
+
+// The port structure must stay valid until it is removed
+extern int reactor_add(t_reactor *r, t_reactor_port *port);
+extern int reactor_del(t_reactor_port *port);
+extern int reactor_set_interest(t_reactor_port *port, int interest);
+// ms <= 0 disarms the timeout
+extern void reactor_set_timeout(t_reactor_port *port, long ms);
+
+// Dispatch one batch of events, waiting at most maxwait msecs (< 0 forever)
+extern int reactor_run_once(t_reactor *r, long maxwait);
+// Loop until reactor_stop() or until no port is left
+extern int reactor_run(t_reactor *r);
+extern void reactor_stop(t_reactor *r);
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef __REPLAY_INCLUDED__
+#define __REPLAY_INCLUDED__
+
+#include <stdint.h>
+
+/*
+ * Replay of a wire capture (capture.h) through the frame parser: the
+ * bytes every port received are pushed in a receive ring chunk by chunk,
+ * as serial_read_ring_until() would, and cut in frames (signature,
+ * payload, CRC trailer), replies and window frames, with the same
+ * resynchronization after junk or a bad signature. At the original
+ * timing it reproduces what the receiver saw in the field, at full speed
+ * it measures the throughput of the parser.
+ */
+
+typedef struct {
+	uint64_t chunks;
+	uint64_t bytes;
+	uint64_t frames;        // data frames
+	uint64_t acks;
+	uint64_t naks;
+	uint64_t window_frames;
+	uint64_t window_acks;
+	uint64_t crc_errors;
+	uint64_t bad_signatures;
+	uint64_t junk;          // bytes skipped looking for a header (commands too)
+	uint64_t breaks;        // breaks sent by the port
+} t_replay_stats;
+
+// passes > 1 repeats the whole capture (throughput). < 0 if error.
+extern int replay_run(const char *path, int realtime, int passes);
+
+#endif
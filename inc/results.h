@@ -0,0 +1,79 @@
+#ifndef __RESULTS_INCLUDED__
+#define __RESULTS_INCLUDED__
+
+#include <stdio.h>
+
+/*
+ * Machine readable results of a run, to gate a driver, adapter or kernel
+ * update on numbers instead of on the coloured console output. A result
+ * is a set of configuration strings, the raw counters of every port and
+ * a list of metrics; every metric keeps the value of each repeated run
+ * so two files can be compared with their confidence intervals.
+ * The file is JSON, or CSV when the name ends with ".csv"; both are
+ * written one metric per line and results_load() reads back either.
+ */
+
+#define RESULTS_MAX_CONFIG	32
+#define RESULTS_MAX_COUNTERS	2048
+#define RESULTS_MAX_METRICS	512
+#define RESULTS_MAX_SAMPLES	32
+
+#define RESULTS_HIGHER		1     // a higher value is better (goodput)
+#define RESULTS_LOWER		-1    // a lower value is better (latency, errors)
+
+typedef struct {
+	char key[32];
+	char value[128];
+} t_results_config;
+
+typedef struct {
+	char port[16];
+	char name[32];
+	unsigned long long value;
+} t_results_counter;
+
+typedef struct {
+	char name[64];
+	char unit[16];
+	int better;
+	int n;
+	double samples[RESULTS_MAX_SAMPLES];
+} t_results_metric;
+
+typedef struct {
+	int nconfig;
+	int ncounters;
+	int nmetrics;
+	t_results_config config[RESULTS_MAX_CONFIG];
+	t_results_counter counters[RESULTS_MAX_COUNTERS];
+	t_results_metric metrics[RESULTS_MAX_METRICS];
+} t_results;
+
+extern void results_init(t_results *r);
+// A key set twice keeps the last value
+extern void results_config(t_results *r, const char *key, const char *fmt, ...)
+	__attribute__ ((format(printf, 3, 4)));
+extern void results_counter(t_results *r, const char *port, const char *name,
+	unsigned long long value);
+// Finds or adds the metric, NULL if the table is full
+extern t_results_metric *results_metric(t_results *r, const char *unit, int better,
+	const char *fmt, ...) __attribute__ ((format(printf, 4, 5)));
+// One value per run: samples beyond RESULTS_MAX_SAMPLES are dropped
+extern void results_sample(t_results_metric *m, double value);
+
+// Mean, standard deviation and half width of the 95% confidence interval
+extern void results_stats(const t_results_metric *m, double *mean, double *sd, double *ci95);
+
+extern int results_write(const t_results *r, const char *path);
+// Only the configuration and the metrics are read back
+extern int results_load(t_results *r, const char *path);
+
+/*
+ * Prints every metric of the baseline next to the candidate. A metric is
+ * a regression when it got worse by at least threshold percent and, with
+ * two runs or more on both sides, the difference passes Welch's t-test
+ * at 95%. Returns the number of regressions.
+ */
+extern int results_compare(const t_results *base, const t_results *cand, double threshold);
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef __RESYNC_INCLUDED__
+#define __RESYNC_INCLUDED__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "ringbuf.h"
+
+/*
+ * Stream resynchronization: after a bad signature the receiver looks for
+ * the next header in the byte stream instead of tearing the session down.
+ * Words are compared as laid out in memory (host order, like they are
+ * sent on the line); only the bytes selected by mask are compared.
+ * The search runs on AVX2 or SSE2 on x86, bytewise elsewhere.
+ */
+
+// Offset of the first word in buf, -1 if not found
+extern long resync_find(const void *buf, size_t len, uint32_t word, uint32_t mask);
+
+// Drops from the ring the bytes before the first word. When the word is
+// not there only the last 3 bytes are kept, they may be its beginning.
+// Returns the bytes dropped.
+extern uint32_t resync_ring(t_ringbuf *rb, uint32_t word, uint32_t mask);
+
+extern const char *resync_impl_name(void);
+
+#endif
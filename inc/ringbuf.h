@@ -0,0 +1,52 @@
+#ifndef __RINGBUF_INCLUDED__
+#define __RINGBUF_INCLUDED__
+
+#include <stdint.h>
+#include <sys/uio.h>
+
+/*
+ * Lock-free single producer / single consumer byte ring.
+ * The producer only moves head, the consumer only moves tail: the two
+ * indexes live on different cache lines so the threads can sit on
+ * different cores without bouncing the same line.
+ * Indexes are free running, the size must be a power of two.
+ */
+
+#define RINGBUF_CACHELINE	64
+
+typedef struct {
+	uint32_t head __attribute__ ((aligned(RINGBUF_CACHELINE)));   // producer
+	uint32_t tail __attribute__ ((aligned(RINGBUF_CACHELINE)));   // consumer
+	unsigned char *data __attribute__ ((aligned(RINGBUF_CACHELINE)));
+	uint32_t size;
+	uint32_t mask;
+} t_ringbuf;
+
+extern int ringbuf_init(t_ringbuf *rb, uint32_t size);
+extern void ringbuf_free(t_ringbuf *rb);
+// Only when neither side is running
+extern void ringbuf_reset(t_ringbuf *rb);
+
+extern uint32_t ringbuf_used(t_ringbuf *rb);
+extern uint32_t ringbuf_space(t_ringbuf *rb);
+
+// Producer side
+extern int ringbuf_write(t_ringbuf *rb, const unsigned char *buf, uint32_t len);
+// One bulk readv() of everything available on fd that fits in the ring,
+// through the given readv (the one of the transport of fd).
+// -ECERR_IO on error or EOF, the cause in errno
+extern int ringbuf_fill_fd(t_ringbuf *rb, int fd,
+	ssize_t (*do_readv)(int fd, const struct iovec *iov, int iovcnt));
+
+// Consumer side
+// Pointer to len bytes at the tail, in place. Only when the bytes wrap
+// around the end of the ring they are copied in scratch (len bytes).
+extern const unsigned char *ringbuf_peek(t_ringbuf *rb, uint32_t len, unsigned char *scratch);
+// Copy of up to len bytes at the tail, left in the ring
+extern int ringbuf_copy(t_ringbuf *rb, unsigned char *buf, uint32_t len);
+extern int ringbuf_read(t_ringbuf *rb, unsigned char *buf, uint32_t len);
+// The bytes at the tail in place, as one or two segments (0 if empty)
+extern int ringbuf_segments(t_ringbuf *rb, struct iovec iov[2]);
+extern void ringbuf_consume(t_ringbuf *rb, uint32_t len);
+
+#endif
@@ -1,21 +1,59 @@
 #ifndef __SERIAL_INCLUDED__
 #define __SERIAL_INCLUDED__
 
+#include <stdint.h>
 #include <termios.h>
+#include <sys/uio.h>
+#include "ringbuf.h"
 #include "debug.h"
 
 extern int serial_device_init(const char *name, int baudrate, int pre, int post);
 extern int serial_device_reset(int fd, int baudrate, int pre, int post);
 extern void serial_device_status(int fd);
 extern int serial_send_break(int fd);
+// Low latency profile, opt-in before serial_device_init(): the port is
+// opened without O_FSYNC, with ASYNC_LOW_LATENCY and the usb-serial
+// latency_timer at 1 msec. Each knob is checked after being set.
+#define SERIAL_LOWLAT_NO_FSYNC    0x01
+#define SERIAL_LOWLAT_ASYNC       0x02
+#define SERIAL_LOWLAT_USB_TIMER   0x04
+extern void serial_set_low_latency(int enable);
+// Root of sysfs, "/sys" by default (a fake tree for testing)
+extern void serial_set_sysfs_root(const char *root);
+// The SERIAL_LOWLAT_* knobs that took effect on the port
+extern unsigned int serial_low_latency_applied(int fd);
+// Configured baudrate of the port, -1 if unknown
+extern int serial_get_baudrate(int fd);
+
+// Deadlines are absolute CLOCK_MONOTONIC times in milliseconds
+extern int64_t serial_now_ms(void);
+extern int64_t serial_deadline_in(long ms);
+extern long serial_time_left(int64_t deadline);
+// Wire time of len characters (8N1) in milliseconds
+extern long serial_transfer_time(int baudrate, int len);
+// Deadline for len characters at the port baudrate plus slack msecs
+extern int64_t serial_transfer_deadline(int fd, int len, long slack);
 
 // String oriented functions (EOL /r/n terminated)
+// The read buffer must hold at least SERIAL_STRING_MAXLEN bytes
+#define SERIAL_STRING_MAXLEN	4096
 extern int serial_send_string(int fd, const unsigned char *string);
 extern int serial_read_string(int fd, unsigned char *buf, long to);
+extern int serial_read_string_until(int fd, unsigned char *buf, int64_t deadline);
 
 // Byte oriented function (length oriented)
 extern int serial_send_raw(int fd, const unsigned char *buf, int len);
 extern int serial_read_raw(int fd, unsigned char *buf, int len);
+extern int serial_read_raw_until(int fd, unsigned char *buf, int len, int64_t deadline);
+// Bulk reads into the port receive ring until it holds len bytes
+extern int serial_read_ring_until(int fd, t_ringbuf *rb, int len, int64_t deadline);
+
+// Scatter/gather: a whole frame (header, payload, trailer) in one writev().
+// Short writes are continued until everything is sent or the deadline
+// (by default the frame wire time plus one second) expires.
+#define SERIAL_MAX_IOV	8
+extern int serial_send_iov(int fd, const struct iovec *iov, int iovcnt);
+extern int serial_send_iov_until(int fd, const struct iovec *iov, int iovcnt, int64_t deadline);
 
 extern void serial_flush_rx(int serfd);
 extern void serial_flush_tx(int serfd);
@@ -0,0 +1,80 @@
+#ifndef __STATETIME_INCLUDED__
+#define __STATETIME_INCLUDED__
+
+#include <stdint.h>
+#include <time.h>
+#include "histogram.h"
+
+/*
+ * Time accounting of a protocol state machine, per port. Every pass of
+ * the loop through a state is timed (usecs, the I/O the state waits for
+ * included, the paced mode sleep excluded) into the histogram of that
+ * state, and every change of state is counted in a transition matrix.
+ * The cost is two vDSO clock reads per pass, no lock: only the thread
+ * running the port writes its block.
+ * statetime_request() asks every port to print its own block at the
+ * next pass, from its own thread, so the numbers are consistent.
+ */
+
+#define STATETIME_MAX		64
+
+typedef struct {
+	int fd;
+	char name[32];
+	int nstates;
+	const char *const *names;
+	int64_t start;                  // attach time, for the share of each state
+	int64_t t0;                     // start of the current pass
+	unsigned int seen;              // last print request served
+	t_histogram *time;              // [nstates]
+	uint64_t *transitions;          // [from * nstates + to]
+} t_statetime;
+
+// Before the port threads start. NULL if the table is full or no memory.
+extern t_statetime *statetime_attach(int fd, const char *name, int nstates, const char *const names[]);
+// NULL if fd was not attached
+extern t_statetime *statetime_of(int fd);
+
+extern void statetime_print(const t_statetime *st);
+extern void statetime_print_all(void);
+// Async-signal-safe: every port prints itself at its next pass
+extern void statetime_request(void);
+
+// Bumped by statetime_request()
+extern unsigned int statetime_requests;
+
+static inline int64_t statetime_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000000L + ts.tv_nsec / 1000L;
+}
+
+// At the top of the loop, before the state runs
+static inline void statetime_enter(t_statetime *st)
+{
+	unsigned int req;
+
+	if (st == NULL)
+		return;
+	req = __atomic_load_n(&statetime_requests, __ATOMIC_RELAXED);
+	if (req != st->seen)
+	{
+		st->seen = req;
+		statetime_print(st);
+	}
+	st->t0 = statetime_now();
+}
+
+// After the state ran, with the state chosen for the next pass
+static inline void statetime_leave(t_statetime *st, int state, int next)
+{
+	if (st == NULL)
+		return;
+	hist_record(&st->time[state], statetime_now() - st->t0);
+	if (next != state)
+		st->transitions[state * st->nstates + next]++;
+}
+
+#endif
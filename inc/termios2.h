@@ -0,0 +1,15 @@
+#ifndef __TERMIOS2_INCLUDED__
+#define __TERMIOS2_INCLUDED__
+
+/*
+ * Arbitrary integer baud rates through the Linux termios2 ioctls
+ * (BOTHER). Kept in their own unit because <asm/termbits.h> clashes
+ * with the glibc <termios.h> used everywhere else.
+ */
+
+// Sets input and output speed, leaves the other settings untouched
+extern int serial_termios2_set_speed(int fd, int baudrate);
+// Output speed actually applied by the driver, < 0 if error
+extern int serial_termios2_get_speed(int fd);
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef __TRANSPORT_INCLUDED__
+#define __TRANSPORT_INCLUDED__
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/*
+ * Transports behind the serial.h API. Every port is still a file
+ * descriptor, the transport decides how it is opened and configured and
+ * how the line level operations (baud rate, break, flush, counters) are
+ * done. The serial_*() functions look the transport up by fd, the fds
+ * that were not opened through transport_open() are ttys.
+ *
+ *   /dev/...           tty: real serial port (any character device)
+ *   pty                pseudo terminal pair
+ *   null, null:paced   in-memory null-modem (see vlink.h)
+ *   unix[:PATH]        Unix domain socket pair (abstract name by default)
+ *   tcp[:PORT]         TCP loopback pair on 127.0.0.1 (ephemeral port by default)
+ */
+
+typedef struct {
+	uint64_t rx_bytes;
+	uint64_t tx_bytes;
+	uint64_t reads;         // read()/readv() calls
+	uint64_t writes;        // writev() calls
+	uint64_t waits;         // poll() calls
+	// Line counters, only from the transports that have a line
+	uint64_t line_rx;
+	uint64_t line_tx;
+	uint64_t frame;
+	uint64_t overrun;
+	uint64_t parity;
+	uint64_t brk;
+	uint64_t buf_overrun;
+} t_transport_stats;
+
+typedef struct {
+	const char *name;
+	const char *prefix;     // NULL: device path
+	int (*open)(const char *name, int baudrate);
+	int (*reset)(int fd, int baudrate, int pre, int post);
+	int (*get_baudrate)(int fd);
+	ssize_t (*readv)(int fd, const struct iovec *iov, int iovcnt);
+	ssize_t (*writev)(int fd, const struct iovec *iov, int iovcnt);
+	// poll() style: 1 ready, 0 timeout, < 0 error (errno set)
+	int (*wait)(int fd, short events, int timeout_ms, short *revents);
+	int (*send_break)(int fd);
+	void (*flush_rx)(int fd);
+	void (*flush_tx)(int fd);
+	// Line counters of the transport, the software ones are filled by the caller
+	void (*stats)(int fd, t_transport_stats *st);
+} t_transport_ops;
+
+extern const t_transport_ops transport_tty;
+extern const t_transport_ops transport_pty;
+extern const t_transport_ops transport_null;
+extern const t_transport_ops transport_unix;
+extern const t_transport_ops transport_tcp;
+
+// Opens name with the transport it selects, < 0 if error
+extern int transport_open(const char *name, int baudrate);
+extern void transport_close(int fd);
+extern const t_transport_ops *transport_of(int fd);
+
+// Per-port flags of the driver (SERIAL_LOWLAT_* of serial.h)
+extern unsigned int transport_get_flags(int fd);
+extern void transport_set_flags(int fd, unsigned int flags);
+
+// Software counters of the port, updated by serial.c
+extern t_transport_stats *transport_counters(int fd);
+extern void transport_get_stats(int fd, t_transport_stats *st);
+
+// Plain fd implementations shared by the transports
+extern ssize_t transport_fd_readv(int fd, const struct iovec *iov, int iovcnt);
+extern ssize_t transport_fd_writev(int fd, const struct iovec *iov, int iovcnt);
+extern int transport_fd_wait(int fd, short events, int timeout_ms, short *revents);
+
+#endif
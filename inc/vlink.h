@@ -0,0 +1,27 @@
+#ifndef __VLINK_INCLUDED__
+#define __VLINK_INCLUDED__
+
+/*
+ * Virtual links: both ends of a null-modem cable inside the process, to
+ * run the protocol without serial hardware.
+ *   "pty"         openpty() pair: two real ttys, the whole termios path
+ *   "null"        in-memory null-modem, full software speed
+ *   "null:paced"  in-memory null-modem delivering the bytes at the baud
+ *                 rate of the sending end (8N1)
+ *   "unix[:PATH]" Unix domain socket pair, abstract name without PATH
+ *   "tcp[:PORT]"  TCP loopback pair on 127.0.0.1, TCP_NODELAY
+ * The first serial_device_init() of a virtual name creates the link and
+ * returns one end, the next one with the same name returns the other.
+ */
+
+#define VLINK_PTY          "pty"
+#define VLINK_NULL         "null"
+#define VLINK_NULL_PACED   "null:paced"
+#define VLINK_UNIX         "unix"
+#define VLINK_TCP          "tcp"
+
+// One end of the link (non blocking), < 0 if error.
+// Used as the open() of the pty, null, unix and tcp transports.
+extern int vlink_open(const char *name, int baudrate);
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef __WINDOW_INCLUDED__
+#define __WINDOW_INCLUDED__
+
+#include <stdint.h>
+#include "ringbuf.h"
+#include "protocol.h"
+#include "crc32.h"
+
+/*
+ * Sliding window (go-back-N) transfer: the sender keeps up to 'window'
+ * frames in flight and the receiver acknowledges cumulatively, so the
+ * line is never idle waiting for the turnaround of every frame.
+ */
+
+#define WINDOW_MAX_PAYLOAD	4096
+#define WINDOW_MAX_RETRIES	5
+
+typedef struct {
+	int fd;
+	t_ringbuf *rx;        // receive ring of the port
+	int window;           // frames in flight
+	t_crc_type crc;       // frames carry a CRC trailer (CRC_NONE: no trailer)
+	uint32_t base;        // sender: oldest unacknowledged frame
+	uint32_t next;        // sender: next frame to send
+	uint32_t expected;    // receiver: next frame in order
+	int64_t start_ms;
+	// statistics
+	uint64_t frames;      // frames sent / accepted in order
+	uint64_t retransmits;
+	uint64_t duplicates;  // frames received out of order and dropped
+	uint64_t acks;
+	uint64_t bytes;       // payload bytes acknowledged / accepted
+	uint64_t errors;
+} t_window;
+
+extern void window_init(t_window *w, int fd, t_ringbuf *rx, int window);
+extern void window_reset(t_window *w);
+
+// Sends 'frames' frames of payload, returns when all are acknowledged
+extern int window_send(t_window *w, const unsigned char *payload, int len, int frames);
+// Receives until 'maxframes' frames are accepted or the line is idle for
+// 'idle' msecs. Returns the frames accepted in order.
+extern int window_receive(t_window *w, int maxframes, long idle);
+
+// Payload bytes per second since the last reset
+extern double window_goodput(t_window *w);
+// Goodput as a percentage of the line rate (8N1) at baudrate
+extern double window_efficiency(t_window *w, int baudrate);
+
+#endif
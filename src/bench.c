@@ -0,0 +1,418 @@
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/resource.h>
+#include "bench.h"
+#include "serial.h"
+#include "protocol.h"
+#include "ringbuf.h"
+#include "ec_types.h"
+#include "log.h"
+#include "debug.h"
+
+DBG_MODULE(debuglevelDriver, "bench", DBG_ERROR)
+
+#define BENCH_RING_SIZE		(KiB(16))
+#define BENCH_POLL_MS		100
+#define BENCH_TURNAROUND_MS	200
+
+typedef struct {
+	int fd;
+	t_crc_type crc;
+	int stop;
+	t_ringbuf rx;
+	unsigned char scratch[BENCH_MAX_PAYLOAD + sizeof(t_trailer)];
+} t_bench_echo;
+
+static int64_t bench_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000000L + ts.tv_nsec / 1000L;
+}
+
+static int bench_retry(int rval)
+{
+	return rval >= 0 || errno == EAGAIN || errno == EINTR;
+}
+
+/*
+ * Il lato che risponde: legge un frame e rimanda la firma con il payload
+ * (eco) oppure solo la firma ACK/NAK dopo aver verificato il CRC
+ */
+static void *bench_echo_pthread(void *data)
+{
+	t_bench_echo *e = data;
+	t_signature sig, reply;
+	t_trailer trailer;
+	struct iovec iov[2];
+	const unsigned char *payload;
+	int tlen = e->crc != CRC_NONE ? sizeof(t_trailer) : 0;
+	uint32_t crc;
+	int rval, need;
+
+	while (!__atomic_load_n(&e->stop, __ATOMIC_ACQUIRE))
+	{
+		rval = serial_read_ring_until(e->fd, &e->rx, sizeof(t_signature), serial_deadline_in(BENCH_POLL_MS));
+		if (!bench_retry(rval))
+		{
+			DRIVER_ERROR("FD %d: read error %d\n", e->fd, rval);
+			break;
+		}
+		if (rval < (int) sizeof(t_signature))
+			continue;
+
+		ringbuf_copy(&e->rx, (unsigned char *) &sig, sizeof(t_signature));
+		if (!protocol_signature_ok(&sig, SERIAL_SIGNATURE_HEADER, 0xffffffff, BENCH_MAX_PAYLOAD))
+		{
+			// Fuori sincronia: chi misura andra' in timeout e ripartira'
+			DRIVER_VERBOSE("FD %d: bad signature 0x%08x\n", e->fd, sig.header);
+			ringbuf_reset(&e->rx);
+			serial_flush_rx(e->fd);
+			continue;
+		}
+
+		need = sizeof(t_signature) + sig.len + tlen;
+		rval = serial_read_ring_until(e->fd, &e->rx, need,
+			serial_transfer_deadline(e->fd, sig.len + tlen, BENCH_TURNAROUND_MS));
+		if (rval < need)
+		{
+			ringbuf_reset(&e->rx);
+			continue;
+		}
+		ringbuf_consume(&e->rx, sizeof(t_signature));
+		payload = ringbuf_peek(&e->rx, sig.len + tlen, e->scratch);
+
+		reply = sig;
+		iov[0].iov_base = &reply;
+		iov[0].iov_len = sizeof(t_signature);
+		iov[1].iov_base = (void *) payload;
+		iov[1].iov_len = sig.len;
+		if (e->crc != CRC_NONE)
+		{
+			memcpy(&trailer, payload + sig.len, sizeof(t_trailer));
+			crc = protocol_frame_crc(e->crc, &sig, payload, sig.len);
+			reply.header = crc == trailer.crc ? SERIAL_SIGNATURE_ACK : SERIAL_SIGNATURE_NAK;
+			iov[1].iov_len = 0;
+		}
+		serial_send_iov(e->fd, iov, 2);
+		ringbuf_consume(&e->rx, sig.len + tlen);
+	}
+	return NULL;
+}
+
+static void bench_rates(t_bench_result *res)
+{
+	res->goodput = 0;
+	res->efficiency = 0;
+	if (res->seconds > 0)
+		res->goodput = res->frames * (double) res->payload / res->seconds;
+	if (res->baudrate > 0)
+		res->efficiency = 100.0 * res->goodput / (res->baudrate / 10.0);
+}
+
+int bench_step(int master, int slave, int baudrate, int payload,
+	t_crc_type crc, int seconds, t_bench_result *res)
+{
+	static unsigned char buf[BENCH_MAX_PAYLOAD];
+	static unsigned char scratch[BENCH_MAX_PAYLOAD];
+	static t_bench_echo echo;
+	pthread_t thread;
+	t_ringbuf rx;
+	t_signature sig, reply;
+	t_trailer trailer;
+	struct iovec iov[3];
+	const unsigned char *p;
+	int64_t start, end, t0, t1;
+	int i, rval, need, total;
+
+	if (payload < 0 || payload > BENCH_MAX_PAYLOAD || seconds <= 0 || res == NULL)
+	{
+		DRIVER_ERROR("BAD PARAMETER\n");
+		return -ECERR_BADPARAM;
+	}
+
+	memset(res, 0, sizeof(t_bench_result));
+	res->baudrate = baudrate;
+	res->payload = payload;
+	res->crc = crc;
+	hist_reset(&res->rtt);
+
+	if (ringbuf_init(&rx, BENCH_RING_SIZE) < 0)
+		return -ECERR_OUTOFMEM;
+	memset(&echo, 0, sizeof(echo));
+	echo.fd = slave;
+	echo.crc = crc;
+	if (ringbuf_init(&echo.rx, BENCH_RING_SIZE) < 0)
+	{
+		ringbuf_free(&rx);
+		return -ECERR_OUTOFMEM;
+	}
+
+	for (i = 0; i < payload; i++)
+		buf[i] = (unsigned char) (i * 31 + 7);
+	sig.header = SERIAL_SIGNATURE_HEADER;
+	sig.len = payload;
+	sig.footer = SERIAL_SIGNATURE_FOOTER;
+	trailer.crc = protocol_frame_crc(crc, &sig, buf, payload);
+	iov[0].iov_base = &sig;
+	iov[0].iov_len = sizeof(t_signature);
+	iov[1].iov_base = buf;
+	iov[1].iov_len = payload;
+	iov[2].iov_base = &trailer;
+	iov[2].iov_len = crc != CRC_NONE ? sizeof(t_trailer) : 0;
+	total = iov[0].iov_len + iov[1].iov_len + iov[2].iov_len;
+	need = sizeof(t_signature) + (crc != CRC_NONE ? 0 : payload);
+
+	serial_flush_rx(master);
+	serial_flush_rx(slave);
+	if (pthread_create(&thread, NULL, bench_echo_pthread, &echo) != 0)
+	{
+		ringbuf_free(&echo.rx);
+		ringbuf_free(&rx);
+		return -ECERR_IO;
+	}
+
+	start = bench_now_us();
+	end = start + seconds * 1000000L;
+	for (t0 = start; t0 < end; t0 = bench_now_us())
+	{
+		rval = serial_send_iov(master, iov, 3);
+		if (rval != total)
+		{
+			if (!bench_retry(rval))
+				break;
+			res->errors++;
+			continue;
+		}
+		rval = serial_read_ring_until(master, &rx, need,
+			serial_transfer_deadline(master, total + need, BENCH_TURNAROUND_MS));
+		t1 = bench_now_us();
+		if (!bench_retry(rval))
+			break;
+		if (rval < need)
+		{
+			res->timeouts++;
+			ringbuf_reset(&rx);
+			serial_flush_rx(master);
+			continue;
+		}
+
+		ringbuf_copy(&rx, (unsigned char *) &reply, sizeof(t_signature));
+		if (crc != CRC_NONE)
+			rval = reply.header == SERIAL_SIGNATURE_ACK && reply.len == sig.len &&
+				reply.footer == SERIAL_SIGNATURE_FOOTER;
+		else
+		{
+			p = ringbuf_peek(&rx, need, scratch);
+			rval = memcmp(p, &sig, sizeof(t_signature)) == 0 &&
+				memcmp(p + sizeof(t_signature), buf, payload) == 0;
+		}
+		if (rval)
+		{
+			res->frames++;
+			hist_record(&res->rtt, t1 - t0);
+			ringbuf_consume(&rx, need);
+		}
+		else
+		{
+			res->errors++;
+			ringbuf_reset(&rx);
+			serial_flush_rx(master);
+		}
+	}
+	res->seconds = (bench_now_us() - start) / 1e6;
+
+	__atomic_store_n(&echo.stop, 1, __ATOMIC_RELEASE);
+	pthread_join(thread, NULL);
+	ringbuf_free(&echo.rx);
+	ringbuf_free(&rx);
+
+	bench_rates(res);
+	return 0;
+}
+
+void bench_merge(t_bench_result *dst, const t_bench_result *src)
+{
+	dst->frames += src->frames;
+	dst->timeouts += src->timeouts;
+	dst->errors += src->errors;
+	dst->seconds += src->seconds;
+	hist_merge(&dst->rtt, &src->rtt);
+	bench_rates(dst);
+}
+
+void bench_print_header(void)
+{
+	printR("%8s %7s %9s %12s %7s %9s %9s %9s %9s %9s %8s %7s\n",
+		"BAUD", "PAYLOAD", "FRAMES", "GOODPUT(B/s)", "EFF%",
+		"P50(us)", "P90(us)", "P99(us)", "P99.9(us)", "MAX(us)", "TIMEOUT", "ERRORS");
+}
+
+void bench_print(const t_bench_result *res)
+{
+	printR("%8d %7d %9llu %12.0f %7.1f %9llu %9llu %9llu %9llu %9llu %8llu %7llu\n",
+		res->baudrate, res->payload, (unsigned long long) res->frames,
+		res->goodput, res->efficiency,
+		(unsigned long long) hist_percentile(&res->rtt, 50),
+		(unsigned long long) hist_percentile(&res->rtt, 90),
+		(unsigned long long) hist_percentile(&res->rtt, 99),
+		(unsigned long long) hist_percentile(&res->rtt, 99.9),
+		(unsigned long long) res->rtt.max,
+		(unsigned long long) res->timeouts, (unsigned long long) res->errors);
+}
+
+typedef struct {
+	t_portstats_cnt frames;
+	t_portstats_cnt errors;
+	t_portstats_cnt resets;
+	int64_t wall_us;
+	int64_t cpu_us;
+} t_bench_snapshot;
+
+static int64_t bench_cpu_us(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return (int64_t) (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000L +
+		ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+static void bench_snapshot(t_engine **engines, int count, t_bench_snapshot *snap)
+{
+	t_portstats_counters c;
+	int i;
+
+	memset(snap, 0, sizeof(t_bench_snapshot));
+	for (i = 0; i < count; i++)
+	{
+		portstats_read(engines[i]->stats, &c);
+		snap->frames += c.frames_tx;
+		snap->errors += portstats_errors(&c);
+		snap->resets += c.resets;
+	}
+	snap->wall_us = bench_now_us();
+	snap->cpu_us = bench_cpu_us();
+}
+
+// Un passo: pairs coppie di engine, un thread ciascuno
+static int bench_engines_step(const int *fds, int pairs, int seconds, const t_engine_config *tmpl)
+{
+	t_engine *engines[2 * BENCH_MAX_PAIRS];
+	pthread_t threads[2 * BENCH_MAX_PAIRS];
+	t_engine_config cfg;
+	t_bench_snapshot t0, t1;
+	char name[32];
+	int64_t deadline;
+	double secs, frames;
+	int count, started = 0;
+	int rval = 0;
+	int i;
+
+	count = 2 * pairs;
+	for (i = 0; i < count; i++)
+	{
+		cfg = *tmpl;
+		cfg.fd = fds[i];
+		snprintf(name, sizeof(name), "pair%d%c", i / 2, i % 2 ? 'b' : 'a');
+		cfg.name = name;
+		// Il capo b aspetta meno: diventa master senza contendersi la linea
+		if (i % 2)
+			cfg.command_timeout = tmpl->command_timeout / 5;
+		engines[i] = engine_create(&cfg);
+		if (engines[i] == NULL)
+		{
+			count = i;
+			rval = -ECERR_OUTOFMEM;
+			goto out;
+		}
+	}
+	for (started = 0; started < count; started++)
+	{
+		if (pthread_create(&threads[started], NULL, engine_run, engines[started]) != 0)
+		{
+			DRIVER_ERROR("Cannot start the engine of %s\n", engines[started]->name);
+			rval = -ECERR_OUTOFMEM;
+			goto out;
+		}
+	}
+
+	// Si misura solo quando i frame corrono su tutte le coppie
+	deadline = serial_deadline_in(5000);
+	do
+	{
+		usleep(10000);
+		bench_snapshot(engines, count, &t0);
+	} while (t0.frames < (t_portstats_cnt) pairs && serial_time_left(deadline) > 0);
+
+	sleep(seconds);
+	bench_snapshot(engines, count, &t1);
+
+	secs = (t1.wall_us - t0.wall_us) / 1e6;
+	frames = t1.frames - t0.frames;
+	printR("%6d %9.0f %10.0f %11.0f %6.1f %13.2f %7lu %7lu\n",
+		pairs, frames, frames / secs, frames / secs / pairs,
+		100.0 * (t1.cpu_us - t0.cpu_us) / (t1.wall_us - t0.wall_us),
+		frames > 0 ? (t1.cpu_us - t0.cpu_us) / frames : 0.0,
+		(unsigned long) (t1.errors - t0.errors), (unsigned long) (t1.resets - t0.resets));
+
+out:
+	engine_stop_join(engines, threads, started);
+	for (i = 0; i < count; i++)
+		engine_destroy(engines[i]);
+	return rval;
+}
+
+int bench_engines(const char *link, int maxpairs, int seconds, const t_engine_config *tmpl)
+{
+	int fds[2 * BENCH_MAX_PAIRS];
+	int level, pairs, last;
+	int rval = 0;
+	int i;
+
+	if (maxpairs <= 0 || maxpairs > BENCH_MAX_PAIRS || seconds <= 0)
+	{
+		DRIVER_ERROR("BAD PARAMETER\n");
+		return -ECERR_BADPARAM;
+	}
+
+	// Lo stesso nome aperto due volte da' i due capi di un link nuovo
+	for (i = 0; i < 2 * maxpairs; i++)
+	{
+		fds[i] = serial_device_init(link, tmpl->baudrate, tmpl->pre, tmpl->post);
+		if (fds[i] < 0)
+		{
+			DRIVER_ERROR("Cannot open %s for the pair %d: %d\n", link, i / 2, fds[i]);
+			return fds[i];
+		}
+	}
+
+	// I messaggi di ogni frame peserebbero piu' del protocollo
+	level = log_module_level("engine", DBG_ERROR);
+
+	printR("Engine scaling on %s: %d bps, payload %d, window %d, crc %s, %d s per step\n",
+		link, tmpl->baudrate, tmpl->payload, tmpl->window, crc_name(tmpl->crc), seconds);
+	printR("%6s %9s %10s %11s %6s %13s %7s %7s\n",
+		"PAIRS", "FRAMES", "FRAMES/S", "PER-PAIR/S", "CPU%", "CPU-us/FRAME", "ERRORS", "RESETS");
+	for (pairs = 1, last = 0; !last && rval == 0; pairs *= 2)
+	{
+		if (pairs >= maxpairs)
+		{
+			pairs = maxpairs;
+			last = 1;
+		}
+		// Ogni passo sui primi link: le coppie ferme restano in silenzio
+		for (i = 0; i < 2 * pairs; i++)
+			serial_flush_rx(fds[i]);
+		rval = bench_engines_step(fds, pairs, seconds, tmpl);
+	}
+
+	if (level >= 0)
+		log_module_level("engine", level);
+	return rval;
+}
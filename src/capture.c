@@ -0,0 +1,296 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "capture.h"
+#include "ec_types.h"
+#include "debug.h"
+
+DBG_MODULE(debuglevelDriver, "capture", DBG_ERROR)
+
+#define REC_SIZE(len)	(((uint64_t) sizeof(t_capture_record) + (len) + CAPTURE_ALIGN - 1) & \
+				~(uint64_t) (CAPTURE_ALIGN - 1))
+
+int capture_enabled = 0;
+
+static pthread_mutex_t capture_lock = PTHREAD_MUTEX_INITIALIZER;
+static t_capture_header *hdr = NULL;
+static unsigned char *ring = NULL;
+static size_t map_len = 0;
+static int port_fd[CAPTURE_MAX_PORTS];
+
+static int64_t capture_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+int capture_open(const char *path, uint64_t size, uint32_t crc)
+{
+	int fd;
+	void *map;
+
+	if (path == NULL || hdr != NULL)
+	{
+		DRIVER_ERROR("BAD PARAMETER\n");
+		return -ECERR_BADPARAM;
+	}
+	if (size < CAPTURE_MIN_SIZE)
+		size = CAPTURE_MIN_SIZE;
+	size = (size + CAPTURE_ALIGN - 1) & ~(uint64_t) (CAPTURE_ALIGN - 1);
+
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+	{
+		DRIVER_ERROR("Cannot create %s: %s\n", path, strerror(errno));
+		return -ECERR_IO;
+	}
+	map_len = CAPTURE_HDR_SIZE + size;
+	if (ftruncate(fd, map_len) < 0)
+	{
+		DRIVER_ERROR("Cannot size %s: %s\n", path, strerror(errno));
+		close(fd);
+		return -ECERR_IO;
+	}
+	map = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	// La mappatura resta valida anche senza il file aperto
+	close(fd);
+	if (map == MAP_FAILED)
+	{
+		DRIVER_ERROR("Cannot map %s: %s\n", path, strerror(errno));
+		return -ECERR_OUTOFMEM;
+	}
+
+	hdr = map;
+	ring = (unsigned char *) map + CAPTURE_HDR_SIZE;
+	memset(hdr, 0, sizeof(t_capture_header));
+	hdr->version = CAPTURE_VERSION;
+	hdr->crc = crc;
+	hdr->capacity = size;
+	hdr->start_ns = capture_now_ns();
+	// Il magic per ultimo: un file a meta' non e' una cattura valida
+	memcpy(hdr->magic, CAPTURE_MAGIC, sizeof(hdr->magic));
+	DRIVER_NOISY("Capture on %s, %llu bytes\n", path, (unsigned long long) size);
+	return 0;
+}
+
+void capture_close(void)
+{
+	pthread_mutex_lock(&capture_lock);
+	__atomic_store_n(&capture_enabled, 0, __ATOMIC_RELAXED);
+	if (hdr != NULL)
+	{
+		msync(hdr, map_len, MS_SYNC);
+		munmap(hdr, map_len);
+		hdr = NULL;
+		ring = NULL;
+	}
+	pthread_mutex_unlock(&capture_lock);
+}
+
+int capture_port(int fd, const char *name, int baudrate)
+{
+	int id;
+
+	if (hdr == NULL)
+		return -ECERR_BADPARAM;
+	pthread_mutex_lock(&capture_lock);
+	id = hdr->nports;
+	if (id >= CAPTURE_MAX_PORTS)
+	{
+		pthread_mutex_unlock(&capture_lock);
+		DRIVER_ERROR("No room to capture FD %d\n", fd);
+		return -ECERR_OUTOFMEM;
+	}
+	port_fd[id] = fd;
+	hdr->baudrate[id] = baudrate;
+	snprintf(hdr->port_name[id], sizeof(hdr->port_name[id]), "%s", name);
+	hdr->nports = id + 1;
+	__atomic_store_n(&capture_enabled, 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&capture_lock);
+	return id;
+}
+
+// Sotto lock: libera dalla coda i record piu' vecchi finche' need ci sta
+static void capture_make_room(uint64_t need)
+{
+	const t_capture_record *old;
+
+	while (hdr->head + need - hdr->tail > hdr->capacity)
+	{
+		old = (const t_capture_record *) (ring + hdr->tail % hdr->capacity);
+		if (old->dir != CAPTURE_PAD)
+			hdr->overwritten++;
+		hdr->tail += REC_SIZE(old->len);
+	}
+}
+
+static void capture_put(int port, t_capture_dir dir, uint16_t flags, const struct iovec *iov,
+	int iovcnt, size_t len)
+{
+	t_capture_record *rec;
+	unsigned char *dst;
+	uint64_t need = REC_SIZE(len);
+	uint64_t pos = hdr->head % hdr->capacity;
+	size_t n;
+	int i;
+
+	if (hdr->capacity - pos < need)
+	{
+		// Il record non si spezza: riempitivo fino alla fine del ring
+		capture_make_room(hdr->capacity - pos);
+		rec = (t_capture_record *) (ring + pos);
+		rec->ts_ns = 0;
+		rec->len = hdr->capacity - pos - sizeof(t_capture_record);
+		rec->dir = CAPTURE_PAD;
+		rec->port = 0;
+		rec->flags = 0;
+		hdr->head += hdr->capacity - pos;
+		pos = 0;
+	}
+	capture_make_room(need);
+
+	rec = (t_capture_record *) (ring + pos);
+	rec->ts_ns = capture_now_ns();
+	rec->len = len;
+	rec->dir = dir;
+	rec->port = port;
+	rec->flags = flags;
+	dst = (unsigned char *) (rec + 1);
+	for (i = 0; i < iovcnt && len > 0; i++)
+	{
+		n = iov[i].iov_len < len ? iov[i].iov_len : len;
+		memcpy(dst, iov[i].iov_base, n);
+		dst += n;
+		len -= n;
+	}
+	hdr->records++;
+	// Prima i dati poi head: dopo un crash head non punta oltre
+	__atomic_store_n(&hdr->head, hdr->head + need, __ATOMIC_RELEASE);
+}
+
+void capture_iov(int fd, t_capture_dir dir, const struct iovec *iov, int iovcnt, size_t len)
+{
+	uint16_t flags = 0;
+	int port;
+
+	pthread_mutex_lock(&capture_lock);
+	if (hdr == NULL)
+		goto out;
+	for (port = 0; port < (int) hdr->nports; port++)
+	{
+		if (port_fd[port] == fd)
+			break;
+	}
+	if (port == (int) hdr->nports)
+		goto out;
+	// Un pezzo enorme si tronca: non deve spazzare via tutto il ring
+	if (len > hdr->capacity / 4)
+	{
+		len = hdr->capacity / 4;
+		flags |= CAPTURE_F_CLIPPED;
+	}
+	capture_put(port, dir, flags, iov, iovcnt, len);
+out:
+	pthread_mutex_unlock(&capture_lock);
+}
+
+void capture_data(int fd, t_capture_dir dir, const void *buf, size_t len)
+{
+	struct iovec iov;
+
+	iov.iov_base = (void *) buf;
+	iov.iov_len = len;
+	capture_iov(fd, dir, &iov, 1, len);
+}
+
+/*
+ * Lettura
+ */
+int capture_reader_open(t_capture_reader *r, const char *path)
+{
+	struct stat sb;
+	void *map;
+
+	memset(r, 0, sizeof(t_capture_reader));
+	r->fd = open(path, O_RDONLY);
+	if (r->fd < 0)
+	{
+		DRIVER_ERROR("Cannot open %s: %s\n", path, strerror(errno));
+		return -ECERR_IO;
+	}
+	if (fstat(r->fd, &sb) < 0 || sb.st_size < CAPTURE_HDR_SIZE)
+	{
+		DRIVER_ERROR("%s: not a capture file\n", path);
+		close(r->fd);
+		return -ECERR_BADPARAM;
+	}
+	r->length = sb.st_size;
+	map = mmap(NULL, r->length, PROT_READ, MAP_SHARED, r->fd, 0);
+	if (map == MAP_FAILED)
+	{
+		DRIVER_ERROR("Cannot map %s: %s\n", path, strerror(errno));
+		close(r->fd);
+		return -ECERR_OUTOFMEM;
+	}
+	r->hdr = map;
+	r->ring = (const unsigned char *) map + CAPTURE_HDR_SIZE;
+	if (memcmp(r->hdr->magic, CAPTURE_MAGIC, sizeof(r->hdr->magic)) != 0 ||
+		r->hdr->version != CAPTURE_VERSION ||
+		r->hdr->capacity + CAPTURE_HDR_SIZE > r->length ||
+		r->hdr->head - r->hdr->tail > r->hdr->capacity)
+	{
+		DRIVER_ERROR("%s: not a capture file or version %u\n", path, r->hdr->version);
+		capture_reader_close(r);
+		return -ECERR_BADPARAM;
+	}
+	r->pos = r->hdr->tail;
+	return 0;
+}
+
+void capture_reader_close(t_capture_reader *r)
+{
+	if (r->hdr != NULL)
+		munmap((void *) r->hdr, r->length);
+	if (r->fd >= 0)
+		close(r->fd);
+	r->hdr = NULL;
+	r->fd = -1;
+}
+
+void capture_reader_rewind(t_capture_reader *r)
+{
+	r->pos = r->hdr->tail;
+}
+
+const t_capture_record *capture_reader_next(t_capture_reader *r, const unsigned char **data)
+{
+	const t_capture_record *rec;
+	uint64_t off;
+
+	while (r->pos < r->hdr->head)
+	{
+		off = r->pos % r->hdr->capacity;
+		rec = (const t_capture_record *) (r->ring + off);
+		// Un record che esce dal ring e' un file rovinato: ci fermiamo
+		if (off + REC_SIZE(rec->len) > r->hdr->capacity)
+		{
+			DRIVER_ERROR("Corrupted record at %llu\n", (unsigned long long) r->pos);
+			r->pos = r->hdr->head;
+			return NULL;
+		}
+		r->pos += REC_SIZE(rec->len);
+		if (rec->dir == CAPTURE_PAD)
+			continue;
+		*data = (const unsigned char *) (rec + 1);
+		return rec;
+	}
+	return NULL;
+}
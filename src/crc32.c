@@ -0,0 +1,175 @@
+#include <string.h>
+#include <pthread.h>
+#include "crc32.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define CRC32C_HW_X86
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define CRC32C_HW_ARM
+#endif
+
+#define CRC32_POLY	0xedb88320	/* IEEE 802.3, reflected */
+#define CRC32C_POLY	0x82f63b78	/* Castagnoli, reflected */
+
+static uint32_t crc32_table[8][256];
+static uint32_t crc32c_table[8][256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *p, size_t len);
+static uint32_t (*crc32c_impl)(uint32_t crc, const unsigned char *p, size_t len) = crc32c_sw;
+
+static void crc_table_init(uint32_t table[8][256], uint32_t poly)
+{
+	uint32_t c;
+	int i, j;
+
+	for (i = 0; i < 256; i++)
+	{
+		c = i;
+		for (j = 0; j < 8; j++)
+			c = (c & 1) ? (c >> 1) ^ poly : c >> 1;
+		table[0][i] = c;
+	}
+	for (i = 0; i < 256; i++)
+	{
+		for (j = 1; j < 8; j++)
+			table[j][i] = (table[j - 1][i] >> 8) ^ table[0][table[j - 1][i] & 0xff];
+	}
+}
+
+static uint32_t crc_slice8(uint32_t table[8][256], uint32_t crc, const unsigned char *p, size_t len)
+{
+	crc = ~crc;
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	while (len >= 8)
+	{
+		uint32_t one, two;
+		memcpy(&one, p, 4);
+		memcpy(&two, p + 4, 4);
+		one ^= crc;
+		crc = table[7][one & 0xff] ^ table[6][(one >> 8) & 0xff] ^
+			table[5][(one >> 16) & 0xff] ^ table[4][one >> 24] ^
+			table[3][two & 0xff] ^ table[2][(two >> 8) & 0xff] ^
+			table[1][(two >> 16) & 0xff] ^ table[0][two >> 24];
+		p += 8;
+		len -= 8;
+	}
+#endif
+	while (len--)
+		crc = table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+	return ~crc;
+}
+
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *p, size_t len)
+{
+	return crc_slice8(crc32c_table, crc, p, len);
+}
+
+#ifdef CRC32C_HW_X86
+__attribute__ ((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char *p, size_t len)
+{
+	crc = ~crc;
+#ifdef __x86_64__
+	while (len >= 8)
+	{
+		uint64_t v;
+		memcpy(&v, p, 8);
+		crc = (uint32_t) _mm_crc32_u64(crc, v);
+		p += 8;
+		len -= 8;
+	}
+#endif
+	while (len >= 4)
+	{
+		uint32_t v;
+		memcpy(&v, p, 4);
+		crc = _mm_crc32_u32(crc, v);
+		p += 4;
+		len -= 4;
+	}
+	while (len--)
+		crc = _mm_crc32_u8(crc, *p++);
+	return ~crc;
+}
+#endif
+
+#ifdef CRC32C_HW_ARM
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char *p, size_t len)
+{
+	crc = ~crc;
+	while (len >= 4)
+	{
+		uint32_t v;
+		memcpy(&v, p, 4);
+		crc = __crc32cw(crc, v);
+		p += 4;
+		len -= 4;
+	}
+	while (len--)
+		crc = __crc32cb(crc, *p++);
+	return ~crc;
+}
+#endif
+
+static void crc_init(void)
+{
+	crc_table_init(crc32_table, CRC32_POLY);
+	crc_table_init(crc32c_table, CRC32C_POLY);
+
+#if defined(CRC32C_HW_X86)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse4.2"))
+		crc32c_impl = crc32c_hw;
+#elif defined(CRC32C_HW_ARM)
+	crc32c_impl = crc32c_hw;
+#endif
+}
+
+uint32_t crc32_ieee(uint32_t crc, const void *buf, size_t len)
+{
+	pthread_once(&crc_once, crc_init);
+	return crc_slice8(crc32_table, crc, buf, len);
+}
+
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len)
+{
+	pthread_once(&crc_once, crc_init);
+	return crc32c_impl(crc, buf, len);
+}
+
+uint32_t crc_compute(t_crc_type type, uint32_t crc, const void *buf, size_t len)
+{
+	switch (type)
+	{
+		case CRC_32:
+			return crc32_ieee(crc, buf, len);
+		case CRC_32C:
+			return crc32c(crc, buf, len);
+		default:
+			return 0;
+	}
+}
+
+int crc32c_hw_available(void)
+{
+	pthread_once(&crc_once, crc_init);
+	return crc32c_impl != crc32c_sw;
+}
+
+const char *crc_name(t_crc_type type)
+{
+	switch (type)
+	{
+		case CRC_32:
+			return "CRC32";
+		case CRC_32C:
+			return crc32c_hw_available() ? "CRC32C (hw)" : "CRC32C";
+		default:
+			return "ECHO";
+	}
+}
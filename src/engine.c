@@ -0,0 +1,1057 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include "engine.h"
+#include "serial.h"
+#include "resync.h"
+#include "ec_types.h"
+#include "debug.h"
+
+DBG_MODULE(debuglevelDriver, "engine", DBG_INFO)
+
+// Con piu' porte nello stesso processo ogni messaggio dice di chi e'
+#define ENGINE_NOISY(e, fmt, args...)	DRIVER_NOISY("%s: " fmt, (e)->name, ## args)
+#define ENGINE_VERBOSE(e, fmt, args...)	DRIVER_VERBOSE("%s: " fmt, (e)->name, ## args)
+#define ENGINE_PRINT(e, fmt, args...)	DRIVER_PRINT("%s: " fmt, (e)->name, ## args)
+#define ENGINE_ERROR(e, fmt, args...)	DRIVER_ERROR("%s: " fmt, (e)->name, ## args)
+
+#define TRAILER_LEN(e)  ((e)->cfg.crc != CRC_NONE ? sizeof(t_trailer) : 0)
+// Payload e trailer di un frame ricevuto devono stare in bufread
+#define FRAME_FITS(e, len)  ((len) + TRAILER_LEN(e) <= sizeof((e)->bufread))
+
+#define WINDOW_BURST_FRAMES(e)  (10 * (e)->cfg.window)  /* frame per ogni giro */
+#define WINDOW_IDLE_MS          (1000)
+
+// Tempo concesso al peer per rispondere, oltre al tempo di trasmissione
+// dei caratteri attesi (qualche pausa della modalita' cadenzata)
+#define PEER_TURNAROUND_MS(e)   (4 * (e)->cfg.pace_us / 1000L + 100)
+
+const char *const engine_state_name[] = {
+	[STATE_START] = "STATE_START",
+
+	// SLAVE STATES
+	[STATE_WAIT_COMMAND] = "STATE_WAIT_COMMAND",
+	[STATE_COMMAND_RECEIVED] = "STATE_COMMAND_RECEIVED",
+	[STATE_READ_SERIAL_PACKET] = "STATE_READ_SERIAL_PACKET",
+	[STATE_WAIT_SERIAL_PACKET_SIGNATURE] = "STATE_WAIT_SERIAL_PACKET_SIGNATURE",
+	[STATE_WRITE_SERIAL_PACKET_SIGNATURE_SLAVE] = "STATE_WRITE_SERIAL_PACKET_SIGNATURE_SLAVE",
+	[STATE_WRITE_SERIAL_PACKET_ACK] = "STATE_WRITE_SERIAL_PACKET_ACK",
+	[STATE_SEND_COMMAND_ACK] = "STATE_SEND_COMMAND_ACK",
+	[STATE_WINDOW_RECEIVE] = "STATE_WINDOW_RECEIVE",
+
+	// MASTER STATES
+	[STATE_SEND_COMMAND] = "STATE_SEND_COMMAND",
+	[STATE_SEND_BREAK] = "STATE_SEND_BREAK",
+	[STATE_WAIT_COMMAND_ACK] = "STATE_WAIT_COMMAND_ACK",
+	[STATE_WRITE_SERIAL_PACKET] = "STATE_WRITE_SERIAL_PACKET",
+	[STATE_WRITE_SERIAL_PACKET_SIGNATURE_MASTER] = "STATE_WRITE_SERIAL_PACKET_SIGNATURE_MASTER",
+	[STATE_WAIT_SERIAL_PACKET_ACK] = "STATE_WAIT_SERIAL_PACKET_ACK",
+	[STATE_WAIT_SERIAL_PACKET_ACK_SIGNATURE] = "STATE_WAIT_SERIAL_PACKET_ACK_SIGNATURE",
+	[STATE_WINDOW_SEND] = "STATE_WINDOW_SEND",
+
+	[STATE_RESYNC] = "STATE_RESYNC",
+	[STATE_RESET_SERIAL] = "STATE_RESET_SERIAL",
+	[STATE_RESET] = "STATE_RESET",
+	[STATE_LAST] = "STATE_LAST",
+};
+
+static const char *str = "0123456789ABCDEFABCDEFGHIJKLMNOPQRSTUVWXYZ[]=-,.";
+
+// Il payload di ogni lunghezza e' l'inizio di str ripetuta: basta un solo
+// modello, scritto una volta e poi solo letto da tutte le porte
+static pthread_once_t template_once = PTHREAD_ONCE_INIT;
+static unsigned char payload_template[ENGINE_BUFFER_SIZE];
+
+int engine_payload_len(int baudrate)
+{
+	int rval;
+
+	// La regola e' piu' andiamo veloci piu' scriviamo (potrebbe essere anche l'opposto)
+	// Oltre 230400 il pacchetto piu' grande: tutto ENGINE_BUFFER_SIZE
+	if (baudrate > 230400)
+		return ENGINE_BUFFER_SIZE;
+
+	switch (baudrate)
+	{
+		case 230400:
+			rval = 70;
+			break;
+		case 115200:
+			rval = 45;
+			break;
+		case 57600:
+			rval = 42;
+			break;
+		case 38400:
+			rval = 40;
+			break;
+		case 19200:
+			rval = 38;
+			break;
+		case 9600:
+			rval = 35;
+			break;
+		case 4800:
+			rval = 30;
+			break;
+		case 2400:
+			rval = 20;
+			break;
+		default:
+		case 1200:
+			rval = 10;
+			break;
+	}
+	return rval;
+}
+
+static void template_init(void)
+{
+	size_t l = strlen(str);
+	size_t i;
+
+	for (i = 0; i + l <= sizeof(payload_template); i += l)
+		memcpy(payload_template + i, str, l);
+	memcpy(payload_template + i, str, sizeof(payload_template) - i);
+}
+
+t_engine *engine_create(const t_engine_config *cfg)
+{
+	t_engine *e;
+
+	// Le statistiche stanno su linee di cache proprie
+	if (posix_memalign((void **) &e, PORTSTATS_CACHELINE, sizeof(t_engine)) != 0)
+	{
+		DRIVER_ERROR("Out of memory\n");
+		return NULL;
+	}
+	memset(e, 0, sizeof(t_engine));
+	e->cfg = *cfg;
+	snprintf(e->name, sizeof(e->name), "%s", cfg->name != NULL ? cfg->name : "");
+	e->cfg.name = e->name;
+	if (e->cfg.payload > ENGINE_BUFFER_SIZE)
+		e->cfg.payload = ENGINE_BUFFER_SIZE;
+
+	if (ringbuf_init(&e->rxring, ENGINE_RX_RING_SIZE) < 0)
+	{
+		ENGINE_ERROR(e, "Cannot allocate the receive ring\n");
+		free(e);
+		return NULL;
+	}
+	window_init(&e->win, cfg->fd, &e->rxring, cfg->window);
+	e->win.crc = cfg->crc;
+
+	// Una porta fuori dalla tabella ha comunque i suoi contatori
+	e->stats = portstats_of(cfg->fd);
+	if (e->stats == NULL)
+	{
+		e->own_stats.fd = cfg->fd;
+		snprintf(e->own_stats.name, sizeof(e->own_stats.name), "%s", e->name);
+		e->stats = &e->own_stats;
+	}
+	e->times = statetime_of(cfg->fd);
+
+	e->state = STATE_RESET;
+	e->state_next = STATE_LAST;
+	e->timeout = cfg->command_timeout;
+	e->resync_state = STATE_RESET;
+	e->resync_word = SERIAL_SIGNATURE_HEADER;
+	e->resync_mask = 0xffffffff;
+	e->sigread.header = e->sigwrite.header = SERIAL_SIGNATURE_HEADER;
+	e->sigread.footer = e->sigwrite.footer = SERIAL_SIGNATURE_FOOTER;
+
+	// Con la PRBS ogni frame ha il seguito della sequenza...
+	if (e->cfg.prbs != PRBS_NONE)
+	{
+		e->prbsbuf = malloc(ENGINE_BUFFER_SIZE);
+		if (e->prbsbuf == NULL)
+		{
+			ENGINE_ERROR(e, "Cannot allocate the PRBS buffer\n");
+			ringbuf_free(&e->rxring);
+			free(e);
+			return NULL;
+		}
+		prbs_init(&e->prbs_tx, e->cfg.prbs);
+		prbs_check_init(&e->prbs_rx, e->cfg.prbs);
+		e->txpayload = e->prbsbuf;
+	}
+	// ...altrimenti il frame del master e' sempre lo stesso: anche il suo CRC
+	else
+	{
+		pthread_once(&template_once, template_init);
+		e->txpayload = payload_template;
+	}
+	if (e->cfg.crc != CRC_NONE && e->cfg.prbs == PRBS_NONE)
+	{
+		e->sigwrite.len = e->cfg.payload;
+		e->txcrc = protocol_frame_crc(e->cfg.crc, &e->sigwrite, e->txpayload, e->cfg.payload);
+	}
+	ENGINE_PRINT(e, "FD %d - BaudRate: %d PRE: %d - POST: %d - payload %d\n",
+		cfg->fd, cfg->baudrate, cfg->pre, cfg->post, e->cfg.payload);
+	return e;
+}
+
+void engine_destroy(t_engine *e)
+{
+	if (e == NULL)
+		return;
+	ringbuf_free(&e->rxring);
+	free(e->prbsbuf);
+	free(e);
+}
+
+// Il payload ricevuto contro la sequenza attesa. Vero se non ha errori
+static int engine_prbs_check(t_engine *e, const unsigned char *payload, int len)
+{
+	t_prbs_check *v = &e->prbs_rx;
+	uint64_t bits = v->bits, errors = v->errors, losses = v->losses;
+	int wrong;
+
+	wrong = prbs_check(v, payload, len);
+	// Perdendo l'aggancio bit ed errori possono anche calare
+	PORTSTATS_ADD(e->stats, prbs_bits, v->bits - bits);
+	PORTSTATS_ADD(e->stats, prbs_errors, v->errors - errors);
+	PORTSTATS_ADD(e->stats, prbs_losses, v->losses - losses);
+	if (wrong > 0)
+		ENGINE_VERBOSE(e, "%s: %d wrong bits in %d bytes%s\n", prbs_name(e->cfg.prbs), wrong, len,
+			v->locked ? "" : ", lock lost");
+	return wrong == 0 && v->locked;
+}
+
+void engine_stop(t_engine *e)
+{
+	__atomic_store_n(&e->stop, 1, __ATOMIC_RELEASE);
+}
+
+static int engine_is_master(const t_engine *e)
+{
+	t_state state = __atomic_load_n(&e->state, __ATOMIC_RELAXED);
+
+	return state >= STATE_SEND_COMMAND && state <= STATE_WINDOW_SEND;
+}
+
+void engine_stop_join(t_engine *const engines[], const pthread_t threads[], int count)
+{
+	char master[count];
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		master[i] = engine_is_master(engines[i]);
+		if (master[i])
+			engine_stop(engines[i]);
+	}
+	for (i = 0; i < count; i++)
+	{
+		if (master[i])
+			pthread_join(threads[i], NULL);
+	}
+	// Ora gli slave non hanno piu' nessuno che aspetta una risposta
+	for (i = 0; i < count; i++)
+	{
+		if (!master[i])
+			engine_stop(engines[i]);
+	}
+	for (i = 0; i < count; i++)
+	{
+		if (!master[i])
+			pthread_join(threads[i], NULL);
+	}
+}
+
+void *engine_run(void *data)
+{
+	t_engine *e = data;
+
+	while (!__atomic_load_n(&e->stop, __ATOMIC_ACQUIRE))
+	{
+		if (engine_step(e) < 0)
+			break;
+	}
+	ENGINE_NOISY(e, "Exit\n");
+	return NULL;
+}
+
+int engine_step(t_engine *e)
+{
+	int fd = e->cfg.fd;
+	t_portstats *stats = e->stats;
+	const unsigned char *payload;
+	struct iovec frame[3];
+	uint64_t win_bytes;
+	uint32_t crc;
+	int rval;
+
+	statetime_enter(e->times);
+	switch (e->state)
+	{
+		case STATE_START:
+			ENGINE_NOISY(e, "STATE_START\n");
+			serial_flush_rx(fd);
+			serial_flush_tx(fd);
+			e->state_next = STATE_WAIT_COMMAND;
+			break;
+
+		// SLAVE STATES
+		case STATE_WAIT_COMMAND:
+			// Ci sono caratteri da leggere entro il timeout!
+			// il timeout puo' aumentare o diminuire a seconda
+			// del livello raggiunto dal test
+			rval = serial_read_string(fd, e->bufread, e->timeout);
+			if (rval < 0)
+			{
+				if (errno != EAGAIN && errno != EINTR)
+				{
+					ENGINE_ERROR(e, "Error on WAITING COMMAND\n");
+					e->state_next = STATE_RESET;
+				}
+				// Se siamo stati interrotti ci riproviamo
+			}
+			else
+			{
+				if (rval == 0)
+				{
+					ENGINE_NOISY(e, "Nothing to read within %ld msecs\n", e->timeout);
+					ENGINE_VERBOSE(e, "\t\t*** NOW SEND BREAK ***\n");
+					e->state_next = STATE_SEND_BREAK;
+				}
+				else
+				{
+					ENGINE_NOISY(e, "Read %d from serial.\n", rval);
+					e->state_next = STATE_COMMAND_RECEIVED;
+				}
+			}
+			break;
+
+		case STATE_SEND_BREAK:
+			rval = serial_send_break(fd);
+			if (rval == 0)
+				portstats_break_sent(fd);
+			if (rval < 0)
+			{
+				if (errno != EAGAIN && errno != EINTR)
+				{
+					ENGINE_ERROR(e, "Error on SENDING BREAK COMMAND\n");
+					e->state_next = STATE_RESET;
+				}
+				// Se siamo stati interrotti ci riproviamo
+			}
+			else
+			{
+				if (rval == 0)
+				{
+					ENGINE_VERBOSE(e, "\t\t*** NOW MASTER ***\n");
+					e->state_next = STATE_SEND_COMMAND;
+				}
+				else
+				{
+					ENGINE_ERROR(e, "SEND BREAK - IS THIS A BUG??? rval: %d\n", rval);
+					e->state_next = STATE_RESET;
+				}
+			}
+			break;
+
+		case STATE_COMMAND_RECEIVED:
+			ENGINE_NOISY(e, "STATE_COMMAND_RECEIVED\n");
+			if (strcmp("DOSLAVE\r\n", (const char *) e->bufread) == 0)
+			{
+				ENGINE_NOISY(e, "DO SLAVE RECEIVED. SENDING ACK\n");
+				e->state_next = STATE_SEND_COMMAND_ACK;
+			}
+			else
+			{
+				// Ho ricevuto caratteri spuri. E' un problema, ritorno
+				// allo stato di MASTER...
+				ENGINE_NOISY(e, "UNKNOWN COMMAND / JUNK RECEIVED\n");
+				ENGINE_VERBOSE(e, "\t\t*** NOW MASTER ***\n");
+				serial_device_status(fd);
+				e->state_next = STATE_SEND_COMMAND;
+			}
+			break;
+
+		case STATE_SEND_COMMAND_ACK:
+			ENGINE_NOISY(e, "SENDING DOSLAVE CMD ACK\n");
+			rval = serial_send_string(fd, (const unsigned char *) "DOSLAVECMDACK\r\n");
+			if (rval < 0)
+			{
+				if (errno != EAGAIN && errno != EINTR)
+				{
+					ENGINE_ERROR(e, "Error on SEND COMMAND ACK\n");
+					e->state_next = STATE_RESET;
+					PORTSTATS_ERROR(stats, PORTSTATS_ERR_IO);
+				}
+			}
+			else
+			{
+				if (rval == 0)
+				{
+					ENGINE_VERBOSE(e, "*** STATE_SEND_COMMAND_ACK NOT SENDING? Retry ***\n");
+				}
+				else
+				{
+					ENGINE_NOISY(e, "Switching STATE_WAIT_SERIAL_PACKET_SIGNATURE FROM MASTER\n");
+					e->state_next = e->cfg.window > 0 ? STATE_WINDOW_RECEIVE : STATE_WAIT_SERIAL_PACKET_SIGNATURE;
+				}
+			}
+			break;
+
+		case STATE_WAIT_SERIAL_PACKET_SIGNATURE:
+			rval = serial_read_ring_until(fd, &e->rxring, sizeof(t_signature),
+				serial_transfer_deadline(fd, sizeof(t_signature), PEER_TURNAROUND_MS(e)));
+			// La firma resta nel ring finche' non e' stata validata:
+			// se e' sbagliata la risincronizzazione riparte da li'
+			if (rval == sizeof(t_signature))
+				ringbuf_copy(&e->rxring, (unsigned char *) &e->sigread, sizeof(t_signature));
+			if (rval < 0)
+			{
+				if (errno != EAGAIN && errno != EINTR)
+				{
+					ENGINE_ERROR(e, "Error on WAIT SERIAL PACKET SIGNATURE\n");
+					e->state_next = STATE_RESET;
+					PORTSTATS_ERROR(stats, PORTSTATS_ERR_IO);
+				}
+			}
+			else
+			{
+				if (rval == 0)
+				{
+					ENGINE_NOISY(e, "*** NOTHING TO READ/SIGNATURE ***\n");
+					e->state_next = STATE_RESET;
+				}
+				else
+				{
+					ENGINE_NOISY(e, "SIGNATURE PACKET RECIVED FROM MASTER\n");
+					if (rval != sizeof(t_signature))
+					{
+						ENGINE_ERROR(e, "RVAL: %d -- BAD SIGNATURE STATE_WAIT_SERIAL_PACKET_SIGNATURE:"
+								"\n\tHEADER: 0x%08x\n\tLEN: 0x%08x\n\tFOOTER: 0x%08x\n",
+							rval, e->sigread.header, e->sigread.len, e->sigread.footer);
+						serial_device_status(fd);
+						e->state_next = STATE_RESET;
+						PORTSTATS_ERROR(stats, PORTSTATS_ERR_SHORT);
+					}
+					else
+					{
+						ENGINE_NOISY(e, "STATE_WAIT_SERIAL_PACKET_SIGNATURE:"
+								"\n\tHEADER: 0x%08x\n\tLEN: 0x%08x\n\tFOOTER: 0x%08x\n",
+							e->sigread.header, e->sigread.len, e->sigread.footer);
+						e->state_next = STATE_READ_SERIAL_PACKET;
+					}
+				}
+			}
+			break;
+
+		case STATE_READ_SERIAL_PACKET:
+			ENGINE_NOISY(e, "STATE_READ_SERIAL_PACKET\n");
+			// Verifichiamo la validita' della signature ricevuta.
+			// Dobbiamo metterci il meno possibile perche' i dati
+			// stanno arrivando dalla seriale.
+			if (protocol_signature_ok(&e->sigread, SERIAL_SIGNATURE_HEADER, 0xffffffff, ENGINE_BUFFER_SIZE) &&
+				FRAME_FITS(e, e->sigread.len))
+			{
+				// La firma ricevuta va bene, leggiamo tutto il contenuto
+				// del pacchetto
+				ringbuf_consume(&e->rxring, sizeof(t_signature));
+				rval = serial_read_ring_until(fd, &e->rxring, e->sigread.len + TRAILER_LEN(e),
+					serial_transfer_deadline(fd, e->sigread.len, PEER_TURNAROUND_MS(e)));
+				if (rval < 0)
+				{
+					if (errno != EAGAIN && errno != EINTR)
+					{
+						ENGINE_ERROR(e, "Error on STATE_READ_SERIAL_PACKET\n");
+						e->state_next = STATE_RESET;
+						PORTSTATS_ERROR(stats, PORTSTATS_ERR_IO);
+					}
+				}
+				else
+				{
+					if (rval == 0)
+					{
+						ENGINE_NOISY(e, "*** NOTHING TO READ ***\n");
+						e->state_next = STATE_RESET;
+					}
+					else
+					{
+						ENGINE_NOISY(e, "STATE_READ_SERIAL_PACKET FROM MASTER\n\tRead: %d -- To Read: %d\n",
+							rval, e->sigread.len);
+						if (rval != (int) (e->sigread.len + TRAILER_LEN(e)))
+						{
+							ENGINE_ERROR(e, "BAD STATE_READ_SERIAL_PACKET LEN\n");
+							serial_device_status(fd);
+							e->state_next = STATE_RESET;
+							PORTSTATS_ERROR(stats, PORTSTATS_ERR_SHORT);
+						}
+						else
+						{
+							// Adesso ho letto tutto, rispediamo la firma indietro
+							// e tutto il pacchetto al chiamante!
+							ENGINE_NOISY(e, "STATE_READ_SERIAL_PACKETREAD\n");
+							e->state_next = STATE_WRITE_SERIAL_PACKET_SIGNATURE_SLAVE;
+						}
+					}
+				}
+			}
+			else
+			{
+				ENGINE_ERROR(e, "STATE_READ_SERIAL_PACKET: BAD SIGNATURE RECEIVED\n");
+				serial_device_status(fd);
+				// Cerchiamo la prossima firma buona nel flusso
+				// invece di ricominciare da capo
+				ringbuf_consume(&e->rxring, 1);
+				e->resync_word = SERIAL_SIGNATURE_HEADER;
+				e->resync_mask = 0xffffffff;
+				e->resync_state = STATE_READ_SERIAL_PACKET;
+				e->state_next = STATE_RESYNC;
+				PORTSTATS_ERROR(stats, PORTSTATS_ERR_SIGNATURE);
+			}
+			break;
+
+		case STATE_WRITE_SERIAL_PACKET_SIGNATURE_SLAVE:
+			ENGINE_NOISY(e, "STATE_WRITE_SERIAL_PACKET_SIGNATURE\n");
+			// La firma di risposta e' quella ricevuta: partira'
+			// insieme al pacchetto in un solo frame
+			e->sigwrite = e->sigread;
+			// Solo i contatori: la risposta la decidono eco o CRC come sempre
+			if (e->cfg.prbs != PRBS_NONE)
+			{
+				payload = ringbuf_peek(&e->rxring, e->sigread.len, e->bufread);
+				engine_prbs_check(e, payload, e->sigread.len);
+			}
+			if (e->cfg.crc != CRC_NONE)
+			{
+				// Verifichiamo il CRC in coda al frame: rispondiamo solo
+				// ACK/NAK invece di rispedire tutto il pacchetto
+				payload = ringbuf_peek(&e->rxring, e->sigread.len + sizeof(t_trailer), e->bufread);
+				memcpy(&e->trailer, payload + e->sigread.len, sizeof(t_trailer));
+				crc = protocol_frame_crc(e->cfg.crc, &e->sigread, payload, e->sigread.len);
+				if (crc == e->trailer.crc)
+				{
+					e->sigwrite.header = SERIAL_SIGNATURE_ACK;
+				}
+				else
+				{
+					ENGINE_ERROR(e, "CRC ERROR: 0x%08x instead of 0x%08x\n", crc, e->trailer.crc);
+					e->sigwrite.header = SERIAL_SIGNATURE_NAK;
+					PORTSTATS_ERROR(stats, PORTSTATS_ERR_PAYLOAD);
+				}
+			}
+			e->state_next = STATE_WRITE_SERIAL_PACKET_ACK;
+			break;
+
+		case STATE_WRITE_SERIAL_PACKET_ACK:
+			// Il messaggio di risposta al pacchetto ricevuto,
+			// e' lo stesso pacchetto...
+			ENGINE_NOISY(e, "STATE_WRITE_SERIAL_PACKET_ACK --- SAME PACKET BACK!\n");
+			// Firma e payload (direttamente dal ring di ricezione)
+			// escono con una sola writev()
+			payload = ringbuf_peek(&e->rxring, e->sigread.len, e->bufread);
+			frame[0].iov_base = &e->sigwrite;
+			frame[0].iov_len = sizeof(t_signature);
+			frame[1].iov_base = (void *) payload;
+			frame[1].iov_len = e->cfg.crc != CRC_NONE ? 0 : e->sigwrite.len;
+			rval = serial_send_iov(fd, frame, 2);
+			if (rval < 0)
+			{
+				if (errno != EAGAIN && errno != EINTR)
+				{
+					ENGINE_ERROR(e, "Error on WRITING SERIAL PACKET ACK\n");
+					e->state_next = STATE_RESET;
+					PORTSTATS_ERROR(stats, PORTSTATS_ERR_IO);
+				}
+			}
+			else
+			{
+				if (rval == 0)
+				{
+					ENGINE_ERROR(e, "*** NOT WRITING - Retry ***\n");
+				}
+				else
+				if (rval == (int) (frame[0].iov_len + frame[1].iov_len))
+				{
+					ringbuf_consume(&e->rxring, e->sigread.len + TRAILER_LEN(e));
+					ENGINE_NOISY(e, "SENT PACKET ACK FROM SLAVE OK: %d\n", e->goodpacketrx++);
+					if (e->sigwrite.header != SERIAL_SIGNATURE_NAK)
+					{
+						PORTSTATS_INC(stats, frames_rx);
+						PORTSTATS_ADD(stats, bytes_rx, e->sigwrite.len);
+						PORTSTATS_GOOD(stats);
+					}
+					e->state_next = STATE_WAIT_SERIAL_PACKET_SIGNATURE;
+				}
+				else
+				{
+					ENGINE_ERROR(e, "STATE_WRITE_SERIAL_PACKET_ACK not writing everything: %d\n",
+						rval);
+					serial_device_status(fd);
+					e->state_next = STATE_RESET;
+					PORTSTATS_ERROR(stats, PORTSTATS_ERR_SHORT);
+				}
+			}
+			break;
+
+		case STATE_WINDOW_RECEIVE:
+			// Modalita' a finestra: i frame arrivano in pipeline,
+			// rispondiamo solo con gli ACK cumulativi
+			win_bytes = e->win.bytes;
+			rval = window_receive(&e->win, WINDOW_BURST_FRAMES(e), WINDOW_IDLE_MS);
+			if (rval < 0)
+			{
+				ENGINE_ERROR(e, "STATE_WINDOW_RECEIVE ERROR: %d\n", rval);
+				serial_device_status(fd);
+				e->state_next = STATE_RESET;
+				PORTSTATS_ERROR(stats, PORTSTATS_ERR_IO);
+			}
+			else
+			if (rval == 0)
+			{
+				ENGINE_NOISY(e, "*** NOTHING TO READ/WINDOW ***\n");
+				e->state_next = STATE_RESET;
+			}
+			else
+			{
+				e->goodpacketrx += rval;
+				PORTSTATS_ADD(stats, frames_rx, rval);
+				PORTSTATS_ADD(stats, bytes_rx, e->win.bytes - win_bytes);
+				PORTSTATS_GOOD(stats);
+				ENGINE_NOISY(e, "STATE_WINDOW_RECEIVE: %d frames - next %u\n", rval, e->win.expected);
+			}
+			break;
+
+		// MASTER STATES
+		case STATE_SEND_COMMAND:
+			ENGINE_NOISY(e, "STATE_SEND_COMMAND\n");
+			rval = serial_send_string(fd, (const unsigned char *) "DOSLAVE\r\n");
+			if (rval < 0)
+			{
+				if (errno != EAGAIN && errno != EINTR)
+				{
+					ENGINE_ERROR(e, "Error on SEND COMMAND DO SLAVE r:%d -- e: %d\n", rval, errno);
+					e->state_next = STATE_RESET_SERIAL;
+					PORTSTATS_ERROR(stats, PORTSTATS_ERR_IO);
+				}
+			}
+			else
+			{
+				if (rval == 0)
+				{
+					ENGINE_VERBOSE(e, "Why NOT SENDING? Retry\n");
+				}
+				else
+				{
+					ENGINE_NOISY(e, "Switching to WAITING CMD ACK FROM SLAVE\n");
+					e->state_next = STATE_WAIT_COMMAND_ACK;
+				}
+			}
+			break;
+
+		case STATE_WAIT_COMMAND_ACK:
+			ENGINE_NOISY(e, "STATE_WAIT_COMMAND_ACK\n");
+			// Il DOSLAVE appena spedito e la risposta devono viaggiare
+			// sulla linea, piu' il tempo di elaborazione dello slave
+			rval = serial_read_string_until(fd, e->bufread,
+				serial_transfer_deadline(fd, sizeof("DOSLAVE\r\n") + sizeof("DOSLAVECMDACK\r\n"),
+					PEER_TURNAROUND_MS(e)));
+			if (rval < 0)
+			{
+				if (errno != EAGAIN && errno != EINTR)
+				{
+					ENGINE_ERROR(e, "Error on STATE_WAIT_COMMAND_ACK\n");
+					e->state_next = STATE_RESET;
+					PORTSTATS_ERROR(stats, PORTSTATS_ERR_IO);
+				}
+			}
+			else
+			{
+				if (rval == 0)
+				{
+					ENGINE_VERBOSE(e, "TIMEOUT ERROR. RESET\n");
+					e->state_next = STATE_RESET;
+					PORTSTATS_ERROR(stats, PORTSTATS_ERR_TIMEOUT);
+				}
+				else
+				{
+					if (strcmp("DOSLAVECMDACK\r\n", (const char *) e->bufread) == 0)
+					{
+						ENGINE_NOISY(e, "DO SLAVE CMD ACKNOWLEDGED.\n");
+						e->state_next = e->cfg.window > 0 ? STATE_WINDOW_SEND : STATE_WRITE_SERIAL_PACKET_SIGNATURE_MASTER;
+					}
+					else
+					{
+						ENGINE_ERROR(e, "GARBAGE/JUNK ON RECEIVING WAIT CMD ACK %s\n", e->bufread);
+						serial_device_status(fd);
+						e->state_next = STATE_RESET;
+						PORTSTATS_ERROR(stats, PORTSTATS_ERR_COMMAND);
+					}
+				}
+			}
+			break;
+
+		case STATE_WRITE_SERIAL_PACKET_SIGNATURE_MASTER:
+			// Prima di scrivere il pacchetto, occorre preparare la signature
+			// corretta ed il payload: partiranno insieme in un solo frame
+			e->sigwrite.header = SERIAL_SIGNATURE_HEADER;
+			e->sigwrite.footer = SERIAL_SIGNATURE_FOOTER;
+			e->sigwrite.len = e->cfg.payload;
+			if (e->cfg.prbs != PRBS_NONE)
+			{
+				prbs_fill(&e->prbs_tx, e->prbsbuf, e->cfg.payload);
+				if (e->cfg.crc != CRC_NONE)
+				{
+					e->trailer.crc = protocol_frame_crc(e->cfg.crc, &e->sigwrite, e->prbsbuf, e->sigwrite.len);
+				}
+			}
+			else
+				e->trailer.crc = e->txcrc;
+			ENGINE_NOISY(e, "STATE_WRITE_SERIAL_PACKET_SIGNATURE_MASTER:"
+				"\n\tHEADER: 0x%08x\n\tLEN: 0x%08x\n\tFOOTER: 0x%08x\n",
+				e->sigwrite.header, e->sigwrite.len, e->sigwrite.footer);
+			e->state_next = STATE_WRITE_SERIAL_PACKET;
+			break;
+
+		case STATE_WRITE_SERIAL_PACKET:
+			ENGINE_NOISY(e, "STATE_WRITE_SERIAL_PACKET\n");
+			frame[0].iov_base = &e->sigwrite;
+			frame[0].iov_len = sizeof(t_signature);
+			frame[1].iov_base = (void *) e->txpayload;
+			frame[1].iov_len = e->sigwrite.len;
+			frame[2].iov_base = &e->trailer;
+			frame[2].iov_len = TRAILER_LEN(e);
+			rval = serial_send_iov(fd, frame, 3);
+			if (rval < 0)
+			{
+				if (errno != EINTR && errno != EAGAIN)
+				{
+					ENGINE_ERROR(e, "STATE_WRITE_SERIAL_PACKET! Unable to write data!\n");
+					e->state_next = STATE_RESET;
+					PORTSTATS_ERROR(stats, PORTSTATS_ERR_IO);
+				}
+			}
+			else
+			{
+				if (rval == 0)
+				{
+					ENGINE_NOISY(e, "Timeout STATE_WRITE_SERIAL_PACKET. Wait...\n");
+					// Retry write
+				}
+				else
+				{
+					if (rval == (int) (sizeof(t_signature) + e->sigwrite.len + TRAILER_LEN(e)))
+					{
+						ENGINE_NOISY(e, "STATE_WRITE_SERIAL_PACKET OK.\n");
+						e->state_next = STATE_WAIT_SERIAL_PACKET_ACK_SIGNATURE;
+					}
+					else
+					{
+						ENGINE_ERROR(e, "STATE_WRITE_SERIAL_PACKET Error: %d\n", rval);
+						serial_device_status(fd);
+						e->state_next = STATE_RESET;
+						PORTSTATS_ERROR(stats, PORTSTATS_ERR_SHORT);
+					}
+				}
+			}
+			break;
+
+		case STATE_WAIT_SERIAL_PACKET_ACK_SIGNATURE:
+			// Aspettiamo la firma dallo slave...
+			ENGINE_NOISY(e, "STATE_WAIT_SERIAL_PACKET_ACK_SIGNATURE\n");
+			rval = serial_read_ring_until(fd, &e->rxring, sizeof(t_signature),
+				serial_transfer_deadline(fd, e->sigwrite.len + 2 * sizeof(t_signature), PEER_TURNAROUND_MS(e)));
+			// La firma resta nel ring finche' non e' stata validata:
+			// se e' sbagliata la risincronizzazione riparte da li'
+			if (rval == sizeof(t_signature))
+				ringbuf_copy(&e->rxring, (unsigned char *) &e->sigread, sizeof(t_signature));
+			if (rval < 0)
+			{
+				if (errno != EAGAIN && errno != EINTR)
+				{
+					ENGINE_ERROR(e, "STATE_WAIT_SERIAL_PACKET_ACK_SIGNATURE ERROR on reading!\n");
+					e->state_next = STATE_RESET;
+					PORTSTATS_ERROR(stats, PORTSTATS_ERR_IO);
+				}
+			}
+			else
+			{
+				if (rval == 0)
+				{
+					ENGINE_ERROR(e, "Timeout STATE_WAIT_SERIAL_PACKET_ACK_SIGNATURE. Check SLAVE\n");
+					serial_device_status(fd);
+					e->state_next = STATE_RESET;
+					PORTSTATS_ERROR(stats, PORTSTATS_ERR_TIMEOUT);
+				}
+				else
+				{
+					if (rval != sizeof(t_signature))
+					{
+						ENGINE_ERROR(e, "STATE_WAIT_SERIAL_PACKET_ACK_SIGNATURE ERROR\n");
+						e->state_next = STATE_RESET;
+						serial_device_status(fd);
+						PORTSTATS_ERROR(stats, PORTSTATS_ERR_SHORT);
+					}
+					else
+					{
+						ENGINE_NOISY(e, "STATE_WAIT_SERIAL_PACKET_ACK_SIGNATURE OK\n");
+						e->state_next = STATE_WAIT_SERIAL_PACKET_ACK;
+					}
+				}
+			}
+			break;
+
+		case STATE_WAIT_SERIAL_PACKET_ACK:
+			ENGINE_NOISY(e, "STATE_WAIT_SERIAL_PACKET_ACK\n");
+			// Proseguiamo nella lettura del pacchetto solo
+			// se quello che abbiamo ricevuto ha l'header uguale
+			// a quello che abbiamo spedito
+			if (e->cfg.crc != CRC_NONE)
+			{
+				// Lo slave ha verificato il CRC e risponde solo ACK/NAK
+				if (e->sigread.header == SERIAL_SIGNATURE_ACK &&
+					e->sigread.len == e->sigwrite.len &&
+					e->sigread.footer == SERIAL_SIGNATURE_FOOTER)
+				{
+					ringbuf_consume(&e->rxring, sizeof(t_signature));
+					e->goodpackettx++;
+					ENGINE_PRINT(e, "STATE_WAIT_SERIAL_PACKET_ACK Good Packet: %d\n", e->goodpackettx);
+					PORTSTATS_INC(stats, frames_tx);
+					PORTSTATS_ADD(stats, bytes_tx, e->sigwrite.len);
+					PORTSTATS_GOOD(stats);
+					e->state_next = STATE_WRITE_SERIAL_PACKET_SIGNATURE_MASTER;
+				}
+				else
+				if (e->sigread.header == SERIAL_SIGNATURE_NAK &&
+					e->sigread.len == e->sigwrite.len &&
+					e->sigread.footer == SERIAL_SIGNATURE_FOOTER)
+				{
+					// Il frame e' arrivato rovinato ma siamo ancora in
+					// sincronia: contiamo l'errore e andiamo avanti
+					ENGINE_ERROR(e, "STATE_WAIT_SERIAL_PACKET_ACK NAK: CRC ERROR ON SLAVE\n");
+					ringbuf_consume(&e->rxring, sizeof(t_signature));
+					e->state_next = STATE_WRITE_SERIAL_PACKET_SIGNATURE_MASTER;
+					PORTSTATS_ERROR(stats, PORTSTATS_ERR_PAYLOAD);
+				}
+				else
+				{
+					ENGINE_ERROR(e, "STATE_WAIT_SERIAL_PACKET_ACK WRONG ACK/NAK SIGNATURE\n");
+					serial_device_status(fd);
+					ringbuf_consume(&e->rxring, 1);
+					e->resync_word = SERIAL_SIGNATURE_ACK;
+					e->resync_mask = SERIAL_SIGNATURE_REPLY_MASK;
+					e->resync_state = STATE_WAIT_SERIAL_PACKET_ACK;
+					e->state_next = STATE_RESYNC;
+					PORTSTATS_ERROR(stats, PORTSTATS_ERR_SIGNATURE);
+				}
+			}
+			else
+			if (memcmp(&e->sigread, &e->sigwrite, sizeof(t_signature)) == 0)
+			{
+				ENGINE_NOISY(e, "STATE_WAIT_SERIAL_PACKET_ACK SIGNATURE OK.\n");
+				ringbuf_consume(&e->rxring, sizeof(t_signature));
+				rval = serial_read_ring_until(fd, &e->rxring, e->sigread.len,
+					serial_transfer_deadline(fd, e->sigread.len, PEER_TURNAROUND_MS(e)));
+				if (rval < 0)
+				{
+					if (errno != EAGAIN && errno != EINTR)
+					{
+						ENGINE_ERROR(e, "ERROR: STATE_WAIT_SERIAL_PACKET_ACK\n");
+						e->state_next = STATE_RESET;
+						PORTSTATS_ERROR(stats, PORTSTATS_ERR_IO);
+					}
+				}
+				else
+				{
+					if (rval == 0)
+					{
+						ENGINE_ERROR(e, "STATE_WAIT_SERIAL_PACKET_ACK TIMEOUT\n");
+						e->state_next = STATE_RESET;
+						PORTSTATS_ERROR(stats, PORTSTATS_ERR_TIMEOUT);
+					}
+					else
+					{
+						if (rval == (int) e->sigread.len)
+						{
+							// Abbiamo letto tutto il pacchetto,
+							// verifichiamo che sia corretto!
+							// Con la PRBS basta la sequenza, non quello che e' partito
+							payload = ringbuf_peek(&e->rxring, e->sigread.len, e->bufread);
+							if (e->cfg.prbs != PRBS_NONE ?
+								engine_prbs_check(e, payload, e->sigread.len) :
+								memcmp(payload, e->txpayload, e->sigread.len) == 0)
+							{
+								ringbuf_consume(&e->rxring, e->sigread.len);
+								e->goodpackettx++;
+								ENGINE_PRINT(e, "STATE_WAIT_SERIAL_PACKET_ACK Good Packet: %d\n", e->goodpackettx);
+								PORTSTATS_INC(stats, frames_tx);
+								PORTSTATS_ADD(stats, bytes_tx, e->sigwrite.len);
+								PORTSTATS_GOOD(stats);
+								e->state_next = STATE_WRITE_SERIAL_PACKET_SIGNATURE_MASTER;
+							}
+							else
+							{
+								// Pacchetto rovinato ma firma giusta: siamo
+								// ancora in sincronia, contiamo l'errore e
+								// andiamo avanti
+								ENGINE_ERROR(e, "ERROR ON STATE_WAIT_SERIAL_PACKET_ACK\n");
+								ringbuf_consume(&e->rxring, e->sigread.len);
+								e->state_next = STATE_WRITE_SERIAL_PACKET_SIGNATURE_MASTER;
+								serial_device_status(fd);
+								PORTSTATS_ERROR(stats, PORTSTATS_ERR_PAYLOAD);
+							}
+						}
+						else
+						{
+							ENGINE_ERROR(e, "STATE_WAIT_SERIAL_PACKET_ACK ERROR ON READING PACKET\n");
+							e->state_next = STATE_RESET;
+							serial_device_status(fd);
+							PORTSTATS_ERROR(stats, PORTSTATS_ERR_SHORT);
+						}
+					}
+				}
+			}
+			else
+			{
+				ENGINE_ERROR(e, "STATE_WAIT_SERIAL_PACKET_ACK WRONG SIGNATURE\n");
+				serial_device_status(fd);
+				ringbuf_consume(&e->rxring, 1);
+				e->resync_word = SERIAL_SIGNATURE_HEADER;
+				e->resync_mask = 0xffffffff;
+				e->resync_state = STATE_WAIT_SERIAL_PACKET_ACK;
+				e->state_next = STATE_RESYNC;
+				PORTSTATS_ERROR(stats, PORTSTATS_ERR_SIGNATURE);
+			}
+			break;
+
+		case STATE_WINDOW_SEND:
+			rval = window_send(&e->win, e->txpayload, e->cfg.payload, WINDOW_BURST_FRAMES(e));
+			if (rval < 0)
+			{
+				ENGINE_ERROR(e, "STATE_WINDOW_SEND ERROR: %d\n", rval);
+				serial_device_status(fd);
+				e->state_next = STATE_RESET;
+				PORTSTATS_ERROR(stats, PORTSTATS_ERR_IO);
+			}
+			else
+			{
+				e->goodpackettx += rval;
+				PORTSTATS_ADD(stats, frames_tx, rval);
+				PORTSTATS_ADD(stats, bytes_tx, rval * e->cfg.payload);
+				PORTSTATS_GOOD(stats);
+				ENGINE_PRINT(e, "STATE_WINDOW_SEND Good Packet: %d - Retransmits: %llu - "
+					"Goodput: %.0f B/s (%.1f%% of %d baud)\n",
+					e->goodpackettx, (unsigned long long) e->win.retransmits,
+					window_goodput(&e->win), window_efficiency(&e->win, serial_get_baudrate(fd)),
+					serial_get_baudrate(fd));
+			}
+			break;
+
+		// ISSUE STATES
+		case STATE_RESYNC:
+			// Scartiamo i byte che non possono essere l'inizio della
+			// firma attesa e ripartiamo dalla prima valida. Aspettiamo
+			// al massimo il tempo di un pacchetto intero
+			if (e->resync_deadline == 0)
+			{
+				e->resync_deadline = serial_transfer_deadline(fd,
+					ENGINE_BUFFER_SIZE + 2 * sizeof(t_signature) + sizeof(t_trailer), PEER_TURNAROUND_MS(e));
+				e->resync_dropped = 1;
+			}
+			e->resync_dropped += resync_ring(&e->rxring, e->resync_word, e->resync_mask);
+			rval = serial_read_ring_until(fd, &e->rxring, sizeof(t_signature), e->resync_deadline);
+			if (rval < 0)
+			{
+				if (errno != EAGAIN && errno != EINTR)
+				{
+					ENGINE_ERROR(e, "Error on STATE_RESYNC\n");
+					e->resync_deadline = 0;
+					e->state_next = STATE_RESET;
+					PORTSTATS_ERROR(stats, PORTSTATS_ERR_IO);
+				}
+			}
+			else
+			if (rval < (int) sizeof(t_signature))
+			{
+				ENGINE_ERROR(e, "STATE_RESYNC: no signature after %u bytes\n", e->resync_dropped);
+				e->resync_deadline = 0;
+				e->state_next = STATE_RESET;
+			}
+			else
+			{
+				ringbuf_copy(&e->rxring, (unsigned char *) &e->sigread, sizeof(t_signature));
+				if ((e->sigread.header & e->resync_mask) == (e->resync_word & e->resync_mask))
+				{
+					if (protocol_signature_ok(&e->sigread, e->resync_word, e->resync_mask, ENGINE_BUFFER_SIZE) &&
+						FRAME_FITS(e, e->sigread.len))
+					{
+						ENGINE_PRINT(e, "STATE_RESYNC: back in sync after %u bytes\n", e->resync_dropped);
+						e->resync_deadline = 0;
+						e->state_next = e->resync_state;
+						PORTSTATS_INC(stats, resyncs);
+						PORTSTATS_ADD(stats, resync_bytes, e->resync_dropped);
+					}
+					else
+					{
+						// L'header era nei dati: andiamo oltre
+						ringbuf_consume(&e->rxring, 1);
+						e->resync_dropped++;
+					}
+				}
+			}
+			break;
+
+		case STATE_RESET_SERIAL:
+			ENGINE_NOISY(e, "STATE_RESET_SERIAL\n");
+			rval = serial_device_reset(fd, e->cfg.baudrate, e->cfg.pre, e->cfg.post);
+			if (rval < 0)
+			{
+				if (errno != EAGAIN && errno != EINTR)
+				{
+					ENGINE_ERROR(e, "STATE_RESET_SERIAL ERROR\n");
+					PORTSTATS_ERROR(stats, PORTSTATS_ERR_IO);
+					return -ECERR_IO;
+				}
+			}
+			else
+			{
+				ENGINE_NOISY(e, "PORT RESETTED TO DEFAULT\n");
+			}
+			e->state_next = STATE_RESET;
+			break;
+
+		case STATE_RESET:
+			// Ogni volta che c'e' un'errore riduco il tempo di
+			// attesa...
+			if (e->timeout > 1000) e->timeout -= 1000; else e->timeout = e->cfg.command_timeout;
+			memset(e->bufread, 0, sizeof(e->bufread));
+			memset(&e->sigread, 0, sizeof(t_signature));
+			memset(&e->sigwrite, 0, sizeof(t_signature));
+			ringbuf_reset(&e->rxring);
+			window_reset(&e->win);
+			e->resync_deadline = 0;
+			// Alla partenza state_next vale ancora STATE_LAST:
+			// quello non e' un reset dovuto a un errore
+			if (e->state_next != STATE_LAST)
+				PORTSTATS_INC(stats, resets);
+			e->state_next = STATE_START;
+			e->goodpacketrx = 0;
+			e->goodpackettx = 0;
+			break;
+
+		case STATE_LAST:
+			// Deve essere l'ultimo!
+			break;
+	}
+
+	statetime_leave(e->times, e->state, e->state_next);
+	if (e->state != e->state_next)
+	{
+		ENGINE_NOISY(e, "<LOOP> Changing state from %s to %s\n",
+			engine_state_name[e->state], engine_state_name[e->state_next]);
+		e->state = e->state_next;
+	}
+	// Modalita' cadenzata: non consumiamo troppa CPU!!
+	if (e->cfg.pace_us > 0)
+		usleep(e->cfg.pace_us);
+	return 0;
+}
@@ -0,0 +1,123 @@
+#include <string.h>
+#include <pthread.h>
+#include "hexdump.h"
+#include "debug.h"
+
+static const char hex_digits[] = "0123456789abcdef";
+static pthread_once_t hexdump_once = PTHREAD_ONCE_INIT;
+static char hex_pair[256][2];
+static char printable[256];
+static int hexdump_limit = 0;
+
+static void hexdump_init(void)
+{
+	int i;
+
+	for (i = 0; i < 256; i++)
+	{
+		hex_pair[i][0] = hex_digits[i >> 4];
+		hex_pair[i][1] = hex_digits[i & 0x0f];
+		// Come isprint() nel locale "C"
+		printable[i] = (i >= 0x20 && i < 0x7f) ? i : '.';
+	}
+}
+
+size_t hexdump_line(char *out, const unsigned char *data, int len, unsigned int offset)
+{
+	char *p = out;
+	int digits, i;
+
+	pthread_once(&hexdump_once, hexdump_init);
+	if (len > HEXDUMP_WIDTH)
+		len = HEXDUMP_WIDTH;
+
+	// offset: almeno 5 cifre, come "%05x"
+	for (digits = 5; digits < 8 && (offset >> (digits * 4)) != 0; digits++)
+		;
+	for (i = digits - 1; i >= 0; i--)
+		*p++ = hex_digits[(offset >> (i * 4)) & 0x0f];
+	memset(p, ' ', 3);
+	p += 3;
+
+	// hex, con uno spazio in piu' dopo l'ottavo byte
+	for (i = 0; i < len; i++)
+	{
+		p[0] = hex_pair[data[i]][0];
+		p[1] = hex_pair[data[i]][1];
+		p[2] = ' ';
+		p += 3;
+		if (i == 7)
+			*p++ = ' ';
+	}
+	// colonne mancanti di una riga corta, piu' la separazione dall'ascii
+	i = (HEXDUMP_WIDTH - len) * 3 + (len < 8 ? 1 : 0) + 3;
+	memset(p, ' ', i);
+	p += i;
+
+	for (i = 0; i < len; i++)
+		*p++ = printable[data[i]];
+	*p++ = '\n';
+	*p = '\0';
+	return p - out;
+}
+
+// Righe da offset a offset + len, a blocchi di HEXDUMP_BLOCK_LINES per record
+static void hexdump_range(const unsigned char *data, int offset, int len)
+{
+	char block[HEXDUMP_BLOCK_LINES * HEXDUMP_LINE_MAX];
+	size_t n = 0;
+	int lines = 0;
+	int line_len;
+
+	while (len > 0)
+	{
+		line_len = len < HEXDUMP_WIDTH ? len : HEXDUMP_WIDTH;
+		n += hexdump_line(block + n, data + offset, line_len, offset);
+		offset += line_len;
+		len -= line_len;
+		if (++lines == HEXDUMP_BLOCK_LINES)
+		{
+			printR("%s", block);
+			n = 0;
+			lines = 0;
+		}
+	}
+	if (lines > 0)
+		printR("%s", block);
+}
+
+void hexdump(const unsigned char *data, int len)
+{
+	int limit = __atomic_load_n(&hexdump_limit, __ATOMIC_RELAXED);
+	int head, tail;
+
+	if (data == NULL || len <= 0)
+		return;
+	if (limit <= 0 || len <= 2 * limit)
+	{
+		hexdump_range(data, 0, len);
+		return;
+	}
+
+	// Testa e coda su righe intere, cosi' gli offset restano allineati
+	head = (limit + HEXDUMP_WIDTH - 1) / HEXDUMP_WIDTH * HEXDUMP_WIDTH;
+	tail = (len - limit) / HEXDUMP_WIDTH * HEXDUMP_WIDTH;
+	if (tail <= head)
+	{
+		hexdump_range(data, 0, len);
+		return;
+	}
+	hexdump_range(data, 0, head);
+	printR("... %d bytes skipped ...\n", tail - head);
+	hexdump_range(data, tail, len - tail);
+}
+
+void hexdump_set_limit(int bytes)
+{
+	__atomic_store_n(&hexdump_limit, bytes > 0 ? bytes : 0, __ATOMIC_RELAXED);
+}
+
+int hexdump_get_limit(void)
+{
+	return __atomic_load_n(&hexdump_limit, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,98 @@
+#include <string.h>
+#include "histogram.h"
+
+#define SUB_COUNT	(1 << HIST_SUB_BITS)
+#define HALF_COUNT	(1 << (HIST_SUB_BITS - 1))
+#define VALUE_MAX	((1ULL << HIST_MAX_BITS) - 1)
+
+static unsigned int hist_index(uint64_t v)
+{
+	unsigned int msb, shift;
+
+	if (v < SUB_COUNT)
+		return v;
+	// Il bit piu' alto e i HIST_SUB_BITS - 1 successivi scelgono il bucket
+	msb = 63 - __builtin_clzll(v);
+	shift = msb - HIST_SUB_BITS + 1;
+	return SUB_COUNT + (shift - 1) * HALF_COUNT + (unsigned int) ((v >> shift) - HALF_COUNT);
+}
+
+// Il valore piu' alto che finisce nel bucket idx
+static uint64_t hist_value(unsigned int idx)
+{
+	unsigned int k, shift;
+	uint64_t sub;
+
+	if (idx < SUB_COUNT)
+		return idx;
+	k = idx - SUB_COUNT;
+	shift = k / HALF_COUNT + 1;
+	sub = k % HALF_COUNT + HALF_COUNT;
+	return ((sub + 1) << shift) - 1;
+}
+
+void hist_reset(t_histogram *h)
+{
+	memset(h, 0, sizeof(t_histogram));
+}
+
+void hist_record(t_histogram *h, uint64_t value)
+{
+	if (value > VALUE_MAX)
+		value = VALUE_MAX;
+	if (h->count == 0 || value < h->min)
+		h->min = value;
+	if (value > h->max)
+		h->max = value;
+	h->count++;
+	h->sum += value;
+	h->buckets[hist_index(value)]++;
+}
+
+void hist_merge(t_histogram *dst, const t_histogram *src)
+{
+	unsigned int i;
+
+	if (src->count == 0)
+		return;
+	if (dst->count == 0 || src->min < dst->min)
+		dst->min = src->min;
+	if (src->max > dst->max)
+		dst->max = src->max;
+	dst->count += src->count;
+	dst->sum += src->sum;
+	for (i = 0; i < HIST_BUCKETS; i++)
+		dst->buckets[i] += src->buckets[i];
+}
+
+uint64_t hist_percentile(const t_histogram *h, double p)
+{
+	uint64_t target, seen = 0, v;
+	unsigned int i;
+
+	if (h->count == 0)
+		return 0;
+	if (p <= 0)
+		return h->min;
+	if (p >= 100)
+		return h->max;
+
+	target = (uint64_t) (p / 100.0 * h->count + 0.5);
+	if (target == 0)
+		target = 1;
+	for (i = 0; i < HIST_BUCKETS; i++)
+	{
+		seen += h->buckets[i];
+		if (seen >= target)
+		{
+			v = hist_value(i);
+			return v > h->max ? h->max : v;
+		}
+	}
+	return h->max;
+}
+
+double hist_mean(const t_histogram *h)
+{
+	return h->count ? (double) h->sum / h->count : 0.0;
+}
@@ -0,0 +1,712 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "log.h"
+#include "ringbuf.h"
+#include "debug.h"
+#include "ec_types.h"
+
+#define LOG_RING_SIZE	(KiB(64))
+#define LOG_MAX_RINGS	64
+#define LOG_DATA_MAX	1024
+#define LOG_LINE_MAX	4096
+#define LOG_SPEC_MAX	32
+#define LOG_IDLE_US	1000
+#define LOG_FLUSH_TRIES	100
+#define LOG_MAX_MODULES	32
+
+// Record in the ring: the header and the arguments, packed one after the other
+typedef struct {
+	uint32_t len;           // header + arguments
+	uint32_t flags;
+	const char *color;
+	const char *type;
+	const char *file;
+	const char *func;
+	const char *fmt;
+	int64_t ns;             // CLOCK_MONOTONIC
+} t_log_header;
+
+typedef union {
+	t_log_header h;
+	unsigned char raw[sizeof(t_log_header) + LOG_DATA_MAX];
+} t_log_record;
+
+typedef enum {
+	ARG_NONE,
+	ARG_INT,
+	ARG_LONG,
+	ARG_LLONG,
+	ARG_SIZE,
+	ARG_INTMAX,
+	ARG_PTRDIFF,
+	ARG_DOUBLE,
+	ARG_LDOUBLE,
+	ARG_PTR,
+	ARG_STR,
+} t_log_arg;
+
+// Uno slot vuoto (NULL) si riusa; nrings e' il piu' alto mai occupato
+static t_ringbuf *rings[LOG_MAX_RINGS];
+static int ring_dead[LOG_MAX_RINGS];    // thread uscito, si libera quando e' vuoto
+static int nrings = 0;
+static pthread_key_t log_key;
+static __thread t_ringbuf *log_ring = NULL;
+static __thread int log_ring_failed = 0;
+
+static pthread_once_t log_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t reg_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t drain_lock = PTHREAD_MUTEX_INITIALIZER;
+static int log_sync = 0;
+static int64_t wall_offset_ns = 0;
+static unsigned long dropped = 0;
+static unsigned long dropped_reported = 0;
+
+typedef struct {
+	const char *name;
+	int *level;
+} t_log_module;
+
+// Registrati dai costruttori prima di main(), poi solo letti
+static t_log_module modules[LOG_MAX_MODULES];
+static int nmodules = 0;
+static char levels_path[256] = "";
+static int levels_pending = 0;
+static const char *level_name[] = { "error", "info", "verbose", "noisy" };
+
+static int64_t log_clock(clockid_t id)
+{
+	struct timespec ts;
+
+	clock_gettime(id, &ts);
+	return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * Una conversione di fmt (subito dopo il '%'): restituisce il puntatore
+ * dopo la conversione, il tipo del suo argomento e quanti '*' contiene.
+ * Produttore e consumatore usano la stessa funzione, cosi' leggono gli
+ * argomenti esattamente come sono stati scritti.
+ */
+static const char *log_spec(const char *p, t_log_arg *arg, int *stars)
+{
+	int l = 0, z = 0, j = 0, t = 0, L = 0;
+
+	*stars = 0;
+	*arg = ARG_NONE;
+	while (*p != '\0' && strchr("-+ #0'", *p) != NULL)
+		p++;
+	if (*p == '*')
+	{
+		(*stars)++;
+		p++;
+	}
+	else
+		while (isdigit((unsigned char) *p))
+			p++;
+	if (*p == '.')
+	{
+		p++;
+		if (*p == '*')
+		{
+			(*stars)++;
+			p++;
+		}
+		else
+			while (isdigit((unsigned char) *p))
+				p++;
+	}
+	for (;; p++)
+	{
+		if (*p == 'l') l++;
+		else if (*p == 'h') continue;
+		else if (*p == 'z') z++;
+		else if (*p == 'j') j++;
+		else if (*p == 't') t++;
+		else if (*p == 'L' || *p == 'q') L++;
+		else break;
+	}
+
+	switch (*p)
+	{
+		case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+			if (l >= 2 || L) *arg = ARG_LLONG;
+			else if (l == 1) *arg = ARG_LONG;
+			else if (z) *arg = ARG_SIZE;
+			else if (j) *arg = ARG_INTMAX;
+			else if (t) *arg = ARG_PTRDIFF;
+			else *arg = ARG_INT;
+			break;
+		case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+			*arg = L ? ARG_LDOUBLE : ARG_DOUBLE;
+			break;
+		case 's':
+			*arg = ARG_STR;
+			break;
+		case 'p':
+			*arg = ARG_PTR;
+			break;
+		default:
+			// "%%" e le conversioni che non gestiamo (%n)
+			break;
+	}
+	if (*p != '\0')
+		p++;
+	return p;
+}
+
+static int log_put(t_log_record *rec, const void *val, size_t len)
+{
+	if (rec->h.len + len > sizeof(t_log_record))
+		return -1;
+	memcpy(rec->raw + rec->h.len, val, len);
+	rec->h.len += len;
+	return 0;
+}
+
+#define LOG_PUT(rec, type, ap) \
+	({ type _v = va_arg(ap, type); log_put(rec, &_v, sizeof(_v)); })
+
+// Copia gli argomenti nel record seguendo il formato
+static void log_pack(t_log_record *rec, va_list ap)
+{
+	const char *p = rec->h.fmt;
+	const char *s;
+	t_log_arg arg;
+	size_t room, n;
+	int stars, rval = 0;
+
+	// Senza posto per un argomento ci fermiamo: il consumatore
+	// chiude la riga con "..." quando gli argomenti finiscono
+	while (rval == 0 && (p = strchr(p, '%')) != NULL)
+	{
+		p = log_spec(p + 1, &arg, &stars);
+		while (rval == 0 && stars-- > 0)
+			rval = LOG_PUT(rec, int, ap);
+		if (rval < 0)
+			break;
+		switch (arg)
+		{
+			case ARG_NONE:    break;
+			case ARG_INT:     rval = LOG_PUT(rec, int, ap); break;
+			case ARG_LONG:    rval = LOG_PUT(rec, long, ap); break;
+			case ARG_LLONG:   rval = LOG_PUT(rec, long long, ap); break;
+			case ARG_SIZE:    rval = LOG_PUT(rec, size_t, ap); break;
+			case ARG_INTMAX:  rval = LOG_PUT(rec, intmax_t, ap); break;
+			case ARG_PTRDIFF: rval = LOG_PUT(rec, ptrdiff_t, ap); break;
+			case ARG_DOUBLE:  rval = LOG_PUT(rec, double, ap); break;
+			case ARG_LDOUBLE: rval = LOG_PUT(rec, long double, ap); break;
+			case ARG_PTR:     rval = LOG_PUT(rec, void *, ap); break;
+			case ARG_STR:
+				s = va_arg(ap, const char *);
+				if (s == NULL)
+					s = "(null)";
+				room = sizeof(t_log_record) - rec->h.len;
+				if (room == 0)
+				{
+					rval = -1;
+					break;
+				}
+				n = strnlen(s, room - 1);
+				memcpy(rec->raw + rec->h.len, s, n);
+				rec->raw[rec->h.len + n] = '\0';
+				rec->h.len += n + 1;
+				break;
+		}
+	}
+}
+
+static int log_get(const t_log_record *rec, size_t *off, void *val, size_t len)
+{
+	if (*off + len > rec->h.len)
+		return -1;
+	memcpy(val, rec->raw + *off, len);
+	*off += len;
+	return 0;
+}
+
+#define LOG_OUT(out, size, n, spec, val) \
+	({ int _r = snprintf((out) + (n), (size) > (n) ? (size) - (n) : 0, spec, val); \
+		(n) += _r > 0 ? (size_t) _r : 0; })
+
+// Formatta il messaggio del record in out, un argomento alla volta
+static size_t log_unpack(const t_log_record *rec, char *out, size_t size)
+{
+	const char *p = rec->h.fmt;
+	const char *q;
+	char spec[LOG_SPEC_MAX];
+	size_t n = 0, off = sizeof(t_log_header), k, lit;
+	t_log_arg arg;
+	int stars, star;
+	union {
+		int i; long l; long long ll; size_t z; intmax_t j; ptrdiff_t t;
+		double d; long double ld; void *ptr;
+	} v;
+
+	for (;;)
+	{
+		q = strchr(p, '%');
+		lit = q != NULL ? (size_t) (q - p) : strlen(p);
+		if (n + lit >= size)
+			lit = n < size ? size - n - 1 : 0;
+		memcpy(out + n, p, lit);
+		n += lit;
+		if (q == NULL)
+			break;
+
+		p = log_spec(q + 1, &arg, &stars);
+		// La conversione da sola, con i '*' gia' sostituiti dal valore
+		for (k = 0; q < p && k < sizeof(spec) - 12; q++)
+		{
+			if (*q == '*')
+			{
+				if (log_get(rec, &off, &star, sizeof(star)) < 0)
+					goto truncated;
+				k += sprintf(spec + k, "%d", star);
+			}
+			else
+				spec[k++] = *q;
+		}
+		spec[k] = '\0';
+
+		switch (arg)
+		{
+			case ARG_NONE:
+				if (strcmp(spec, "%%") == 0 && n + 1 < size)
+					out[n++] = '%';
+				break;
+			case ARG_INT:
+				if (log_get(rec, &off, &v.i, sizeof(v.i)) < 0) goto truncated;
+				LOG_OUT(out, size, n, spec, v.i);
+				break;
+			case ARG_LONG:
+				if (log_get(rec, &off, &v.l, sizeof(v.l)) < 0) goto truncated;
+				LOG_OUT(out, size, n, spec, v.l);
+				break;
+			case ARG_LLONG:
+				if (log_get(rec, &off, &v.ll, sizeof(v.ll)) < 0) goto truncated;
+				LOG_OUT(out, size, n, spec, v.ll);
+				break;
+			case ARG_SIZE:
+				if (log_get(rec, &off, &v.z, sizeof(v.z)) < 0) goto truncated;
+				LOG_OUT(out, size, n, spec, v.z);
+				break;
+			case ARG_INTMAX:
+				if (log_get(rec, &off, &v.j, sizeof(v.j)) < 0) goto truncated;
+				LOG_OUT(out, size, n, spec, v.j);
+				break;
+			case ARG_PTRDIFF:
+				if (log_get(rec, &off, &v.t, sizeof(v.t)) < 0) goto truncated;
+				LOG_OUT(out, size, n, spec, v.t);
+				break;
+			case ARG_DOUBLE:
+				if (log_get(rec, &off, &v.d, sizeof(v.d)) < 0) goto truncated;
+				LOG_OUT(out, size, n, spec, v.d);
+				break;
+			case ARG_LDOUBLE:
+				if (log_get(rec, &off, &v.ld, sizeof(v.ld)) < 0) goto truncated;
+				LOG_OUT(out, size, n, spec, v.ld);
+				break;
+			case ARG_PTR:
+				if (log_get(rec, &off, &v.ptr, sizeof(v.ptr)) < 0) goto truncated;
+				LOG_OUT(out, size, n, spec, v.ptr);
+				break;
+			case ARG_STR:
+				if (off >= rec->h.len) goto truncated;
+				LOG_OUT(out, size, n, spec, (const char *) rec->raw + off);
+				off += strlen((const char *) rec->raw + off) + 1;
+				break;
+		}
+		if (n >= size)
+			break;
+	}
+	if (n >= size)
+		n = size - 1;
+	out[n] = '\0';
+	return n;
+
+truncated:
+	if (n + 4 < size)
+		n += sprintf(out + n, "...\n");
+	else
+		n = size - 1;
+	out[n] = '\0';
+	return n;
+}
+
+static void log_emit(const t_log_record *rec)
+{
+	char line[LOG_LINE_MAX];
+	FILE *out = (rec->h.flags & LOG_F_STDERR) ? stderr : stdout;
+	int64_t wall;
+	size_t n = 0;
+
+	if (!(rec->h.flags & LOG_F_RAW))
+	{
+		if (rec->h.flags & LOG_F_TIMESTAMP)
+		{
+			wall = rec->h.ns + wall_offset_ns;
+			n = snprintf(line, sizeof(line), "%s[%08ld:%06ld] %s %s (%s): ", rec->h.color,
+				(long) (wall / 1000000000LL), (long) (wall % 1000000000LL) / 1000L,
+				rec->h.file, rec->h.type, rec->h.func);
+		}
+		else
+			n = snprintf(line, sizeof(line), "%s%s %s (%s): ", rec->h.color,
+				rec->h.file, rec->h.type, rec->h.func);
+	}
+	n += log_unpack(rec, line + n, sizeof(line) - n - sizeof(ANSI_RESET));
+	if (!(rec->h.flags & LOG_F_RAW))
+	{
+		memcpy(line + n, ANSI_RESET, sizeof(ANSI_RESET) - 1);
+		n += sizeof(ANSI_RESET) - 1;
+	}
+	fwrite(line, 1, n, out);
+}
+
+/*
+ * Scrive i record di tutti i ring in ordine di tempo: ogni ring e' gia'
+ * ordinato, basta prendere ogni volta la testa piu' vecchia.
+ * Solo con drain_lock: i ring hanno un solo consumatore.
+ */
+static int log_drain(void)
+{
+	t_log_record rec;
+	t_log_header h;
+	t_ringbuf *rb, *oldest;
+	int64_t oldest_ns = 0;
+	unsigned long lost;
+	int i, n, count = 0;
+
+	for (;;)
+	{
+		oldest = NULL;
+		n = __atomic_load_n(&nrings, __ATOMIC_ACQUIRE);
+		for (i = 0; i < n; i++)
+		{
+			rb = __atomic_load_n(&rings[i], __ATOMIC_ACQUIRE);
+			if (rb == NULL || ringbuf_used(rb) < sizeof(t_log_header))
+				continue;
+			ringbuf_copy(rb, (unsigned char *) &h, sizeof(t_log_header));
+			if (h.len < sizeof(t_log_header) || h.len > sizeof(t_log_record) ||
+				h.len > ringbuf_used(rb))
+			{
+				// Il ring non e' piu' allineato ai record: si butta
+				// tutto quello che c'e', il produttore riparte pulito
+				ringbuf_consume(rb, ringbuf_used(rb));
+				__atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+				continue;
+			}
+			if (oldest == NULL || h.ns < oldest_ns)
+			{
+				oldest = rb;
+				oldest_ns = h.ns;
+			}
+		}
+		if (oldest == NULL)
+			break;
+		ringbuf_copy(oldest, (unsigned char *) &h, sizeof(t_log_header));
+		ringbuf_read(oldest, rec.raw, h.len);
+		log_emit(&rec);
+		count++;
+	}
+
+	// I ring dei thread usciti, ormai vuoti, liberano il loro slot
+	for (i = 0; i < n; i++)
+	{
+		if (!__atomic_load_n(&ring_dead[i], __ATOMIC_ACQUIRE))
+			continue;
+		rb = rings[i];
+		if (ringbuf_used(rb) > 0)
+			continue;
+		pthread_mutex_lock(&reg_lock);
+		__atomic_store_n(&rings[i], NULL, __ATOMIC_RELEASE);
+		ring_dead[i] = 0;
+		pthread_mutex_unlock(&reg_lock);
+		ringbuf_free(rb);
+		free(rb);
+	}
+
+	lost = __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+	if (lost != dropped_reported)
+	{
+		fprintf(stdout, ANSI_RED "log: %lu messages dropped" ANSI_RESET "\n", lost - dropped_reported);
+		dropped_reported = lost;
+		count++;
+	}
+	if (count > 0)
+	{
+		fflush(stdout);
+		fflush(stderr);
+	}
+	return count;
+}
+
+void log_module(const char *name, int *level)
+{
+	if (nmodules < LOG_MAX_MODULES)
+	{
+		modules[nmodules].name = name;
+		modules[nmodules].level = level;
+		nmodules++;
+	}
+}
+
+int log_module_level(const char *name, int level)
+{
+	int i;
+
+	for (i = 0; i < nmodules; i++)
+	{
+		if (strcmp(name, modules[i].name) == 0)
+			return __atomic_exchange_n(modules[i].level, level, __ATOMIC_RELAXED);
+	}
+	return -1;
+}
+
+void log_levels_file(const char *path)
+{
+	snprintf(levels_path, sizeof(levels_path), "%s", path);
+}
+
+void log_levels_request(void)
+{
+	__atomic_store_n(&levels_pending, 1, __ATOMIC_RELEASE);
+}
+
+static int log_level_parse(const char *arg)
+{
+	char *end;
+	long val;
+	int i;
+
+	for (i = 0; i < (int) ArraySize(level_name); i++)
+	{
+		if (strcasecmp(arg, level_name[i]) == 0)
+			return i;
+	}
+	val = strtol(arg, &end, 10);
+	if (end == arg || *end != '\0' || val < DBG_ERROR || val > DBG_NOISY)
+		return -1;
+	return val;
+}
+
+// Solo dal thread del logger: i livelli si cambiano fuori dai signal handler
+static void log_levels_load(void)
+{
+	char line[128], name[64], arg[32];
+	FILE *fp;
+	int i, level, found;
+
+	if (levels_path[0] == '\0')
+		return;
+	fp = fopen(levels_path, "r");
+	if (fp == NULL)
+	{
+		printRaw(ANSI_RED, "LOG ", "Cannot read the levels from %s\n", levels_path);
+		return;
+	}
+	while (fgets(line, sizeof(line), fp) != NULL)
+	{
+		if (line[0] == '#' || sscanf(line, "%63s %31s", name, arg) != 2)
+			continue;
+		level = log_level_parse(arg);
+		if (level < 0)
+		{
+			printRaw(ANSI_RED, "LOG ", "Bad level '%s' for %s\n", arg, name);
+			continue;
+		}
+		found = 0;
+		for (i = 0; i < nmodules; i++)
+		{
+			if (strcmp(name, "all") != 0 && strcmp(name, modules[i].name) != 0)
+				continue;
+			__atomic_store_n(modules[i].level, level, __ATOMIC_RELAXED);
+			found = 1;
+			printRaw(ANSI_GREEN, "LOG ", "%s: level %s%s\n", modules[i].name, level_name[level],
+				level > DBG_BUILD_LEVEL ? " (above the build level, compiled out)" : "");
+		}
+		if (!found)
+			printRaw(ANSI_RED, "LOG ", "Unknown module %s\n", name);
+	}
+	fclose(fp);
+}
+
+static void *log_pthread(void *data)
+{
+	sigset_t set;
+
+	(void) data;
+	// I segnali vanno gestiti dagli altri thread: il loro handler
+	// potrebbe volere drain_lock, che qui potrebbe essere preso
+	sigfillset(&set);
+	sigdelset(&set, SIGSEGV);
+	sigdelset(&set, SIGBUS);
+	sigdelset(&set, SIGFPE);
+	sigdelset(&set, SIGILL);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	for (;;)
+	{
+		if (__atomic_exchange_n(&levels_pending, 0, __ATOMIC_ACQ_REL))
+			log_levels_load();
+		pthread_mutex_lock(&drain_lock);
+		if (log_drain() == 0)
+		{
+			pthread_mutex_unlock(&drain_lock);
+			usleep(LOG_IDLE_US);
+		}
+		else
+			pthread_mutex_unlock(&drain_lock);
+	}
+	return NULL;
+}
+
+/*
+ * Distruttore della chiave, nel thread che esce: il ring resta a chi
+ * scarica finche' non e' vuoto, poi il suo slot torna libero. Quello
+ * che il thread scrive ancora da qui in poi esce subito.
+ */
+static void log_ring_release(void *data)
+{
+	int i;
+
+	log_ring = NULL;
+	log_ring_failed = 1;
+	pthread_mutex_lock(&reg_lock);
+	for (i = 0; i < nrings; i++)
+	{
+		if (rings[i] == data)
+			__atomic_store_n(&ring_dead[i], 1, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&reg_lock);
+}
+
+static void log_init(void)
+{
+	pthread_attr_t attr;
+	pthread_t thread;
+
+	wall_offset_ns = log_clock(CLOCK_REALTIME) - log_clock(CLOCK_MONOTONIC);
+	if (pthread_key_create(&log_key, log_ring_release) != 0)
+	{
+		log_sync = 1;
+		return;
+	}
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&thread, &attr, log_pthread, NULL) != 0)
+		log_sync = 1;
+	pthread_attr_destroy(&attr);
+	atexit(log_flush);
+}
+
+// Il ring del thread chiamante, creato alla prima scrittura
+static t_ringbuf *log_thread_ring(void)
+{
+	t_ringbuf *rb;
+	int i;
+
+	if (log_ring != NULL || log_ring_failed)
+		return log_ring;
+
+	log_ring_failed = 1;
+	rb = malloc(sizeof(t_ringbuf));
+	if (rb == NULL)
+		return NULL;
+	if (ringbuf_init(rb, LOG_RING_SIZE) < 0)
+	{
+		free(rb);
+		return NULL;
+	}
+	pthread_mutex_lock(&reg_lock);
+	for (i = 0; i < nrings && rings[i] != NULL; i++)
+		;
+	if (i < LOG_MAX_RINGS)
+	{
+		__atomic_store_n(&rings[i], rb, __ATOMIC_RELEASE);
+		if (i == nrings)
+			__atomic_store_n(&nrings, nrings + 1, __ATOMIC_RELEASE);
+		log_ring = rb;
+		log_ring_failed = 0;
+	}
+	pthread_mutex_unlock(&reg_lock);
+	if (log_ring == NULL)
+	{
+		// Piu' di LOG_MAX_RINGS thread vivi che scrivono: questo scrive subito
+		ringbuf_free(rb);
+		free(rb);
+	}
+	else
+		pthread_setspecific(log_key, rb);
+	return log_ring;
+}
+
+void log_write(unsigned int flags, const char *color, const char *type,
+	const char *file, const char *func, const char *fmt, ...)
+{
+	t_log_record rec;
+	t_ringbuf *rb;
+	va_list ap;
+
+	rec.h.ns = log_clock(CLOCK_MONOTONIC);
+	pthread_once(&log_once, log_init);
+
+	rec.h.len = sizeof(t_log_header);
+	rec.h.flags = flags;
+	rec.h.color = color;
+	rec.h.type = type;
+	rec.h.file = file;
+	rec.h.func = func;
+	rec.h.fmt = fmt;
+	va_start(ap, fmt);
+	log_pack(&rec, ap);
+	va_end(ap);
+
+	rb = log_sync ? NULL : log_thread_ring();
+	if (rb == NULL)
+	{
+		// Senza thread o senza ring: come prima, subito
+		log_emit(&rec);
+		fflush(stdout);
+		return;
+	}
+	// Solo il record intero: se non c'e' posto lo perdiamo, non aspettiamo
+	if (ringbuf_space(rb) < rec.h.len)
+	{
+		__atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	ringbuf_write(rb, rec.raw, rec.h.len);
+}
+
+void log_flush(void)
+{
+	int i;
+
+	// Da exit() in un thread qualunque, anche mentre il thread del logger
+	// sta scrivendo: niente attesa infinita sul lock
+	for (i = 0; i < LOG_FLUSH_TRIES; i++)
+	{
+		if (pthread_mutex_trylock(&drain_lock) == 0)
+		{
+			log_drain();
+			pthread_mutex_unlock(&drain_lock);
+			return;
+		}
+		usleep(LOG_IDLE_US);
+	}
+}
+
+unsigned long log_dropped(void)
+{
+	return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+}
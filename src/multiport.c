@@ -0,0 +1,362 @@
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "multiport.h"
+#include "serial.h"
+#include "portstats.h"
+#include "statetime.h"
+#include "ec_types.h"
+#include "debug.h"
+
+DBG_MODULE(debuglevelDriver, "multiport", DBG_INFO)
+
+typedef struct {
+	const t_multiport_config *cfg;
+	int npairs;
+	int next;                               // prossima coppia da aprire
+	int pair[MULTIPORT_MAX_PORTS / 2];      // primo capo di ogni coppia
+	int fd[MULTIPORT_MAX_PORTS];
+} t_multiport_open;
+
+// Stato della prova in corso, letto anche dal gestore dei segnali
+static const t_multiport_config *run_cfg = NULL;
+static t_engine *engines[MULTIPORT_MAX_PORTS];
+static pthread_t threads[MULTIPORT_MAX_PORTS];
+static int64_t run_start_us = 0;
+
+// La barriera di partenza: i thread si contano e aspettano il via
+static pthread_mutex_t gate_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gate_cond = PTHREAD_COND_INITIALIZER;
+static int gate_ready = 0;
+static int gate_open = 0;
+
+// I due capi di un link virtuale vanno aperti uno dopo l'altro
+static pthread_mutex_t vlink_open_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int multiport_load(t_multiport_config *cfg, const char *path)
+{
+	char line[512];
+	const char *p;
+	t_multiport_port *port;
+	FILE *fp;
+	int lineno = 0;
+	int rval = 0;
+	int i, j, n;
+
+	memset(cfg, 0, sizeof(t_multiport_config));
+	fp = fopen(path, "r");
+	if (fp == NULL)
+	{
+		DRIVER_ERROR("Cannot read %s: %s\n", path, strerror(errno));
+		return -ECERR_IO;
+	}
+	while (fgets(line, sizeof(line), fp) != NULL)
+	{
+		lineno++;
+		for (p = line; isspace((unsigned char) *p); p++)
+			;
+		if (*p == '\0' || *p == '#')
+			continue;
+		if (cfg->nports >= MULTIPORT_MAX_PORTS)
+		{
+			DRIVER_ERROR("%s:%d: more than %d ports\n", path, lineno, MULTIPORT_MAX_PORTS);
+			rval = -ECERR_BADPARAM;
+			break;
+		}
+		port = &cfg->ports[cfg->nports];
+		n = sscanf(p, "%31s %255s %d %31s %d %d", port->name, port->device, &port->baudrate,
+			port->peer_name, &port->pre, &port->post);
+		if (n < 4 || port->baudrate <= 0 || port->pre < 0 || port->post < 0)
+		{
+			DRIVER_ERROR("%s:%d: expected NAME DEVICE BAUD PEER [PRE [POST]]\n", path, lineno);
+			rval = -ECERR_BADPARAM;
+			continue;
+		}
+		port->line = lineno;
+		cfg->nports++;
+	}
+	fclose(fp);
+	if (rval < 0)
+		return rval;
+
+	// Ogni porta e il suo peer devono nominarsi a vicenda
+	for (i = 0; i < cfg->nports; i++)
+	{
+		port = &cfg->ports[i];
+		port->peer = -1;
+		for (j = 0; j < cfg->nports; j++)
+		{
+			if (j < i && strcmp(cfg->ports[j].name, port->name) == 0)
+			{
+				DRIVER_ERROR("%s:%d: port %s already defined at line %d\n",
+					path, port->line, port->name, cfg->ports[j].line);
+				rval = -ECERR_BADPARAM;
+			}
+			if (j != i && strcmp(cfg->ports[j].name, port->peer_name) == 0)
+				port->peer = j;
+		}
+		if (port->peer < 0)
+		{
+			DRIVER_ERROR("%s:%d: unknown peer %s of %s\n", path, port->line, port->peer_name, port->name);
+			rval = -ECERR_BADPARAM;
+		}
+		else if (strcmp(cfg->ports[port->peer].peer_name, port->name) != 0)
+		{
+			DRIVER_ERROR("%s:%d: the peer of %s is %s, but the peer of %s is %s\n", path, port->line,
+				port->name, port->peer_name, port->peer_name, cfg->ports[port->peer].peer_name);
+			rval = -ECERR_BADPARAM;
+		}
+	}
+	if (rval == 0 && cfg->nports == 0)
+	{
+		DRIVER_ERROR("%s: no ports\n", path);
+		rval = -ECERR_BADPARAM;
+	}
+	return rval;
+}
+
+static int multiport_open_port(const t_multiport_port *port)
+{
+	int fd = serial_device_init(port->device, port->baudrate, port->pre, port->post);
+
+	if (fd < 0)
+	{
+		DRIVER_ERROR("%s: cannot open %s: %d\n", port->name, port->device, fd);
+	}
+	else
+	{
+		DRIVER_VERBOSE("%s: %s FD %d @ %d - PRE: %d - POST: %d\n",
+			port->name, port->device, fd, port->baudrate, port->pre, port->post);
+	}
+	return fd;
+}
+
+// Un worker del pool: apre coppie finche' ce ne sono
+static void *multiport_open_pthread(void *data)
+{
+	t_multiport_open *o = data;
+	const t_multiport_port *a, *b;
+	int idx, virtual;
+
+	while ((idx = __atomic_fetch_add(&o->next, 1, __ATOMIC_RELAXED)) < o->npairs)
+	{
+		a = &o->cfg->ports[o->pair[idx]];
+		b = &o->cfg->ports[a->peer];
+		virtual = strcmp(a->device, b->device) == 0;
+		if (virtual)
+			pthread_mutex_lock(&vlink_open_lock);
+		o->fd[o->pair[idx]] = multiport_open_port(a);
+		o->fd[a->peer] = multiport_open_port(b);
+		if (virtual)
+			pthread_mutex_unlock(&vlink_open_lock);
+	}
+	return NULL;
+}
+
+static int multiport_open(t_multiport_open *o, int workers)
+{
+	pthread_t pool[MULTIPORT_MAX_PORTS / 2];
+	int started, i;
+
+	if (workers > o->npairs)
+		workers = o->npairs;
+	for (started = 0; started < workers; started++)
+	{
+		if (pthread_create(&pool[started], NULL, multiport_open_pthread, o) != 0)
+			break;
+	}
+	// Senza nessun worker apre tutto il chiamante
+	if (started == 0)
+		multiport_open_pthread(o);
+	for (i = 0; i < started; i++)
+		pthread_join(pool[i], NULL);
+
+	for (i = 0; i < o->cfg->nports; i++)
+	{
+		if (o->fd[i] < 0)
+			return -ECERR_IO;
+	}
+	return 0;
+}
+
+static void *multiport_engine_pthread(void *data)
+{
+	pthread_mutex_lock(&gate_lock);
+	gate_ready++;
+	pthread_cond_broadcast(&gate_cond);
+	while (!gate_open)
+		pthread_cond_wait(&gate_cond, &gate_lock);
+	pthread_mutex_unlock(&gate_lock);
+	return engine_run(data);
+}
+
+static void multiport_gate(int count)
+{
+	pthread_mutex_lock(&gate_lock);
+	while (gate_ready < count)
+		pthread_cond_wait(&gate_cond, &gate_lock);
+	gate_open = 1;
+	pthread_cond_broadcast(&gate_cond);
+	pthread_mutex_unlock(&gate_lock);
+}
+
+static const char *multiport_ber(char *buf, size_t size, t_portstats_cnt bits, t_portstats_cnt errors)
+{
+	if (bits == 0)
+		return "-";
+	snprintf(buf, size, "%.2e", (double) errors / bits);
+	return buf;
+}
+
+void multiport_print(void)
+{
+	const t_multiport_config *cfg = __atomic_load_n(&run_cfg, __ATOMIC_ACQUIRE);
+	const t_multiport_port *port;
+	t_portstats_counters c;
+	t_portstats_cnt frames_tx = 0, frames_rx = 0, errors = 0, resets = 0, resyncs = 0;
+	t_portstats_cnt prbs_bits = 0, prbs_errors = 0;
+	char ber[16];
+	double secs, goodput, total = 0;
+	int i;
+
+	if (cfg == NULL || run_start_us == 0)
+		return;
+	secs = (serial_now_ms() * 1000L - run_start_us) / 1e6;
+	if (secs <= 0)
+		return;
+
+	printR("%-12s %-20s %-12s %8s %10s %10s %12s %7s %7s %7s %9s\n",
+		"PORT", "DEVICE", "PEER", "BAUD", "FRAMES-TX", "FRAMES-RX", "GOODPUT(B/s)",
+		"ERRORS", "RESETS", "RESYNCS", "BER");
+	for (i = 0; i < cfg->nports; i++)
+	{
+		port = &cfg->ports[i];
+		portstats_read(engines[i]->stats, &c);
+		goodput = (c.bytes_tx + c.bytes_rx) / secs;
+		printR("%-12s %-20.20s %-12s %8d %10lu %10lu %12.0f %7lu %7lu %7lu %9s\n",
+			port->name, port->device, port->peer_name, port->baudrate,
+			c.frames_tx, c.frames_rx, goodput, portstats_errors(&c), c.resets, c.resyncs,
+			multiport_ber(ber, sizeof(ber), c.prbs_bits, c.prbs_errors));
+		frames_tx += c.frames_tx;
+		frames_rx += c.frames_rx;
+		errors += portstats_errors(&c);
+		resets += c.resets;
+		resyncs += c.resyncs;
+		prbs_bits += c.prbs_bits;
+		prbs_errors += c.prbs_errors;
+		total += goodput;
+	}
+	printR("%-12s %-20s %-12s %8s %10lu %10lu %12.0f %7lu %7lu %7lu %9s\n",
+		"TOTAL", "", "", "", frames_tx, frames_rx, total, errors, resets, resyncs,
+		multiport_ber(ber, sizeof(ber), prbs_bits, prbs_errors));
+	printR("%d ports, %d pairs, %.1f s\n", cfg->nports, cfg->nports / 2, secs);
+}
+
+int multiport_run(const t_multiport_config *cfg, const t_engine_config *tmpl,
+	int workers, int seconds)
+{
+	static t_multiport_open o;
+	t_engine_config ecfg;
+	t_portstats_counters c;
+	const t_multiport_port *port, *peer;
+	int64_t deadline;
+	int created = 0, started = 0;
+	int rval = 0;
+	int i;
+
+	memset(&o, 0, sizeof(o));
+	o.cfg = cfg;
+	for (i = 0; i < cfg->nports; i++)
+	{
+		o.fd[i] = -1;
+		if (i < cfg->ports[i].peer)
+			o.pair[o.npairs++] = i;
+	}
+
+	DRIVER_PRINT("Opening %d ports with %d workers\n", cfg->nports,
+		workers < o.npairs ? workers : o.npairs);
+	rval = multiport_open(&o, workers);
+	if (rval < 0)
+		goto out;
+
+	// Le tabelle hanno un solo scrittore: si riempiono qui, prima dei thread
+	for (i = 0; i < cfg->nports; i++)
+	{
+		port = &cfg->ports[i];
+		peer = &cfg->ports[port->peer];
+		if (portstats_attach(o.fd[i], port->name) == NULL)
+		{
+			rval = -ECERR_OUTOFMEM;
+			goto out;
+		}
+		if (statetime_attach(o.fd[i], port->name, STATE_LAST, engine_state_name) == NULL)
+			DRIVER_ERROR("%s: no state times\n", port->name);
+
+		ecfg = *tmpl;
+		ecfg.fd = o.fd[i];
+		ecfg.name = port->name;
+		ecfg.baudrate = port->baudrate;
+		ecfg.pre = port->pre;
+		ecfg.post = port->post;
+		// Il payload e' quello della porta piu' lenta della coppia
+		ecfg.payload = engine_payload_len(port->baudrate < peer->baudrate ?
+			port->baudrate : peer->baudrate);
+		// Come nel test a due porte: il secondo capo diventa master
+		if (i > port->peer)
+			ecfg.command_timeout = tmpl->command_timeout / 5;
+		engines[i] = engine_create(&ecfg);
+		if (engines[i] == NULL)
+		{
+			rval = -ECERR_OUTOFMEM;
+			goto out;
+		}
+		created++;
+	}
+
+	gate_ready = 0;
+	gate_open = 0;
+	for (started = 0; started < cfg->nports; started++)
+	{
+		if (pthread_create(&threads[started], NULL, multiport_engine_pthread, engines[started]) != 0)
+		{
+			DRIVER_ERROR("%s: cannot start the engine thread\n", cfg->ports[started].name);
+			// Chi e' gia' partito esce appena passa la barriera
+			for (i = 0; i < started; i++)
+				engine_stop(engines[i]);
+			multiport_gate(started);
+			rval = -ECERR_OUTOFMEM;
+			goto out;
+		}
+	}
+
+	multiport_gate(started);
+	run_start_us = serial_now_ms() * 1000L;
+	__atomic_store_n(&run_cfg, cfg, __ATOMIC_RELEASE);
+	DRIVER_PRINT("%d ports started%s\n", cfg->nports, seconds > 0 ? "" : ", until a signal");
+
+	deadline = serial_deadline_in(seconds * 1000L);
+	while (seconds == 0 || serial_time_left(deadline) > 0)
+		sleep(1);
+
+	multiport_print();
+	for (i = 0; i < cfg->nports; i++)
+	{
+		portstats_read(engines[i]->stats, &c);
+		rval += (int) portstats_errors(&c);
+	}
+
+out:
+	__atomic_store_n(&run_cfg, NULL, __ATOMIC_RELEASE);
+	engine_stop_join(engines, threads, started);
+	for (i = 0; i < created; i++)
+		engine_destroy(engines[i]);
+	for (i = 0; i < cfg->nports; i++)
+	{
+		if (o.fd[i] >= 0)
+			close(o.fd[i]);
+	}
+	return rval;
+}
@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "portstats.h"
+#include "ec_types.h"
+#include "debug.h"
+
+DBG_MODULE(debuglevelDriver, "portstats", DBG_ERROR)
+
+static t_portstats table[PORTSTATS_MAX];
+static int table_used = 0;
+
+static const char *err_name[] = {
+	[PORTSTATS_ERR_IO] = "io",
+	[PORTSTATS_ERR_TIMEOUT] = "timeout",
+	[PORTSTATS_ERR_SHORT] = "short",
+	[PORTSTATS_ERR_SIGNATURE] = "signature",
+	[PORTSTATS_ERR_PAYLOAD] = "payload",
+	[PORTSTATS_ERR_COMMAND] = "command",
+};
+
+// Nell'ordine di t_portstats_counters
+static const char *field_name[] = {
+	"frames_tx", "frames_rx", "bytes_tx", "bytes_rx",
+	"err_io", "err_timeout", "err_short", "err_signature", "err_payload", "err_command",
+	"resets", "resyncs", "resync_bytes",
+	"prbs_bits", "prbs_errors", "prbs_losses",
+	"line_rx", "line_tx", "frame", "overrun", "parity", "brk", "buf_overrun",
+	"breaks_sent",
+};
+
+t_portstats *portstats_attach(int fd, const char *name)
+{
+	t_portstats *ps;
+	int n = table_used;
+
+	if (n >= PORTSTATS_MAX)
+	{
+		DRIVER_ERROR("No room for the statistics of FD %d\n", fd);
+		return NULL;
+	}
+
+	ps = &table[n];
+	memset(ps, 0, sizeof(t_portstats));
+	ps->fd = fd;
+	snprintf(ps->name, sizeof(ps->name), "%s", name);
+	// I contatori di linea partono da zero per questa sessione
+	transport_get_stats(fd, &ps->base);
+	// Il blocco e' completo prima di essere visibile ai lettori
+	__atomic_store_n(&table_used, n + 1, __ATOMIC_RELEASE);
+	DRIVER_NOISY("FD %d statistics in slot %d as %s\n", fd, n, ps->name);
+	return ps;
+}
+
+int portstats_count(void)
+{
+	return __atomic_load_n(&table_used, __ATOMIC_ACQUIRE);
+}
+
+t_portstats *portstats_at(int idx)
+{
+	if (idx < 0 || idx >= portstats_count())
+		return NULL;
+	return &table[idx];
+}
+
+t_portstats *portstats_of(int fd)
+{
+	int i, n = portstats_count();
+
+	for (i = 0; i < n; i++)
+	{
+		if (table[i].fd == fd)
+			return &table[i];
+	}
+	return NULL;
+}
+
+static int64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000000L + ts.tv_nsec / 1000L;
+}
+
+void portstats_fault(t_portstats *ps)
+{
+	// Conta il primo errore: i successivi fanno parte dello stesso guasto
+	if (ps->fault_us == 0)
+		ps->fault_us = now_us();
+}
+
+void portstats_recovered(t_portstats *ps)
+{
+	hist_record(&ps->recovery, now_us() - ps->fault_us);
+	ps->fault_us = 0;
+}
+
+void portstats_break_sent(int fd)
+{
+	t_portstats *ps = portstats_of(fd);
+
+	if (ps != NULL)
+		__atomic_fetch_add(&ps->breaks_sent, 1, __ATOMIC_RELAXED);
+}
+
+static inline void line_delta(t_portstats_cnt *cnt, uint64_t now, uint64_t base)
+{
+	// Un contatore del driver che riparte (porta riaperta) non va sotto zero
+	__atomic_store_n(cnt, now > base ? (t_portstats_cnt) (now - base) : 0, __ATOMIC_RELAXED);
+}
+
+void portstats_line(int fd, const t_transport_stats *st)
+{
+	t_portstats *ps = portstats_of(fd);
+
+	if (ps == NULL)
+		return;
+	line_delta(&ps->c.line_rx, st->line_rx, ps->base.line_rx);
+	line_delta(&ps->c.line_tx, st->line_tx, ps->base.line_tx);
+	line_delta(&ps->c.frame, st->frame, ps->base.frame);
+	line_delta(&ps->c.overrun, st->overrun, ps->base.overrun);
+	line_delta(&ps->c.parity, st->parity, ps->base.parity);
+	line_delta(&ps->c.brk, st->brk, ps->base.brk);
+	line_delta(&ps->c.buf_overrun, st->buf_overrun, ps->base.buf_overrun);
+}
+
+void portstats_read(const t_portstats *ps, t_portstats_counters *out)
+{
+	const t_portstats_cnt *src = (const t_portstats_cnt *) &ps->c;
+	t_portstats_cnt *dst = (t_portstats_cnt *) out;
+	unsigned int i;
+
+	// Ogni contatore e' coerente, l'insieme e' una fotografia approssimata
+	for (i = 0; i < sizeof(t_portstats_counters) / sizeof(t_portstats_cnt); i++)
+		dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+	out->breaks_sent = __atomic_load_n(&ps->breaks_sent, __ATOMIC_RELAXED);
+}
+
+t_portstats_cnt portstats_errors(const t_portstats_counters *c)
+{
+	t_portstats_cnt total = 0;
+	int i;
+
+	for (i = 0; i < PORTSTATS_ERR_LAST; i++)
+		total += c->errors[i];
+	return total;
+}
+
+const char *portstats_err_name(t_portstats_err cls)
+{
+	if (cls < 0 || cls >= PORTSTATS_ERR_LAST)
+		return "unknown";
+	return err_name[cls];
+}
+
+const char *portstats_field(const t_portstats_counters *c, int idx, t_portstats_cnt *value)
+{
+	BUILD_BUG_ON(ArraySize(field_name) != sizeof(t_portstats_counters) / sizeof(t_portstats_cnt));
+
+	if (idx < 0 || idx >= (int) ArraySize(field_name))
+		return NULL;
+	*value = ((const t_portstats_cnt *) c)[idx];
+	return field_name[idx];
+}
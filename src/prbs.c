@@ -0,0 +1,155 @@
+#include <string.h>
+#include "prbs.h"
+
+// Secondo tap del polinomio: x^n + x^m + 1
+static int prbs_tap(t_prbs_type type)
+{
+	switch (type)
+	{
+		case PRBS_7:
+			return 6;
+		case PRBS_15:
+			return 14;
+		case PRBS_31:
+			return 28;
+		default:
+			return 0;
+	}
+}
+
+static inline unsigned int prbs_next(t_prbs *g, int n, int m, uint32_t mask)
+{
+	unsigned int b = ((g->state >> (n - 1)) ^ (g->state >> (m - 1))) & 1;
+
+	g->state = ((g->state << 1) | b) & mask;
+	return b;
+}
+
+static inline uint32_t prbs_mask(t_prbs_type type)
+{
+	return (uint32_t) ((1ULL << type) - 1);
+}
+
+t_prbs_type prbs_type(int order)
+{
+	switch (order)
+	{
+		case 7:
+			return PRBS_7;
+		case 15:
+			return PRBS_15;
+		case 31:
+			return PRBS_31;
+		default:
+			return PRBS_NONE;
+	}
+}
+
+const char *prbs_name(t_prbs_type type)
+{
+	switch (type)
+	{
+		case PRBS_7:
+			return "PRBS-7";
+		case PRBS_15:
+			return "PRBS-15";
+		case PRBS_31:
+			return "PRBS-31";
+		default:
+			return "NONE";
+	}
+}
+
+void prbs_init(t_prbs *g, t_prbs_type type)
+{
+	g->type = type;
+	// Qualunque stato tranne zero
+	g->state = prbs_mask(type);
+}
+
+void prbs_fill(t_prbs *g, unsigned char *buf, size_t len)
+{
+	int n = g->type, m = prbs_tap(g->type);
+	uint32_t mask = prbs_mask(g->type);
+	unsigned int byte;
+	size_t i;
+	int bit;
+
+	if (m == 0)
+		return;
+	for (i = 0; i < len; i++)
+	{
+		byte = 0;
+		for (bit = 0; bit < 8; bit++)
+			byte |= prbs_next(g, n, m, mask) << bit;
+		buf[i] = byte;
+	}
+}
+
+void prbs_check_init(t_prbs_check *v, t_prbs_type type)
+{
+	memset(v, 0, sizeof(t_prbs_check));
+	prbs_init(&v->gen, type);
+}
+
+int prbs_check(t_prbs_check *v, const unsigned char *buf, size_t len)
+{
+	int n = v->gen.type, m = prbs_tap(v->gen.type);
+	uint32_t mask = prbs_mask(v->gen.type);
+	unsigned int r, p, e;
+	int wrong = 0;
+	int window;
+	size_t i;
+	int bit;
+
+	if (m == 0)
+		return 0;
+	for (i = 0; i < len; i++)
+	{
+		for (bit = 0; bit < 8; bit++)
+		{
+			r = (buf[i] >> bit) & 1;
+			p = prbs_next(&v->gen, n, m, mask);
+			if (!v->locked)
+			{
+				// Il registro segue i bit ricevuti finche' non li predice
+				v->gen.state = (v->gen.state & ~1U) | r;
+				if (v->fill < n)
+					v->fill++;
+				else if (p != r)
+					v->run = 0;
+				else if (++v->run >= PRBS_LOCK_BITS)
+				{
+					v->locked = 1;
+					v->recent = 0;
+					v->since = 0;
+				}
+				continue;
+			}
+
+			e = p ^ r;
+			wrong += e;
+			v->bits++;
+			v->errors += e;
+			v->since++;
+			v->recent = (v->recent << 1) | e;
+			if (e && __builtin_popcountll(v->recent) >= PRBS_LOSS_ERRORS)
+			{
+				// Fuori passo, non errori di linea: si tolgono dal conto
+				window = v->since < 64 ? v->since : 64;
+				v->bits -= window;
+				v->errors -= __builtin_popcountll(v->recent);
+				v->losses++;
+				v->locked = 0;
+				v->fill = 0;
+				v->run = 0;
+			}
+		}
+	}
+	return wrong;
+}
+
+double prbs_ber(const t_prbs_check *v)
+{
+	return v->bits > 0 ? (double) v->errors / v->bits : 0.0;
+}
@@ -0,0 +1,26 @@
+#include <string.h>
+#include "protocol.h"
+
+int protocol_signature_ok(const t_signature *sig, uint32_t header, uint32_t mask, uint32_t maxlen)
+{
+	return (sig->header & mask) == (header & mask) &&
+		sig->footer == SERIAL_SIGNATURE_FOOTER &&
+		sig->len <= maxlen;
+}
+
+uint32_t protocol_frame_crc(t_crc_type type, const t_signature *sig, const void *payload, uint32_t len)
+{
+	uint32_t crc;
+
+	crc = crc_compute(type, 0, sig, sizeof(t_signature));
+	return crc_compute(type, crc, payload, len);
+}
+
+int protocol_trailer_ok(t_crc_type type, const unsigned char *frame, uint32_t len)
+{
+	t_trailer trailer;
+
+	// Il trailer puo' non essere allineato
+	memcpy(&trailer, frame + len, sizeof(t_trailer));
+	return crc_compute(type, 0, frame, len) == trailer.crc;
+}
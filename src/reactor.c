@@ -0,0 +1,309 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include "reactor.h"
+#include "ec_types.h"
+#include "debug.h"
+
+DBG_MODULE(debuglevelDriver, "reactor", DBG_ERROR)
+
+#define REACTOR_MAX_EVENTS	64
+
+struct t_reactor {
+	int epfd;
+	int maxports;
+	int nports;
+	volatile int stop;
+	t_reactor_port **ports;
+	struct epoll_event events[REACTOR_MAX_EVENTS];
+};
+
+// Come serial_now_ms(): il benchmark non si porta dietro serial.o
+static int64_t reactor_now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint32_t reactor_epoll_events(int interest)
+{
+	uint32_t ev = 0;
+	if (interest & REACTOR_EV_READABLE)
+		ev |= EPOLLIN;
+	if (interest & REACTOR_EV_WRITABLE)
+		ev |= EPOLLOUT;
+	return ev;
+}
+
+t_reactor *reactor_create(int maxports)
+{
+	t_reactor *r;
+
+	if (maxports <= 0)
+	{
+		DRIVER_ERROR("BAD PARAMETER\n");
+		return NULL;
+	}
+
+	r = calloc(1, sizeof(t_reactor));
+	if (r == NULL)
+	{
+		DRIVER_ERROR("Out of memory\n");
+		return NULL;
+	}
+
+	r->ports = calloc(maxports, sizeof(t_reactor_port *));
+	if (r->ports == NULL)
+	{
+		DRIVER_ERROR("Out of memory\n");
+		free(r);
+		return NULL;
+	}
+
+	r->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (r->epfd < 0)
+	{
+		DRIVER_ERROR("epoll_create1() %d %s\n", errno, strerror(errno));
+		free(r->ports);
+		free(r);
+		return NULL;
+	}
+
+	r->maxports = maxports;
+	DRIVER_NOISY("Reactor created for %d ports\n", maxports);
+	return r;
+}
+
+void reactor_destroy(t_reactor *r)
+{
+	int i;
+
+	if (r == NULL)
+		return;
+
+	for (i = 0; i < r->maxports; i++)
+	{
+		if (r->ports[i] != NULL)
+			r->ports[i]->reactor = NULL;
+	}
+	close(r->epfd);
+	free(r->ports);
+	free(r);
+}
+
+int reactor_add(t_reactor *r, t_reactor_port *port)
+{
+	struct epoll_event ev;
+	int i;
+
+	if (r == NULL || port == NULL || port->fd < 0 || port->handler == NULL)
+	{
+		DRIVER_ERROR("BAD PARAMETER\n");
+		return -ECERR_BADPARAM;
+	}
+
+	for (i = 0; i < r->maxports; i++)
+	{
+		if (r->ports[i] == NULL)
+			break;
+	}
+	if (i == r->maxports)
+	{
+		DRIVER_ERROR("Reactor full: %d ports\n", r->maxports);
+		return -ENOSPC;
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = reactor_epoll_events(port->interest);
+	ev.data.ptr = port;
+	if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, port->fd, &ev) < 0)
+	{
+		DRIVER_ERROR("epoll_ctl(ADD) fd %d: %d %s\n", port->fd, errno, strerror(errno));
+		return -errno;
+	}
+
+	r->ports[i] = port;
+	r->nports++;
+	port->reactor = r;
+	port->slot = i;
+	DRIVER_NOISY("Port fd %d added in slot %d\n", port->fd, i);
+	return 0;
+}
+
+int reactor_del(t_reactor_port *port)
+{
+	t_reactor *r;
+
+	if (port == NULL || port->reactor == NULL)
+		return -ECERR_BADPARAM;
+
+	r = port->reactor;
+	if (epoll_ctl(r->epfd, EPOLL_CTL_DEL, port->fd, NULL) < 0)
+	{
+		DRIVER_VERBOSE("epoll_ctl(DEL) fd %d: %d %s\n", port->fd, errno, strerror(errno));
+	}
+	r->ports[port->slot] = NULL;
+	r->nports--;
+	port->reactor = NULL;
+	DRIVER_NOISY("Port fd %d removed\n", port->fd);
+	return 0;
+}
+
+int reactor_set_interest(t_reactor_port *port, int interest)
+{
+	struct epoll_event ev;
+
+	if (port == NULL)
+		return -ECERR_BADPARAM;
+
+	if (port->interest == interest)
+		return 0;
+
+	port->interest = interest;
+	if (port->reactor == NULL)
+		return 0;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = reactor_epoll_events(interest);
+	ev.data.ptr = port;
+	if (epoll_ctl(port->reactor->epfd, EPOLL_CTL_MOD, port->fd, &ev) < 0)
+	{
+		DRIVER_ERROR("epoll_ctl(MOD) fd %d: %d %s\n", port->fd, errno, strerror(errno));
+		return -errno;
+	}
+	return 0;
+}
+
+void reactor_set_timeout(t_reactor_port *port, long ms)
+{
+	if (port == NULL)
+		return;
+	port->deadline_ms = (ms > 0) ? reactor_now_ms() + ms : 0;
+}
+
+static void reactor_dispatch(t_reactor_port *port, int events)
+{
+	if (port->handler(port, events) < 0 && port->reactor != NULL)
+	{
+		DRIVER_VERBOSE("Handler for fd %d asked to leave\n", port->fd);
+		reactor_del(port);
+	}
+}
+
+/*
+ * The timeout list is scanned linearly: with a few tens of ports this
+ * is cheaper than keeping a heap up to date on every rearm.
+ */
+static int64_t reactor_next_deadline(t_reactor *r)
+{
+	int64_t next = 0;
+	int i;
+
+	for (i = 0; i < r->maxports; i++)
+	{
+		t_reactor_port *p = r->ports[i];
+		if (p == NULL || p->deadline_ms == 0)
+			continue;
+		if (next == 0 || p->deadline_ms < next)
+			next = p->deadline_ms;
+	}
+	return next;
+}
+
+static void reactor_expire(t_reactor *r, int64_t now)
+{
+	int i;
+
+	for (i = 0; i < r->maxports; i++)
+	{
+		t_reactor_port *p = r->ports[i];
+		if (p == NULL || p->deadline_ms == 0 || p->deadline_ms > now)
+			continue;
+		p->deadline_ms = 0;
+		reactor_dispatch(p, REACTOR_EV_TIMEOUT);
+	}
+}
+
+int reactor_run_once(t_reactor *r, long maxwait)
+{
+	int64_t next;
+	int64_t now;
+	int wait;
+	int n;
+	int i;
+
+	if (r == NULL)
+		return -ECERR_BADPARAM;
+
+	wait = (int) maxwait;
+	next = reactor_next_deadline(r);
+	if (next != 0)
+	{
+		now = reactor_now_ms();
+		if (next <= now)
+			wait = 0;
+		else
+		if (maxwait < 0 || next - now < maxwait)
+			wait = (int) (next - now);
+	}
+
+	n = epoll_wait(r->epfd, r->events, REACTOR_MAX_EVENTS, wait);
+	if (n < 0)
+	{
+		if (errno == EINTR)
+			return 0;
+		DRIVER_ERROR("epoll_wait() %d %s\n", errno, strerror(errno));
+		return -errno;
+	}
+
+	for (i = 0; i < n; i++)
+	{
+		t_reactor_port *port = r->events[i].data.ptr;
+		uint32_t ev = r->events[i].events;
+		int events = 0;
+
+		// Removed by an handler dispatched earlier in this batch
+		if (port->reactor != r)
+			continue;
+
+		if (ev & (EPOLLIN | EPOLLHUP))
+			events |= REACTOR_EV_READABLE;
+		if (ev & EPOLLOUT)
+			events |= REACTOR_EV_WRITABLE;
+		if (ev & EPOLLERR)
+			events |= REACTOR_EV_ERROR;
+		reactor_dispatch(port, events);
+	}
+
+	if (next != 0)
+		reactor_expire(r, reactor_now_ms());
+
+	return n;
+}
+
+int reactor_run(t_reactor *r)
+{
+	int rval = 0;
+
+	if (r == NULL)
+		return -ECERR_BADPARAM;
+
+	r->stop = 0;
+	while (!r->stop && r->nports > 0)
+	{
+		rval = reactor_run_once(r, -1);
+		if (rval < 0)
+			break;
+	}
+	return rval < 0 ? rval : 0;
+}
+
+void reactor_stop(t_reactor *r)
+{
+	if (r != NULL)
+		r->stop = 1;
+}
@@ -0,0 +1,328 @@
+/*
+ * -----------------------------------------
+ * Reactor benchmark
+ * -----------------------------------------
+ *
+ * Runs N ping-pong links inside one epoll reactor thread and reports
+ * the CPU usage and the round trip latency as the number of ports grows.
+ * Every link is a pseudo terminal pair: the slave side runs the ping
+ * state machine (signature + payload, wait for the echo) and the master
+ * side echoes everything back, so no hardware is needed.
+ * Standalone: raw read()/write() on the pty, not the serial.h layer nor
+ * the protocol engine of testunit. It measures the event loop alone.
+ *
+ * usage: ./reactorbench [MAX PORTS] [PAYLOAD LEN] [SECONDS PER STEP]
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pty.h>
+#include <time.h>
+#include <termios.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include "reactor.h"
+#include "protocol.h"
+#include "ec_types.h"
+#include "debug.h"
+
+DBG_MODULE(debuglevel, "reactorbench", DBG_INFO)
+
+#define BENCH_MAX_PORTS      256
+#define BENCH_MAX_PAYLOAD    1024
+#define BENCH_FRAME_SIZE     (sizeof(t_signature) + BENCH_MAX_PAYLOAD)
+#define BENCH_MAX_SAMPLES    (1 << 20)
+#define BENCH_TIMEOUT_MS     1000
+
+typedef enum {
+	PING_SEND = 0,
+	PING_WAIT_ECHO,
+} t_ping_state;
+
+typedef struct {
+	t_reactor_port port;
+	t_ping_state state;
+	unsigned char tx[BENCH_FRAME_SIZE];
+	unsigned char rx[BENCH_FRAME_SIZE];
+	int framelen;
+	int txdone;
+	int rxdone;
+	struct timespec sent;
+} t_ping;
+
+typedef struct {
+	t_reactor_port port;
+	unsigned char buf[BENCH_FRAME_SIZE];
+	int pending;
+	int offset;
+} t_echo;
+
+static uint32_t *samples;
+static int nsamples;
+static long frames;
+static long timeouts;
+static long errors;
+
+static uint32_t elapsed_usec(const struct timespec *from)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint32_t) ((now.tv_sec - from->tv_sec) * 1000000L +
+		(now.tv_nsec - from->tv_nsec) / 1000L);
+}
+
+static int ping_flush(t_ping *p)
+{
+	int rval;
+
+	while (p->txdone < p->framelen)
+	{
+		rval = write(p->port.fd, p->tx + p->txdone, p->framelen - p->txdone);
+		if (rval < 0)
+		{
+			if (errno == EAGAIN || errno == EINTR)
+				return reactor_set_interest(&p->port, REACTOR_EV_READABLE | REACTOR_EV_WRITABLE);
+			return -errno;
+		}
+		p->txdone += rval;
+	}
+	return reactor_set_interest(&p->port, REACTOR_EV_READABLE);
+}
+
+static int ping_send(t_ping *p)
+{
+	p->state = PING_WAIT_ECHO;
+	p->txdone = 0;
+	p->rxdone = 0;
+	clock_gettime(CLOCK_MONOTONIC, &p->sent);
+	reactor_set_timeout(&p->port, BENCH_TIMEOUT_MS);
+	return ping_flush(p);
+}
+
+static int ping_handler(t_reactor_port *port, int events)
+{
+	t_ping *p = port->priv;
+	int rval;
+
+	if (events & REACTOR_EV_ERROR)
+	{
+		errors++;
+		return -1;
+	}
+
+	if (events & REACTOR_EV_TIMEOUT)
+	{
+		DBG_V("fd %d: timeout, resending\n", port->fd);
+		timeouts++;
+		tcflush(port->fd, TCIOFLUSH);
+		return ping_send(p);
+	}
+
+	if (events & REACTOR_EV_WRITABLE)
+	{
+		rval = ping_flush(p);
+		if (rval < 0)
+			return rval;
+	}
+
+	if (events & REACTOR_EV_READABLE)
+	{
+		rval = read(port->fd, p->rx + p->rxdone, p->framelen - p->rxdone);
+		if (rval < 0)
+			return (errno == EAGAIN || errno == EINTR) ? 0 : -errno;
+		p->rxdone += rval;
+		if (p->state == PING_WAIT_ECHO && p->rxdone == p->framelen)
+		{
+			if (memcmp(p->rx, p->tx, p->framelen) != 0)
+				errors++;
+			if (nsamples < BENCH_MAX_SAMPLES)
+				samples[nsamples++] = elapsed_usec(&p->sent);
+			frames++;
+			return ping_send(p);
+		}
+	}
+	return 0;
+}
+
+static int echo_handler(t_reactor_port *port, int events)
+{
+	t_echo *e = port->priv;
+	int rval;
+
+	if (events & REACTOR_EV_ERROR)
+		return -1;
+
+	if (e->pending == 0 && (events & REACTOR_EV_READABLE))
+	{
+		rval = read(port->fd, e->buf, sizeof(e->buf));
+		if (rval < 0)
+			return (errno == EAGAIN || errno == EINTR) ? 0 : -errno;
+		e->pending = rval;
+		e->offset = 0;
+	}
+
+	while (e->pending > 0)
+	{
+		rval = write(port->fd, e->buf + e->offset, e->pending);
+		if (rval < 0)
+		{
+			if (errno == EAGAIN || errno == EINTR)
+				return reactor_set_interest(port, REACTOR_EV_WRITABLE);
+			return -errno;
+		}
+		e->offset += rval;
+		e->pending -= rval;
+	}
+	return reactor_set_interest(port, REACTOR_EV_READABLE);
+}
+
+static int open_link(int *master, int *slave)
+{
+	struct termios term;
+
+	if (openpty(master, slave, NULL, NULL, NULL) < 0)
+		return -errno;
+	tcgetattr(*slave, &term);
+	cfmakeraw(&term);
+	tcsetattr(*slave, TCSANOW, &term);
+	fcntl(*master, F_SETFL, fcntl(*master, F_GETFL) | O_NONBLOCK);
+	fcntl(*slave, F_SETFL, fcntl(*slave, F_GETFL) | O_NONBLOCK);
+	return 0;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *) a;
+	uint32_t y = *(const uint32_t *) b;
+	return (x > y) - (x < y);
+}
+
+static double cpu_seconds(void)
+{
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+		ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+static int bench_step(int nports, int payload, int seconds)
+{
+	static t_ping pings[BENCH_MAX_PORTS];
+	static t_echo echoes[BENCH_MAX_PORTS];
+	t_reactor *r;
+	t_signature sig;
+	struct timespec t0;
+	double cpu0, wall;
+	int i, j;
+
+	r = reactor_create(nports * 2);
+	if (r == NULL)
+		return -ECERR_OUTOFMEM;
+
+	sig.header = SERIAL_SIGNATURE_HEADER;
+	sig.len = payload;
+	sig.footer = SERIAL_SIGNATURE_FOOTER;
+
+	for (i = 0; i < nports; i++)
+	{
+		t_ping *p = &pings[i];
+		t_echo *e = &echoes[i];
+		int master, slave;
+
+		memset(p, 0, sizeof(*p));
+		memset(e, 0, sizeof(*e));
+		if (open_link(&master, &slave) < 0)
+		{
+			DBG_E("openpty() failed for port %d: %s\n", i, strerror(errno));
+			nports = i;
+			break;
+		}
+		memcpy(p->tx, &sig, sizeof(sig));
+		for (j = 0; j < payload; j++)
+			p->tx[sizeof(sig) + j] = (unsigned char) (i + j);
+		p->framelen = sizeof(sig) + payload;
+
+		p->port.fd = slave;
+		p->port.interest = REACTOR_EV_READABLE;
+		p->port.handler = ping_handler;
+		p->port.priv = p;
+		e->port.fd = master;
+		e->port.interest = REACTOR_EV_READABLE;
+		e->port.handler = echo_handler;
+		e->port.priv = e;
+		reactor_add(r, &e->port);
+		reactor_add(r, &p->port);
+	}
+
+	nsamples = 0;
+	frames = timeouts = errors = 0;
+
+	cpu0 = cpu_seconds();
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < nports; i++)
+		ping_send(&pings[i]);
+
+	while (elapsed_usec(&t0) < seconds * 1000000UL)
+		reactor_run_once(r, 100);
+
+	wall = elapsed_usec(&t0) / 1e6;
+	qsort(samples, nsamples, sizeof(uint32_t), cmp_u32);
+	printR("%6d %10ld %12.0f %7.1f %9u %9u %9u %8ld %7ld\n",
+		nports, frames, frames / wall,
+		100.0 * (cpu_seconds() - cpu0) / wall,
+		nsamples ? samples[nsamples / 2] : 0,
+		nsamples ? samples[(int) (nsamples * 0.99)] : 0,
+		nsamples ? samples[nsamples - 1] : 0,
+		timeouts, errors);
+
+	for (i = 0; i < nports; i++)
+	{
+		close(pings[i].port.fd);
+		close(echoes[i].port.fd);
+	}
+	reactor_destroy(r);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int maxports = 64;
+	int payload = 64;
+	int seconds = 2;
+	int n;
+
+	if (argc > 1) maxports = strtoul(argv[1], NULL, 10);
+	if (argc > 2) payload = strtoul(argv[2], NULL, 10);
+	if (argc > 3) seconds = strtoul(argv[3], NULL, 10);
+
+	if (maxports < 1 || maxports > BENCH_MAX_PORTS ||
+		payload < 0 || payload > BENCH_MAX_PAYLOAD || seconds < 1)
+	{
+		DBG_E("usage: %s [MAX PORTS 1-%d] [PAYLOAD LEN 0-%d] [SECONDS]\n",
+			argv[0], BENCH_MAX_PORTS, BENCH_MAX_PAYLOAD);
+		return -1;
+	}
+
+	samples = malloc(BENCH_MAX_SAMPLES * sizeof(uint32_t));
+	if (samples == NULL)
+	{
+		DBG_E("Out of memory\n");
+		return -1;
+	}
+
+	DBG_I("Reactor benchmark: up to %d ports, payload %d bytes, %d s per step\n",
+		maxports, payload, seconds);
+	printR("%6s %10s %12s %7s %9s %9s %9s %8s %7s\n",
+		"PORTS", "FRAMES", "FRAMES/S", "CPU%", "P50(us)", "P99(us)", "MAX(us)",
+		"TIMEOUT", "ERRORS");
+	for (n = 1; n <= maxports; n *= 2)
+		bench_step(n, payload, seconds);
+	if ((maxports & (maxports - 1)) != 0)
+		bench_step(maxports, payload, seconds);
+
+	free(samples);
+	return 0;
+}
@@ -0,0 +1,257 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "replay.h"
+#include "capture.h"
+#include "protocol.h"
+#include "crc32.h"
+#include "resync.h"
+#include "ringbuf.h"
+#include "ec_types.h"
+#include "debug.h"
+
+DBG_MODULE(debuglevelDriver, "replay", DBG_ERROR)
+
+#define REPLAY_RING_SIZE	(KiB(64))
+#define REPLAY_MAX_PAYLOAD	(KiB(16))
+
+typedef struct {
+	t_ringbuf rx;
+	t_replay_stats st;
+	unsigned char scratch[sizeof(t_window_signature) + REPLAY_MAX_PAYLOAD + sizeof(t_trailer)];
+} t_replay_port;
+
+static int64_t replay_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static void replay_sleep_until(int64_t ns)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ns / 1000000000L;
+	ts.tv_nsec = ns % 1000000000L;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+// Lunghezza del frame in testa al ring, 0 se servono altri caratteri, < 0 se non e' un frame
+static long replay_frame(t_replay_port *p, uint32_t word, uint32_t used, uint32_t tlen)
+{
+	t_signature sig;
+	t_window_signature wsig;
+
+	switch (word)
+	{
+		case SERIAL_SIGNATURE_HEADER:
+		case SERIAL_SIGNATURE_ACK:
+		case SERIAL_SIGNATURE_NAK:
+			if (used < sizeof(t_signature))
+				return 0;
+			ringbuf_copy(&p->rx, (unsigned char *) &sig, sizeof(t_signature));
+			if (!protocol_signature_ok(&sig, word, 0xffffffff, REPLAY_MAX_PAYLOAD))
+				return -1;
+			if (word == SERIAL_SIGNATURE_ACK)
+				p->st.acks++;
+			if (word == SERIAL_SIGNATURE_NAK)
+				p->st.naks++;
+			if (word != SERIAL_SIGNATURE_HEADER)
+				return sizeof(t_signature);
+			return sizeof(t_signature) + sig.len + tlen;
+
+		case SERIAL_WINDOW_DATA_HEADER:
+		case SERIAL_WINDOW_ACK_HEADER:
+			if (used < sizeof(t_window_signature))
+				return 0;
+			ringbuf_copy(&p->rx, (unsigned char *) &wsig, sizeof(t_window_signature));
+			if (wsig.footer != SERIAL_SIGNATURE_FOOTER || wsig.len > REPLAY_MAX_PAYLOAD)
+				return -1;
+			if (word == SERIAL_WINDOW_ACK_HEADER)
+			{
+				p->st.window_acks++;
+				return sizeof(t_window_signature);
+			}
+			return sizeof(t_window_signature) + wsig.len + tlen;
+	}
+	return -1;
+}
+
+static void replay_parse(t_replay_port *p, t_crc_type crc)
+{
+	uint32_t tlen = crc != CRC_NONE ? sizeof(t_trailer) : 0;
+	const unsigned char *frame;
+	uint32_t used, word;
+	long need;
+
+	for (;;)
+	{
+		used = ringbuf_used(&p->rx);
+		if (used < sizeof(uint32_t))
+			return;
+		ringbuf_copy(&p->rx, (unsigned char *) &word, sizeof(uint32_t));
+		if ((word & SERIAL_SIGNATURE_REPLY_MASK) != (SERIAL_SIGNATURE_HEADER & SERIAL_SIGNATURE_REPLY_MASK))
+		{
+			// Comandi, break e rumore: fino al prossimo header
+			p->st.junk += resync_ring(&p->rx, SERIAL_SIGNATURE_HEADER, SERIAL_SIGNATURE_REPLY_MASK);
+			continue;
+		}
+
+		need = replay_frame(p, word, used, tlen);
+		if (need < 0)
+		{
+			p->st.bad_signatures++;
+			p->st.junk++;
+			ringbuf_consume(&p->rx, 1);
+			continue;
+		}
+		if (need == 0 || (uint32_t) need > used)
+			return;
+		if (word == SERIAL_SIGNATURE_HEADER || word == SERIAL_WINDOW_DATA_HEADER)
+		{
+			if (tlen > 0)
+			{
+				frame = ringbuf_peek(&p->rx, need, p->scratch);
+				if (!protocol_trailer_ok(crc, frame, need - tlen))
+					p->st.crc_errors++;
+			}
+			if (word == SERIAL_SIGNATURE_HEADER)
+				p->st.frames++;
+			else
+				p->st.window_frames++;
+		}
+		ringbuf_consume(&p->rx, need);
+	}
+}
+
+static void replay_feed(t_replay_port *p, t_crc_type crc, const unsigned char *data, uint32_t len)
+{
+	uint32_t n;
+
+	p->st.chunks++;
+	p->st.bytes += len;
+	while (len > 0)
+	{
+		n = ringbuf_space(&p->rx);
+		if (n == 0)
+		{
+			// Il parser aspetta un frame piu' lungo del ring: non e' un frame
+			p->st.junk += ringbuf_used(&p->rx);
+			ringbuf_reset(&p->rx);
+			continue;
+		}
+		if (n > len)
+			n = len;
+		ringbuf_write(&p->rx, data, n);
+		data += n;
+		len -= n;
+		replay_parse(p, crc);
+	}
+}
+
+static void replay_print(const t_capture_header *hdr, const t_replay_port *ports, double secs)
+{
+	const t_replay_stats *st;
+	unsigned int i;
+
+	printR("%-16s %10s %12s %9s %7s %7s %9s %9s %7s %7s %9s %7s %12s\n", "PORT", "CHUNKS", "BYTES",
+		"FRAMES", "ACK", "NAK", "W.FRAMES", "W.ACK", "CRCERR", "BADSIG", "JUNK", "BREAKS", "PARSE(MB/s)");
+	for (i = 0; i < hdr->nports; i++)
+	{
+		st = &ports[i].st;
+		printR("%-16s %10llu %12llu %9llu %7llu %7llu %9llu %9llu %7llu %7llu %9llu %7llu %12.1f\n",
+			hdr->port_name[i], (unsigned long long) st->chunks, (unsigned long long) st->bytes,
+			(unsigned long long) st->frames, (unsigned long long) st->acks,
+			(unsigned long long) st->naks, (unsigned long long) st->window_frames,
+			(unsigned long long) st->window_acks, (unsigned long long) st->crc_errors,
+			(unsigned long long) st->bad_signatures, (unsigned long long) st->junk,
+			(unsigned long long) st->breaks, secs > 0 ? st->bytes / secs / 1e6 : 0.0);
+	}
+}
+
+int replay_run(const char *path, int realtime, int passes)
+{
+	t_capture_reader r;
+	const t_capture_record *rec;
+	const unsigned char *data;
+	t_replay_port *ports;
+	t_replay_port *p;
+	int64_t first = -1, start, elapsed = 0;
+	uint64_t records = 0, frames = 0;
+	unsigned int i;
+	int pass, rval;
+
+	rval = capture_reader_open(&r, path);
+	if (rval < 0)
+		return rval;
+	if (r.hdr->nports == 0 || r.hdr->nports > CAPTURE_MAX_PORTS)
+	{
+		DRIVER_ERROR("%s: no ports\n", path);
+		capture_reader_close(&r);
+		return -ECERR_BADPARAM;
+	}
+	ports = calloc(r.hdr->nports, sizeof(t_replay_port));
+	if (ports == NULL)
+	{
+		capture_reader_close(&r);
+		return -ECERR_OUTOFMEM;
+	}
+	for (i = 0; i < r.hdr->nports; i++)
+	{
+		if (ringbuf_init(&ports[i].rx, REPLAY_RING_SIZE) < 0)
+		{
+			rval = -ECERR_OUTOFMEM;
+			goto out;
+		}
+		printR("Port %u: %s @ %d baud\n", i,
+			r.hdr->port_name[i], r.hdr->baudrate[i]);
+	}
+	printR("%s: %llu records, %llu overwritten, %s, %s\n", path,
+		(unsigned long long) r.hdr->records, (unsigned long long) r.hdr->overwritten,
+		crc_name(r.hdr->crc), realtime ? "original timing" : "full speed");
+
+	for (pass = 0; pass < passes; pass++)
+	{
+		capture_reader_rewind(&r);
+		for (i = 0; i < r.hdr->nports; i++)
+			ringbuf_reset(&ports[i].rx);
+		first = -1;
+		start = replay_now_ns();
+		while ((rec = capture_reader_next(&r, &data)) != NULL)
+		{
+			if (rec->port >= r.hdr->nports)
+				continue;
+			p = &ports[rec->port];
+			records++;
+			if (first < 0)
+				first = rec->ts_ns;
+			if (realtime)
+				replay_sleep_until(start + rec->ts_ns - first);
+			if (rec->dir == CAPTURE_BREAK)
+				p->st.breaks++;
+			else
+			if (rec->dir == CAPTURE_RX)
+				replay_feed(p, r.hdr->crc, data, rec->len);
+		}
+		elapsed += replay_now_ns() - start;
+	}
+
+	replay_print(r.hdr, ports, elapsed / 1e9);
+	for (i = 0; i < r.hdr->nports; i++)
+		frames += ports[i].st.frames + ports[i].st.window_frames;
+	printR("%d pass%s, %llu records in %.3f secs: %.0f records/s, %.0f frames/s\n", passes,
+		passes == 1 ? "" : "es", (unsigned long long) records, elapsed / 1e9,
+		elapsed > 0 ? records * 1e9 / elapsed : 0.0, elapsed > 0 ? frames * 1e9 / elapsed : 0.0);
+	rval = 0;
+out:
+	for (i = 0; i < r.hdr->nports; i++)
+		ringbuf_free(&ports[i].rx);
+	free(ports);
+	capture_reader_close(&r);
+	return rval;
+}
@@ -0,0 +1,555 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include <errno.h>
+#include <unistd.h>
+#include "results.h"
+#include "ec_types.h"
+#include "debug.h"
+
+DBG_MODULE(debuglevelDriver, "results", DBG_ERROR)
+
+#define RESULTS_LINE_MAX	4096
+
+// t di Student a due code al 95%, gradi di liberta' 1..30
+static const double t95_table[] = {
+	12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+	2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+	2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+};
+
+static double t95(double df)
+{
+	int i = (int) df;
+
+	if (i < 1)
+		i = 1;
+	if (i <= (int) ArraySize(t95_table))
+		return t95_table[i - 1];
+	return df < 60 ? 2.000 : 1.960;
+}
+
+void results_init(t_results *r)
+{
+	memset(r, 0, sizeof(t_results));
+}
+
+void results_config(t_results *r, const char *key, const char *fmt, ...)
+{
+	t_results_config *c = NULL;
+	va_list ap;
+	int i;
+
+	for (i = 0; i < r->nconfig; i++)
+	{
+		if (strcmp(r->config[i].key, key) == 0)
+			c = &r->config[i];
+	}
+	if (c == NULL)
+	{
+		if (r->nconfig >= RESULTS_MAX_CONFIG)
+		{
+			DRIVER_ERROR("No room for the configuration key %s\n", key);
+			return;
+		}
+		c = &r->config[r->nconfig++];
+		snprintf(c->key, sizeof(c->key), "%s", key);
+	}
+	va_start(ap, fmt);
+	vsnprintf(c->value, sizeof(c->value), fmt, ap);
+	va_end(ap);
+}
+
+void results_counter(t_results *r, const char *port, const char *name, unsigned long long value)
+{
+	t_results_counter *c;
+
+	if (r->ncounters >= RESULTS_MAX_COUNTERS)
+	{
+		DRIVER_ERROR("No room for the counter %s/%s\n", port, name);
+		return;
+	}
+	c = &r->counters[r->ncounters++];
+	snprintf(c->port, sizeof(c->port), "%s", port);
+	snprintf(c->name, sizeof(c->name), "%s", name);
+	c->value = value;
+}
+
+static t_results_metric *metric_find(const t_results *r, const char *name)
+{
+	int i;
+
+	for (i = 0; i < r->nmetrics; i++)
+	{
+		if (strcmp(r->metrics[i].name, name) == 0)
+			return (t_results_metric *) &r->metrics[i];
+	}
+	return NULL;
+}
+
+t_results_metric *results_metric(t_results *r, const char *unit, int better, const char *fmt, ...)
+{
+	char name[sizeof(((t_results_metric *) 0)->name)];
+	t_results_metric *m;
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsnprintf(name, sizeof(name), fmt, ap);
+	va_end(ap);
+
+	m = metric_find(r, name);
+	if (m != NULL)
+		return m;
+	if (r->nmetrics >= RESULTS_MAX_METRICS)
+	{
+		DRIVER_ERROR("No room for the metric %s\n", name);
+		return NULL;
+	}
+	m = &r->metrics[r->nmetrics++];
+	memset(m, 0, sizeof(t_results_metric));
+	snprintf(m->name, sizeof(m->name), "%s", name);
+	snprintf(m->unit, sizeof(m->unit), "%s", unit);
+	m->better = better;
+	return m;
+}
+
+void results_sample(t_results_metric *m, double value)
+{
+	if (m == NULL || m->n >= RESULTS_MAX_SAMPLES)
+		return;
+	m->samples[m->n++] = value;
+}
+
+void results_stats(const t_results_metric *m, double *mean, double *sd, double *ci95)
+{
+	double sum = 0, var = 0;
+	int i;
+
+	*mean = *sd = *ci95 = 0;
+	if (m->n == 0)
+		return;
+	for (i = 0; i < m->n; i++)
+		sum += m->samples[i];
+	*mean = sum / m->n;
+	if (m->n < 2)
+		return;
+	for (i = 0; i < m->n; i++)
+		var += (m->samples[i] - *mean) * (m->samples[i] - *mean);
+	*sd = sqrt(var / (m->n - 1));
+	*ci95 = t95(m->n - 1) * *sd / sqrt(m->n);
+}
+
+static const char *better_name(int better)
+{
+	return better == RESULTS_LOWER ? "lower" : "higher";
+}
+
+/*
+ * Scrittura
+ */
+static void json_string(FILE *f, const char *s)
+{
+	fputc('"', f);
+	for (; *s != '\0'; s++)
+	{
+		if (*s == '"' || *s == '\\')
+			fprintf(f, "\\%c", *s);
+		else
+		if ((unsigned char) *s < 0x20)
+			fprintf(f, "\\u%04x", (unsigned char) *s);
+		else
+			fputc(*s, f);
+	}
+	fputc('"', f);
+}
+
+static void write_json(const t_results *r, FILE *f)
+{
+	double mean, sd, ci;
+	int i, j;
+
+	fprintf(f, "{\n  \"format\": \"testunit-results\",\n  \"version\": 1,\n  \"config\": {\n");
+	for (i = 0; i < r->nconfig; i++)
+	{
+		fprintf(f, "    ");
+		json_string(f, r->config[i].key);
+		fprintf(f, ": ");
+		json_string(f, r->config[i].value);
+		fprintf(f, "%s\n", i + 1 < r->nconfig ? "," : "");
+	}
+	fprintf(f, "  },\n  \"ports\": {\n");
+	// I contatori della stessa porta sono consecutivi
+	for (i = 0; i < r->ncounters; i++)
+	{
+		if (i == 0 || strcmp(r->counters[i].port, r->counters[i - 1].port) != 0)
+		{
+			fprintf(f, "    ");
+			json_string(f, r->counters[i].port);
+			fprintf(f, ": {\n");
+		}
+		fprintf(f, "      \"%s\": %llu", r->counters[i].name, r->counters[i].value);
+		if (i + 1 < r->ncounters && strcmp(r->counters[i].port, r->counters[i + 1].port) == 0)
+			fprintf(f, ",\n");
+		else
+			fprintf(f, "\n    }%s\n", i + 1 < r->ncounters ? "," : "");
+	}
+	fprintf(f, "  },\n  \"metrics\": [\n");
+	for (i = 0; i < r->nmetrics; i++)
+	{
+		const t_results_metric *m = &r->metrics[i];
+
+		results_stats(m, &mean, &sd, &ci);
+		fprintf(f, "    {\"name\": \"%s\", \"unit\": \"%s\", \"better\": \"%s\", \"n\": %d, "
+			"\"mean\": %.10g, \"sd\": %.10g, \"ci95\": %.10g, \"samples\": [",
+			m->name, m->unit, better_name(m->better), m->n, mean, sd, ci);
+		for (j = 0; j < m->n; j++)
+			fprintf(f, "%s%.10g", j ? ", " : "", m->samples[j]);
+		fprintf(f, "]}%s\n", i + 1 < r->nmetrics ? "," : "");
+	}
+	fprintf(f, "  ]\n}\n");
+}
+
+static void csv_field(FILE *f, const char *s)
+{
+	if (strpbrk(s, ",\"\n") == NULL)
+	{
+		fputs(s, f);
+		return;
+	}
+	fputc('"', f);
+	for (; *s != '\0'; s++)
+	{
+		if (*s == '"')
+			fputc('"', f);
+		fputc(*s, f);
+	}
+	fputc('"', f);
+}
+
+static void write_csv(const t_results *r, FILE *f)
+{
+	double mean, sd, ci;
+	int i, j;
+
+	fprintf(f, "kind,name,unit,better,n,mean,sd,ci95,value\n");
+	for (i = 0; i < r->nconfig; i++)
+	{
+		fprintf(f, "config,%s,,,,,,,", r->config[i].key);
+		csv_field(f, r->config[i].value);
+		fputc('\n', f);
+	}
+	for (i = 0; i < r->ncounters; i++)
+		fprintf(f, "counter,%s/%s,,,,,,,%llu\n",
+			r->counters[i].port, r->counters[i].name, r->counters[i].value);
+	for (i = 0; i < r->nmetrics; i++)
+	{
+		const t_results_metric *m = &r->metrics[i];
+
+		results_stats(m, &mean, &sd, &ci);
+		fprintf(f, "metric,%s,%s,%s,%d,%.10g,%.10g,%.10g,", m->name, m->unit,
+			better_name(m->better), m->n, mean, sd, ci);
+		for (j = 0; j < m->n; j++)
+			fprintf(f, "%s%.10g", j ? " " : "", m->samples[j]);
+		fputc('\n', f);
+	}
+}
+
+static int is_csv(const char *path)
+{
+	size_t len = strlen(path);
+
+	return len >= 4 && strcmp(path + len - 4, ".csv") == 0;
+}
+
+int results_write(const t_results *r, const char *path)
+{
+	char tmp[1024];
+	FILE *f;
+	int rval;
+
+	// Chi raccoglie i file non deve mai vederne uno scritto a meta'
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	f = fopen(tmp, "w");
+	if (f == NULL)
+	{
+		DRIVER_ERROR("Cannot create %s: %s\n", tmp, strerror(errno));
+		return -1;
+	}
+	if (is_csv(path))
+		write_csv(r, f);
+	else
+		write_json(r, f);
+	rval = ferror(f);
+	if (fclose(f) != 0 || rval != 0 || rename(tmp, path) != 0)
+	{
+		DRIVER_ERROR("Cannot write %s: %s\n", path, strerror(errno));
+		unlink(tmp);
+		return -1;
+	}
+	DRIVER_NOISY("Results written to %s\n", path);
+	return 0;
+}
+
+/*
+ * Lettura: solo i file scritti qui sopra, una riga per voce
+ */
+static void load_samples(t_results_metric *m, const char *p, char sep, char end)
+{
+	char *next;
+	double v;
+
+	while (*p != '\0' && *p != end)
+	{
+		v = strtod(p, &next);
+		if (next == p)
+			break;
+		results_sample(m, v);
+		p = next;
+		while (*p == sep || *p == ' ')
+			p++;
+	}
+}
+
+// Il valore stringa della chiave "key" nella riga JSON
+static int json_get(const char *line, const char *key, char *out, int len)
+{
+	char pattern[40];
+	const char *p;
+	int n = 0;
+
+	snprintf(pattern, sizeof(pattern), "\"%s\": \"", key);
+	p = strstr(line, pattern);
+	if (p == NULL)
+		return -1;
+	for (p += strlen(pattern); *p != '\0' && *p != '"'; p++)
+	{
+		if (*p == '\\' && p[1] != '\0')
+			p++;
+		if (n < len - 1)
+			out[n++] = *p;
+	}
+	out[n] = '\0';
+	return 0;
+}
+
+static void load_json_line(t_results *r, const char *line, int *in_config)
+{
+	char name[64], unit[16], better[8], value[128];
+	t_results_metric *m;
+	const char *p;
+
+	if (strstr(line, "\"config\": {") != NULL)
+	{
+		*in_config = 1;
+		return;
+	}
+	if (*in_config)
+	{
+		p = line + strspn(line, " ");
+		if (*p == '}')
+			*in_config = 0;
+		else
+		if (*p == '"' && sscanf(p, "\"%31[^\"]\"", name) == 1 &&
+			json_get(p, name, value, sizeof(value)) == 0)
+			results_config(r, name, "%s", value);
+		return;
+	}
+	p = strstr(line, "\"samples\": [");
+	if (p == NULL || json_get(line, "name", name, sizeof(name)) < 0 ||
+		json_get(line, "unit", unit, sizeof(unit)) < 0 ||
+		json_get(line, "better", better, sizeof(better)) < 0)
+		return;
+	m = results_metric(r, unit, strcmp(better, "lower") == 0 ? RESULTS_LOWER : RESULTS_HIGHER, "%s", name);
+	if (m != NULL)
+		load_samples(m, p + strlen("\"samples\": ["), ',', ']');
+}
+
+// Divide la riga CSV nei campi, con le virgolette
+static int csv_split(char *line, char **field, int max)
+{
+	char *src = line, *dst = line;
+	int n = 0, quoted;
+
+	while (n < max)
+	{
+		field[n++] = dst;
+		quoted = *src == '"';
+		if (quoted)
+			src++;
+		while (*src != '\0' && *src != '\n')
+		{
+			if (quoted && *src == '"')
+			{
+				if (src[1] != '"')
+				{
+					src++;
+					quoted = 0;
+					continue;
+				}
+				src++;
+			}
+			else
+			if (!quoted && *src == ',')
+				break;
+			*dst++ = *src++;
+		}
+		if (*src != ',')
+		{
+			*dst = '\0';
+			break;
+		}
+		src++;
+		*dst++ = '\0';
+	}
+	return n;
+}
+
+static void load_csv_line(t_results *r, char *line)
+{
+	char *field[9];
+	t_results_metric *m;
+
+	if (csv_split(line, field, ArraySize(field)) != ArraySize(field))
+		return;
+	if (strcmp(field[0], "config") == 0)
+		results_config(r, field[1], "%s", field[8]);
+	else
+	if (strcmp(field[0], "metric") == 0)
+	{
+		m = results_metric(r, field[2], strcmp(field[3], "lower") == 0 ? RESULTS_LOWER : RESULTS_HIGHER,
+			"%s", field[1]);
+		if (m != NULL)
+			load_samples(m, field[8], ' ', '\0');
+	}
+}
+
+int results_load(t_results *r, const char *path)
+{
+	static char line[RESULTS_LINE_MAX];
+	int csv = -1, in_config = 0;
+	FILE *f;
+
+	results_init(r);
+	f = fopen(path, "r");
+	if (f == NULL)
+	{
+		DRIVER_ERROR("Cannot open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	while (fgets(line, sizeof(line), f) != NULL)
+	{
+		if (csv < 0)
+		{
+			csv = strncmp(line, "kind,", 5) == 0;
+			if (!csv && strstr(line, "{") == NULL)
+				break;
+		}
+		if (csv)
+			load_csv_line(r, line);
+		else
+			load_json_line(r, line, &in_config);
+	}
+	fclose(f);
+	if (r->nmetrics == 0)
+	{
+		DRIVER_ERROR("%s: no metrics, not a results file\n", path);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Confronto
+ */
+static const char *config_value(const t_results *r, const char *key)
+{
+	int i;
+
+	for (i = 0; i < r->nconfig; i++)
+	{
+		if (strcmp(r->config[i].key, key) == 0)
+			return r->config[i].value;
+	}
+	return NULL;
+}
+
+// Welch: la differenza delle medie e' oltre il rumore delle due serie?
+static int significant(const t_results_metric *a, const t_results_metric *b)
+{
+	double ma, sa, ca, mb, sb, cb, va, vb, se, df;
+
+	results_stats(a, &ma, &sa, &ca);
+	results_stats(b, &mb, &sb, &cb);
+	va = sa * sa / a->n;
+	vb = sb * sb / b->n;
+	se = sqrt(va + vb);
+	if (se == 0)
+		return ma != mb;
+	df = (va + vb) * (va + vb) /
+		(va * va / (a->n - 1) + vb * vb / (b->n - 1));
+	return fabs(ma - mb) / se > t95(df);
+}
+
+static void format_cell(char *out, int len, const t_results_metric *m)
+{
+	double mean, sd, ci;
+
+	results_stats(m, &mean, &sd, &ci);
+	if (m->n > 1)
+		snprintf(out, len, "%.1f +-%.1f n=%d", mean, ci, m->n);
+	else
+		snprintf(out, len, "%.1f", mean);
+}
+
+int results_compare(const t_results *base, const t_results *cand, double threshold)
+{
+	const t_results_metric *b, *c;
+	char bcell[48], ccell[48];
+	const char *verdict, *v;
+	double mb, mc, sd, ci, delta;
+	int i, worse, regressions = 0;
+
+	for (i = 0; i < base->nconfig; i++)
+	{
+		v = config_value(cand, base->config[i].key);
+		if (v != NULL && strcmp(v, base->config[i].value) != 0)
+			printR("config %s: %s -> %s\n", base->config[i].key, base->config[i].value, v);
+	}
+
+	printR("%-32s %30s %30s %8s  %s\n", "METRIC", "BASELINE", "CANDIDATE", "DELTA", "VERDICT");
+	for (i = 0; i < base->nmetrics; i++)
+	{
+		b = &base->metrics[i];
+		c = metric_find(cand, b->name);
+		format_cell(bcell, sizeof(bcell), b);
+		if (c == NULL || c->n == 0)
+		{
+			printR("%-32s %30s %30s %8s  %s\n", b->name, bcell, "-", "-", "missing");
+			continue;
+		}
+		format_cell(ccell, sizeof(ccell), c);
+		results_stats(b, &mb, &sd, &ci);
+		results_stats(c, &mc, &sd, &ci);
+		if (mb != 0)
+			delta = 100.0 * (mc - mb) / fabs(mb);
+		else
+			delta = mc == 0 ? 0 : (mc > 0 ? 100.0 : -100.0);
+		worse = b->better == RESULTS_LOWER ? mc > mb : mc < mb;
+
+		verdict = "same";
+		if (fabs(delta) >= threshold &&
+			(b->n < 2 || c->n < 2 || significant(b, c)))
+		{
+			verdict = worse ? "REGRESSION" : "improved";
+			if (worse)
+				regressions++;
+		}
+		printR("%-32s %30s %30s %+7.1f%%  %s%s\n", b->name, bcell, ccell, delta, verdict,
+			(b->n < 2 || c->n < 2) && strcmp(verdict, "same") != 0 ? " (single run, no CI)" : "");
+	}
+	printR("%d regression%s over %d metrics (threshold %.1f%%)\n", regressions,
+		regressions == 1 ? "" : "s", base->nmetrics, threshold);
+	return regressions;
+}
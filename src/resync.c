@@ -0,0 +1,188 @@
+#include <string.h>
+#include <pthread.h>
+#include "resync.h"
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#include <immintrin.h>
+#define RESYNC_X86
+#endif
+
+#define WORD_LEN	4
+
+typedef long (*t_find)(const unsigned char *p, size_t len, const unsigned char *b, const unsigned char *m);
+
+static long resync_find_sw(const unsigned char *p, size_t len, const unsigned char *b, const unsigned char *m);
+static t_find resync_impl = resync_find_sw;
+static const char *resync_name = "bytewise";
+static pthread_once_t resync_once = PTHREAD_ONCE_INIT;
+
+static int resync_match(const unsigned char *p, const unsigned char *b, const unsigned char *m)
+{
+	int j;
+
+	for (j = 0; j < WORD_LEN; j++)
+	{
+		if (m[j] && p[j] != b[j])
+			return 0;
+	}
+	return 1;
+}
+
+static long resync_find_sw(const unsigned char *p, size_t len, const unsigned char *b, const unsigned char *m)
+{
+	const unsigned char *q;
+	size_t i = 0;
+	int k;
+
+	if (len < WORD_LEN)
+		return -1;
+
+	// memchr() sul primo byte che conta, poi il confronto completo
+	for (k = 0; k < WORD_LEN && !m[k]; k++)
+		;
+	if (k == WORD_LEN)
+		return 0;
+
+	while (i + WORD_LEN <= len)
+	{
+		q = memchr(p + i + k, b[k], len - (WORD_LEN - 1) - i);
+		if (q == NULL)
+			return -1;
+		i = q - p - k;
+		if (resync_match(p + i, b, m))
+			return i;
+		i++;
+	}
+	return -1;
+}
+
+#ifdef RESYNC_X86
+/*
+ * Per ogni byte della parola confrontiamo un blocco di posizioni alla
+ * volta, spostato di j: le posizioni con tutti i byte uguali sono i bit
+ * rimasti a 1 nella maschera.
+ */
+static long resync_find_sse2(const unsigned char *p, size_t len, const unsigned char *b, const unsigned char *m)
+{
+	__m128i eq;
+	unsigned int bits;
+	size_t i;
+	long rval;
+	int j;
+
+	for (i = 0; i + 16 + WORD_LEN - 1 <= len; i += 16)
+	{
+		eq = _mm_set1_epi8(-1);
+		for (j = 0; j < WORD_LEN; j++)
+		{
+			if (m[j])
+				eq = _mm_and_si128(eq, _mm_cmpeq_epi8(
+					_mm_loadu_si128((const __m128i *) (p + i + j)), _mm_set1_epi8(b[j])));
+		}
+		bits = _mm_movemask_epi8(eq);
+		if (bits)
+			return i + __builtin_ctz(bits);
+	}
+	rval = resync_find_sw(p + i, len - i, b, m);
+	return rval < 0 ? -1 : (long) i + rval;
+}
+
+__attribute__ ((target("avx2")))
+static long resync_find_avx2(const unsigned char *p, size_t len, const unsigned char *b, const unsigned char *m)
+{
+	__m256i eq;
+	unsigned int bits;
+	size_t i;
+	long rval;
+	int j;
+
+	for (i = 0; i + 32 + WORD_LEN - 1 <= len; i += 32)
+	{
+		eq = _mm256_set1_epi8(-1);
+		for (j = 0; j < WORD_LEN; j++)
+		{
+			if (m[j])
+				eq = _mm256_and_si256(eq, _mm256_cmpeq_epi8(
+					_mm256_loadu_si256((const __m256i *) (p + i + j)), _mm256_set1_epi8(b[j])));
+		}
+		bits = _mm256_movemask_epi8(eq);
+		if (bits)
+			return i + __builtin_ctz(bits);
+	}
+	rval = resync_find_sse2(p + i, len - i, b, m);
+	return rval < 0 ? -1 : (long) i + rval;
+}
+#endif
+
+static void resync_init(void)
+{
+#ifdef RESYNC_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+	{
+		resync_impl = resync_find_avx2;
+		resync_name = "AVX2";
+	}
+	else
+	{
+		resync_impl = resync_find_sse2;
+		resync_name = "SSE2";
+	}
+#endif
+}
+
+long resync_find(const void *buf, size_t len, uint32_t word, uint32_t mask)
+{
+	unsigned char b[WORD_LEN], m[WORD_LEN];
+
+	pthread_once(&resync_once, resync_init);
+	memcpy(b, &word, WORD_LEN);
+	memcpy(m, &mask, WORD_LEN);
+	return resync_impl(buf, len, b, m);
+}
+
+uint32_t resync_ring(t_ringbuf *rb, uint32_t word, uint32_t mask)
+{
+	unsigned char edge[2 * (WORD_LEN - 1)];
+	struct iovec iov[2];
+	size_t n0, n1;
+	long off;
+	int cnt;
+
+	cnt = ringbuf_segments(rb, iov);
+	if (cnt == 0)
+		return 0;
+
+	off = resync_find(iov[0].iov_base, iov[0].iov_len, word, mask);
+	if (off < 0 && cnt == 2)
+	{
+		// La parola puo' stare a cavallo della fine del ring
+		n0 = iov[0].iov_len < WORD_LEN - 1 ? iov[0].iov_len : WORD_LEN - 1;
+		n1 = iov[1].iov_len < WORD_LEN - 1 ? iov[1].iov_len : WORD_LEN - 1;
+		memcpy(edge, (unsigned char *) iov[0].iov_base + iov[0].iov_len - n0, n0);
+		memcpy(edge + n0, iov[1].iov_base, n1);
+		off = resync_find(edge, n0 + n1, word, mask);
+		if (off >= 0)
+			off += iov[0].iov_len - n0;
+		else
+		{
+			off = resync_find(iov[1].iov_base, iov[1].iov_len, word, mask);
+			if (off >= 0)
+				off += iov[0].iov_len;
+		}
+	}
+
+	if (off < 0)
+	{
+		n0 = iov[0].iov_len + (cnt == 2 ? iov[1].iov_len : 0);
+		off = n0 > WORD_LEN - 1 ? n0 - (WORD_LEN - 1) : 0;
+	}
+	ringbuf_consume(rb, off);
+	return off;
+}
+
+const char *resync_impl_name(void)
+{
+	pthread_once(&resync_once, resync_init);
+	return resync_name;
+}
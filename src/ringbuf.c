@@ -0,0 +1,194 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include "ringbuf.h"
+#include "ec_types.h"
+
+int ringbuf_init(t_ringbuf *rb, uint32_t size)
+{
+	if (rb == NULL || size == 0 || (size & (size - 1)) != 0)
+		return -ECERR_BADPARAM;
+
+	rb->data = malloc(size);
+	if (rb->data == NULL)
+		return -ECERR_OUTOFMEM;
+
+	rb->size = size;
+	rb->mask = size - 1;
+	rb->head = 0;
+	rb->tail = 0;
+	return 0;
+}
+
+void ringbuf_free(t_ringbuf *rb)
+{
+	if (rb == NULL)
+		return;
+	free(rb->data);
+	rb->data = NULL;
+	rb->size = rb->mask = 0;
+}
+
+void ringbuf_reset(t_ringbuf *rb)
+{
+	__atomic_store_n(&rb->tail, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&rb->head, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Each side reads its own index relaxed and the other one with acquire:
+ * the release store of head publishes the bytes written before it, the
+ * release store of tail gives the space back to the producer.
+ */
+uint32_t ringbuf_used(t_ringbuf *rb)
+{
+	return __atomic_load_n(&rb->head, __ATOMIC_ACQUIRE) -
+		__atomic_load_n(&rb->tail, __ATOMIC_ACQUIRE);
+}
+
+uint32_t ringbuf_space(t_ringbuf *rb)
+{
+	return rb->size - ringbuf_used(rb);
+}
+
+int ringbuf_write(t_ringbuf *rb, const unsigned char *buf, uint32_t len)
+{
+	uint32_t head = __atomic_load_n(&rb->head, __ATOMIC_RELAXED);
+	uint32_t tail = __atomic_load_n(&rb->tail, __ATOMIC_ACQUIRE);
+	uint32_t off = head & rb->mask;
+	uint32_t first;
+
+	if (len > rb->size - (head - tail))
+		len = rb->size - (head - tail);
+
+	first = rb->size - off;
+	if (first > len)
+		first = len;
+	memcpy(rb->data + off, buf, first);
+	memcpy(rb->data, buf + first, len - first);
+
+	__atomic_store_n(&rb->head, head + len, __ATOMIC_RELEASE);
+	return len;
+}
+
+/*
+ * Restituisce i caratteri letti, 0 se non c'era nulla (o il ring e'
+ * pieno), -ECERR_IO se errore o EOF come il resto di serial.c: il
+ * motivo resta in errno (EIO per l'EOF).
+ */
+int ringbuf_fill_fd(t_ringbuf *rb, int fd,
+	ssize_t (*do_readv)(int fd, const struct iovec *iov, int iovcnt))
+{
+	uint32_t head = __atomic_load_n(&rb->head, __ATOMIC_RELAXED);
+	uint32_t tail = __atomic_load_n(&rb->tail, __ATOMIC_ACQUIRE);
+	uint32_t space = rb->size - (head - tail);
+	uint32_t off = head & rb->mask;
+	struct iovec iov[2];
+	int iovcnt = 1;
+	ssize_t rval;
+
+	if (space == 0)
+		return 0;
+
+	iov[0].iov_base = rb->data + off;
+	iov[0].iov_len = rb->size - off;
+	if (iov[0].iov_len >= space)
+	{
+		iov[0].iov_len = space;
+	}
+	else
+	{
+		iov[1].iov_base = rb->data;
+		iov[1].iov_len = space - iov[0].iov_len;
+		iovcnt = 2;
+	}
+
+	rval = do_readv(fd, iov, iovcnt);
+	if (rval < 0)
+	{
+		if (errno == EAGAIN || errno == EINTR)
+			return 0;
+		return -ECERR_IO;
+	}
+	if (rval == 0)
+	{
+		errno = EIO;
+		return -ECERR_IO;
+	}
+
+	__atomic_store_n(&rb->head, head + (uint32_t) rval, __ATOMIC_RELEASE);
+	return (int) rval;
+}
+
+const unsigned char *ringbuf_peek(t_ringbuf *rb, uint32_t len, unsigned char *scratch)
+{
+	uint32_t tail = __atomic_load_n(&rb->tail, __ATOMIC_RELAXED);
+	uint32_t off = tail & rb->mask;
+	uint32_t first;
+
+	if (len > ringbuf_used(rb))
+		return NULL;
+
+	first = rb->size - off;
+	if (first >= len)
+		return rb->data + off;
+
+	if (scratch == NULL)
+		return NULL;
+	memcpy(scratch, rb->data + off, first);
+	memcpy(scratch + first, rb->data, len - first);
+	return scratch;
+}
+
+void ringbuf_consume(t_ringbuf *rb, uint32_t len)
+{
+	uint32_t tail = __atomic_load_n(&rb->tail, __ATOMIC_RELAXED);
+	uint32_t used = ringbuf_used(rb);
+
+	if (len > used)
+		len = used;
+	__atomic_store_n(&rb->tail, tail + len, __ATOMIC_RELEASE);
+}
+
+int ringbuf_copy(t_ringbuf *rb, unsigned char *buf, uint32_t len)
+{
+	const unsigned char *p;
+	uint32_t used = ringbuf_used(rb);
+
+	if (len > used)
+		len = used;
+	p = ringbuf_peek(rb, len, buf);
+	if (p != buf)
+		memcpy(buf, p, len);
+	return len;
+}
+
+int ringbuf_read(t_ringbuf *rb, unsigned char *buf, uint32_t len)
+{
+	len = ringbuf_copy(rb, buf, len);
+	ringbuf_consume(rb, len);
+	return len;
+}
+
+int ringbuf_segments(t_ringbuf *rb, struct iovec iov[2])
+{
+	uint32_t tail = __atomic_load_n(&rb->tail, __ATOMIC_RELAXED);
+	uint32_t used = ringbuf_used(rb);
+	uint32_t off = tail & rb->mask;
+	uint32_t first = rb->size - off;
+
+	if (used == 0)
+		return 0;
+
+	iov[0].iov_base = rb->data + off;
+	if (first >= used)
+	{
+		iov[0].iov_len = used;
+		return 1;
+	}
+	iov[0].iov_len = first;
+	iov[1].iov_base = rb->data;
+	iov[1].iov_len = used - first;
+	return 2;
+}
@@ -1,24 +1,42 @@
 #include <termios.h>
 #include <string.h>
+#include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/signal.h>
 #include <sys/types.h>
 #include <sys/time.h>
-#include <sys/select.h>
+#include <poll.h>
+#include <time.h>
 #include <errno.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <limits.h>
+#include <libgen.h>
+#include <stdlib.h>
 #include <pthread.h>
 #include <linux/serial.h>
 #include "serial.h"
+#include "ringbuf.h"
+#include "termios2.h"
+#include "vlink.h"
+#include "transport.h"
+#include "portstats.h"
+#include "capture.h"
 #include "ec_types.h"
 #include "debug.h"
 
-static int debuglevelDriver = DBG_ERROR;
+DBG_MODULE(debuglevelDriver, "serial", DBG_ERROR)
 
 #define MAX_SERIAL_ERRNO	5
 
+/* Profilo a bassa latenza: vedi serial_set_low_latency() */
+#define SERIAL_USB_LATENCY_MS	1
+static int serial_lowlat = 0;
+static char serial_sysfs_root[PATH_MAX] = "/sys";
+
 /*
  * Questa funzione restituisce:
  * il risultato del comando passatogli
@@ -103,20 +121,144 @@ static void dump_raw_data(const unsigned char *buffer, int len)
 	print_payload(__FUNCTION__, buffer, len, DBG_VERBOSE);
 }
 
+static int serial_poll_until(int fd, short events, int64_t deadline);
+
 void serial_device_status(int fd)
+{
+	t_transport_stats st;
+
+	transport_get_stats(fd, &st);
+	DRIVER_ERROR("%s FD %d: rx=%llu, tx=%llu, reads = %llu, writes = %llu, waits = %llu, "
+		"line rx = %llu, line tx = %llu, "
+		"frame = %llu, overrun = %llu, parity = %llu, brk = %llu, buf_overrun = %llu\n",
+		transport_of(fd)->name, fd,
+		(unsigned long long) st.rx_bytes, (unsigned long long) st.tx_bytes,
+		(unsigned long long) st.reads, (unsigned long long) st.writes, (unsigned long long) st.waits,
+		(unsigned long long) st.line_rx, (unsigned long long) st.line_tx,
+		(unsigned long long) st.frame, (unsigned long long) st.overrun, (unsigned long long) st.parity,
+		(unsigned long long) st.brk, (unsigned long long) st.buf_overrun);
+	portstats_line(fd, &st);
+}
+
+static void tty_stats(int fd, t_transport_stats *st)
 {
 	struct serial_icounter_struct icount = { 0 };
-	int ret = ioctl(fd, TIOCGICOUNT, &icount);
-	if (ret != -1) {
-		DRIVER_ERROR("TIOCGICOUNT: ret=%i, rx=%i, tx=%i, frame = %i, overrun = %i, parity = %i, brk = %i, buf_overrun = %i\n",
-			ret, icount.rx, icount.tx, icount.frame, icount.overrun, icount.parity, icount.brk, icount.buf_overrun);
+
+	if (ioctl(fd, TIOCGICOUNT, &icount) < 0)
+		return;
+	st->line_rx = icount.rx;
+	st->line_tx = icount.tx;
+	st->frame = icount.frame;
+	st->overrun = icount.overrun;
+	st->parity = icount.parity;
+	st->brk = icount.brk;
+	st->buf_overrun = icount.buf_overrun;
+}
+
+static int tty_open(const char *name, int baudrate)
+{
+	struct stat st;
+	int fd;
+
+	(void) baudrate;
+
+	// Qualsiasi device a caratteri: /dev/ttyS*, /dev/ttyUSB*, /dev/pts/*...
+	if (stat(name, &st) < 0 || !S_ISCHR(st.st_mode))
+	{
+		DRIVER_ERROR( "Not supported device!\n" );
+		return -ENODEV;
+	}
+
+	// O_FSYNC non serve a una seriale e rallenta ogni write()
+	fd = open(name, O_RDWR | (serial_lowlat ? 0 : O_FSYNC) | O_NOCTTY | O_NONBLOCK);
+	if (fd < 0)
+	{
+		DRIVER_ERROR("open() %d %s for %s\n", errno, strerror( errno ), name);
+		perror("open");
+		return -ENODEV;
+	}
+	return fd;
+}
+
+void serial_set_low_latency(int enable)
+{
+	serial_lowlat = enable;
+}
+
+void serial_set_sysfs_root(const char *root)
+{
+	if (root != NULL)
+		snprintf(serial_sysfs_root, sizeof(serial_sysfs_root), "%s", root);
+}
+
+unsigned int serial_low_latency_applied(int fd)
+{
+	return transport_get_flags(fd);
+}
+
+/*
+ * Il latency_timer dei convertitori USB (FTDI) tiene fermi i caratteri
+ * ricevuti fino a 16 msec di default: e' la voce piu' grossa del tempo
+ * di andata e ritorno. Lo troviamo da /sys/class/tty/<tty>/device.
+ */
+static int serial_usb_latency_timer(const char *name, int msecs)
+{
+	char real[PATH_MAX];
+	char path[PATH_MAX + 64];
+	char value[16];
+	FILE *f;
+	int rval = -1;
+
+	if (realpath(name, real) == NULL)
+		return -1;
+	snprintf(path, sizeof(path), "%s/class/tty/%s/device/latency_timer",
+		serial_sysfs_root, basename(real));
+
+	f = fopen(path, "w");
+	if (f == NULL)
+	{
+		DRIVER_VERBOSE("No latency_timer for %s (%s)\n", name, path);
+		return -1;
+	}
+	fprintf(f, "%d\n", msecs);
+	if (fclose(f) != 0)
+		return -1;
+
+	// Rileggiamo: il valore conta solo se il driver l'ha accettato
+	f = fopen(path, "r");
+	if (f == NULL)
+		return -1;
+	if (fgets(value, sizeof(value), f) != NULL)
+		rval = strtol(value, NULL, 10) == msecs ? 0 : -1;
+	fclose(f);
+	return rval;
+}
+
+static unsigned int serial_low_latency_setup(int fd, const char *name)
+{
+	struct serial_struct ss;
+	unsigned int applied = 0;
+
+	if (ioctl(fd, TIOCGSERIAL, &ss) == 0)
+	{
+		ss.flags |= ASYNC_LOW_LATENCY;
+		if (ioctl(fd, TIOCSSERIAL, &ss) == 0 &&
+			ioctl(fd, TIOCGSERIAL, &ss) == 0 && (ss.flags & ASYNC_LOW_LATENCY))
+			applied |= SERIAL_LOWLAT_ASYNC;
 	}
+
+	if (serial_usb_latency_timer(name, SERIAL_USB_LATENCY_MS) == 0)
+		applied |= SERIAL_LOWLAT_USB_TIMER;
+
+	DRIVER_VERBOSE("%s low latency: ASYNC_LOW_LATENCY %s - latency_timer %s\n", name,
+		applied & SERIAL_LOWLAT_ASYNC ? "on" : "off",
+		applied & SERIAL_LOWLAT_USB_TIMER ? "on" : "off");
+	return applied;
 }
 
 int serial_device_init(const char *name, int baudrate, int pre, int post)
 {
 	int fd;
-	const char * devicefamily = "/dev/tty";
 	int rval;
 
 	/* Consideriamo le seriali tutte RS485! */
@@ -129,109 +271,133 @@ int serial_device_init(const char *name, int baudrate, int pre, int post)
 
 	DRIVER_NOISY("Enter with: %s and %d baudrate\n", name, baudrate);
 
-	if (strncmp(name, devicefamily, strlen(devicefamily)))
-	{
-		DRIVER_ERROR( "Not supported device!\n" );
-		return -ENODEV;
-	}
-
-	fd = open(name, O_RDWR | O_FSYNC | O_NOCTTY | O_NONBLOCK);
+	// Il nome sceglie il trasporto: device, pty, null, unix, tcp
+	fd = transport_open(name, baudrate);
 	if (fd < 0)
-	{
-		DRIVER_ERROR("open() %d %s for %s\n", errno, strerror( errno ), name);
-		perror("open");
 		return -ENODEV;
-	}
 
 	rval = serial_device_reset(fd, baudrate, pre, post);
 	if (rval < 0)
 	{
 		DRIVER_ERROR("Unable to reset device %s at baudrate %d\n",
 			name, baudrate);
-		close(fd);
+		transport_close(fd);
 		return -ENODEV;
 	}
 
+	if (serial_lowlat && transport_of(fd) == &transport_tty)
+		transport_set_flags(fd, SERIAL_LOWLAT_NO_FSYNC | serial_low_latency_setup(fd, name));
+
 	DRIVER_NOISY("rval: %d -- Exit with: %d\n", rval, fd);
 	return fd;
 }
 
 int serial_send_break(int fd)
 {
-	int rval = 0;
 	DRIVER_NOISY("Enter with: FD: %d\n", fd);
+	if (capture_active())
+		capture_data(fd, CAPTURE_BREAK, NULL, 0);
+	return transport_of(fd)->send_break(fd);
+}
+
+static int tty_send_break(int fd)
+{
+	int rval = 0;
 	// Send BREAK
 	rval = tcsendbreak(fd, 250);
 	return rval;
 }
 
-int serial_device_reset(int fd, int baudrate, int pre, int post)
+static const struct {
+	int baudrate;
+	speed_t speed;
+} serial_speeds[] = {
+	{ 1200, B1200 },
+	{ 2400, B2400 },
+	{ 4800, B4800 },
+	{ 9600, B9600 },
+	{ 19200, B19200 },
+	{ 38400, B38400 },
+	{ 57600, B57600 },
+	{ 115200, B115200 },
+	{ 230400, B230400 },
+	{ 1000000, B1000000 },
+	{ 2000000, B2000000 },
+};
+
+static speed_t serial_speed_from_baudrate(int baudrate)
+{
+	unsigned int i;
+	for (i = 0; i < ArraySize(serial_speeds); i++)
+	{
+		if (serial_speeds[i].baudrate == baudrate)
+			return serial_speeds[i].speed;
+	}
+	return B0;
+}
+
+int serial_get_baudrate(int fd)
+{
+	return transport_of(fd)->get_baudrate(fd);
+}
+
+static int tty_get_baudrate(int fd)
 {
 	struct termios term;
-	struct serial_rs485 rs485conf;
+	speed_t speed;
+	unsigned int i;
+	int rval;
 
-	if (baudrate < 0 || fd < 0)
+	// termios2 riporta qualsiasi velocita', anche quelle non standard
+	rval = serial_termios2_get_speed(fd);
+	if (rval > 0)
+		return rval;
+
+	if (fd < 0 || tcgetattr(fd, &term) < 0)
+		return -1;
+
+	speed = cfgetospeed(&term);
+	for (i = 0; i < ArraySize(serial_speeds); i++)
+	{
+		if (serial_speeds[i].speed == speed)
+			return serial_speeds[i].baudrate;
+	}
+	return -1;
+}
+
+/* Errore massimo sulla velocita' applicata dal driver (percento) */
+#define SERIAL_BAUD_TOLERANCE_PCT	3
+
+int serial_device_reset(int fd, int baudrate, int pre, int post)
+{
+	if (baudrate <= 0 || fd < 0)
 	{
 		DRIVER_ERROR("BAD PARAMETER\n");
 		return -ECERR_BADPARAM;
 	}
 
 	DRIVER_NOISY("Enter with: FD: %d - %d baudrate\n", fd, baudrate);
+	return transport_of(fd)->reset(fd, baudrate, pre, post);
+}
+
+static int tty_reset(int fd, int baudrate, int pre, int post)
+{
+	struct termios term;
+	speed_t speed;
+	struct serial_rs485 rs485conf;
+	int applied;
+	int rval;
 
 	GET_PORT_STATE(fd, &term);
 
 	cfmakeraw(&term);
 
-	switch (baudrate)
-	{
-		case 1200:
-			cfsetispeed( &term, B1200 );
-			cfsetospeed( &term, B1200 );
-			break;
-		case 2400:
-			cfsetispeed( &term, B2400 );
-			cfsetospeed( &term, B2400 );
-			break;
-		case 4800:
-			cfsetispeed( &term, B4800 );
-			cfsetospeed( &term, B4800 );
-			break;
-		case 9600:
-			cfsetispeed( &term, B9600 );
-			cfsetospeed( &term, B9600 );
-			break;
-		case 19200:
-			cfsetispeed( &term, B19200 );
-			cfsetospeed( &term, B19200 );
-			break;
-		case 38400:
-			cfsetispeed( &term, B38400 );
-			cfsetospeed( &term, B38400 );
-			break;
-		case 57600:
-			cfsetispeed( &term, B57600 );
-			cfsetospeed( &term, B57600 );
-			break;
-		case 115200:
-			cfsetispeed( &term, B115200 );
-			cfsetospeed( &term, B115200 );
-			break;
-		case 230400:
-			cfsetispeed( &term, B230400 );
-			cfsetospeed( &term, B230400 );
-			break;
-		case 1000000:
-			cfsetispeed( &term, B1000000 );
-			cfsetospeed( &term, B1000000 );
-			break;
-		case 2000000:
-			cfsetispeed( &term, B2000000 );
-			cfsetospeed( &term, B2000000 );
-			break;
-		default:
-			DRIVER_ERROR("Not Supported BaudRate: %d\n", baudrate);
-			return -EINVAL;
-	}
+	// Le velocita' non standard vengono impostate dopo con termios2
+	speed = serial_speed_from_baudrate(baudrate);
+	if (speed == B0)
+		speed = B38400;
+	cfsetispeed( &term, speed );
+	cfsetospeed( &term, speed );
 
 	/* Impostazioni termios */
 	term.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP |
@@ -258,6 +424,29 @@ int serial_device_reset(int fd, int baudrate, int pre, int post)
 
 	SET_PORT_STATE(fd, &term);
 
+	if (serial_speed_from_baudrate(baudrate) == B0)
+	{
+		rval = serial_termios2_set_speed(fd, baudrate);
+		if (rval < 0)
+		{
+			DRIVER_ERROR("Not Supported BaudRate: %d (%s)\n", baudrate, strerror(-rval));
+			return -EINVAL;
+		}
+	}
+
+	/*
+	 * Rileggiamo la velocita' che il driver ha davvero applicato: il
+	 * divisore dell'UART puo' solo approssimare quella chiesta
+	 */
+	applied = serial_get_baudrate(fd);
+	if (applied <= 0 || abs(applied - baudrate) > baudrate / 100 * SERIAL_BAUD_TOLERANCE_PCT)
+	{
+		DRIVER_ERROR("BaudRate %d not applied by the driver: %d\n", baudrate, applied);
+		return -EINVAL;
+	}
+	if (applied != baudrate)
+		DRIVER_VERBOSE("BaudRate %d applied as %d\n", baudrate, applied);
+
 	/* 
 	 * RS485 Section. If it fails, does not care!
 	 */
@@ -296,11 +485,27 @@ int serial_device_reset(int fd, int baudrate, int pre, int post)
 }
 
 
-int send_serial_data(int fd, const unsigned char *buffer, int len)
-{
-	int rval = 0;
+/* Margine concesso alla coda di trasmissione oltre al tempo di linea */
+#define SERIAL_WRITE_SLACK_MS	1000L
 
-	DRIVER_NOISY("Enter Buffer: %p - Len: %d\n", buffer, len);
+/*
+ * Scrive tutti i segmenti con writev(), continuando dopo le scritture
+ * parziali: se la coda del driver e' piena aspettiamo che si liberi
+ * (POLLOUT) fino alla deadline. Con deadline 0 la deadline viene
+ * calcolata, solo se serve, dalla lunghezza del frame.
+ * Restituisce i caratteri scritti (meno del totale se la deadline e'
+ * scaduta) oppure < 0 se errore, con errno impostato.
+ */
+static int serial_writev_all(int fd, const struct iovec *iov, int iovcnt, int64_t deadline)
+{
+	struct iovec v[SERIAL_MAX_IOV];
+	struct iovec *cur = v;
+	const t_transport_ops *ops;
+	t_transport_stats *st;
+	int total = 0;
+	int sent = 0;
+	int rval;
+	int i;
 
 	if (fd < 0)
 	{
@@ -308,25 +513,146 @@ int send_serial_data(int fd, const unsigned char *buffer, int len)
 		return -ECERR_IO;
 	}
 
-	if (debuglevelDriver >= DBG_VERBOSE)
+	if (iov == NULL || iovcnt <= 0 || iovcnt > SERIAL_MAX_IOV)
+	{
+		DRIVER_ERROR("BAD PARAMETER\n");
+		return -ECERR_BADPARAM;
+	}
+
+	memcpy(v, iov, iovcnt * sizeof(struct iovec));
+	for (i = 0; i < iovcnt; i++)
 	{
-		DRIVER_NOISY("EXITING WRITE: ");
-		dump_raw_data(buffer, len);
+		total += v[i].iov_len;
+		if (DBG_ENABLED(debuglevelDriver, DBG_VERBOSE))
+		{
+			DRIVER_NOISY("EXITING WRITE [%d]: ", i);
+			dump_raw_data(v[i].iov_base, v[i].iov_len);
+		}
 	}
 
-	rval = write(fd, buffer, len);
+	ops = transport_of(fd);
+	st = transport_counters(fd);
+	while (iovcnt > 0)
+	{
+		rval = ops->writev(fd, cur, iovcnt);
+		st->writes++;
+		if (rval < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN)
+			{
+				DRIVER_ERROR("writev() %d %s\n", errno, strerror(errno));
+				return rval;
+			}
+			// Coda di trasmissione piena: aspettiamo che si svuoti
+			if (deadline == 0)
+				deadline = serial_transfer_deadline(fd, total, SERIAL_WRITE_SLACK_MS);
+			rval = serial_poll_until(fd, POLLOUT, deadline);
+			if (rval < 0)
+				return rval;
+			if (rval == 0)
+			{
+				DRIVER_ERROR("Write timeout: %d of %d sent\n", sent, total);
+				break;
+			}
+			continue;
+		}
+
+		sent += rval;
+		st->tx_bytes += rval;
+		if (capture_active())
+			capture_iov(fd, CAPTURE_TX, cur, iovcnt, rval);
+		DRIVER_NOISY("writev() RETURNS: %d - SENT %d of %d\n", rval, sent, total);
+		// Saltiamo i segmenti gia' scritti e accorciamo quello parziale
+		while (iovcnt > 0 && (size_t) rval >= cur->iov_len)
+		{
+			rval -= cur->iov_len;
+			cur++;
+			iovcnt--;
+		}
+		if (iovcnt > 0)
+		{
+			cur->iov_base = (unsigned char *) cur->iov_base + rval;
+			cur->iov_len -= rval;
+		}
+	}
+
+	return sent;
+}
+
+int serial_send_iov(int fd, const struct iovec *iov, int iovcnt)
+{
+	return serial_writev_all(fd, iov, iovcnt, 0);
+}
+
+int serial_send_iov_until(int fd, const struct iovec *iov, int iovcnt, int64_t deadline)
+{
+	return serial_writev_all(fd, iov, iovcnt, deadline);
+}
+
+int send_serial_data(int fd, const unsigned char *buffer, int len)
+{
+	struct iovec iov;
+	int rval = 0;
+
+	DRIVER_NOISY("Enter Buffer: %p - Len: %d\n", buffer, len);
+
+	iov.iov_base = (void *) buffer;
+	iov.iov_len = len;
+	rval = serial_writev_all(fd, &iov, 1, 0);
 	DRIVER_NOISY("Exit rval: %d\n", rval);
 	return rval;
 }
 
-static int serial_wait_data(int fd, long timeout)
+int64_t serial_now_ms(void)
 {
-	fd_set rfds;
-	struct timeval tv;
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int64_t serial_deadline_in(long ms)
+{
+	return serial_now_ms() + (ms > 0 ? ms : 0);
+}
+
+long serial_time_left(int64_t deadline)
+{
+	int64_t left = deadline - serial_now_ms();
+	return left > 0 ? (long) left : 0;
+}
+
+/*
+ * Tempo necessario per trasmettere len caratteri alla velocita'
+ * indicata (1 start + 8 dati + 1 stop = 10 bit per carattere),
+ * arrotondato al millisecondo superiore.
+ */
+long serial_transfer_time(int baudrate, int len)
+{
+	if (baudrate <= 0 || len <= 0)
+		return 0;
+	return (long) (((int64_t) len * 10 * 1000 + baudrate - 1) / baudrate);
+}
+
+int64_t serial_transfer_deadline(int fd, int len, long slack)
+{
+	return serial_deadline_in(serial_transfer_time(serial_get_baudrate(fd), len) + slack);
+}
+
+/*
+ * Attende che la porta sia pronta (events di poll()) entro la deadline
+ * assoluta. Restituisce 1 se pronta, 0 se la deadline e' scaduta, < 0
+ * se errore. Le interruzioni (EINTR) non accorciano l'attesa.
+ */
+static int serial_poll_until(int fd, short events, int64_t deadline)
+{
+	int (*wait)(int, short, int, short *);
+	short revents = 0;
 	int rval;
 	int retval = -1;
 
-	DRIVER_NOISY("Called with TO: %ld\n", timeout);
+	DRIVER_NOISY("Called with TO: %ld\n", serial_time_left(deadline));
 
 	if (fd < 0)
 	{
@@ -334,26 +660,14 @@ static int serial_wait_data(int fd, long timeout)
 		return -ECERR_IO;
 	}
 
-	// Timeout must be in milliseconds
-	// Wait up to N seconds.
-	// Watch file fd to see when it has input.
-	FD_ZERO(&rfds);
-	FD_SET(fd, &rfds);
-
-	if ( timeout > 0 )
+	// We sleep in the kernel until the port becomes ready, so the
+	// first byte wakes us up at once.
+	wait = transport_of(fd)->wait;
+	transport_counters(fd)->waits++;
+	do
 	{
-		// Do not touch the requested timeout value
-	}
-	else
-	{
-		// If timeout is equal or less than 0, we setup a timeout of
-		// 5 seconds to keep the CPU free of charge
-		timeout = 5000L;
-	}
-
-	tv.tv_sec = timeout / 1000;
-	tv.tv_usec = (timeout % 1000) * 1000;
-	rval = select(fd+1, &rfds, NULL, NULL, &tv);
+		rval = wait(fd, events, (int) serial_time_left(deadline), &revents);
+	} while (rval < 0 && errno == EINTR && serial_time_left(deadline) > 0);
 
 	if (rval < 0)
 	{
@@ -364,19 +678,27 @@ static int serial_wait_data(int fd, long timeout)
 		}
 		else
 		{
-			DRIVER_ERROR( "SELECT ERROR\n");
+			DRIVER_ERROR( "POLL ERROR\n");
 			retval = -1;
 		}
 	}
 	else
 	if (rval == 0)
 	{
-		DRIVER_VERBOSE("SELECT TIMEOUT\n");
+		DRIVER_VERBOSE("POLL TIMEOUT\n");
 		retval = 0;
 	}
 	else
+	if (revents & (POLLERR | POLLNVAL))
+	{
+		DRIVER_ERROR("POLL EVENT ERROR 0x%04x\n", revents);
+		retval = -1;
+	}
+	else
 	{
-		DRIVER_VERBOSE("SELECT RECEIVE\n");
+		// POLLHUP is reported as ready too: the following read() or
+		// write() will tell the caller what really happened.
+		DRIVER_VERBOSE("POLL READY 0x%04x\n", revents);
 		retval = 1;
 	}
 
@@ -385,22 +707,61 @@ static int serial_wait_data(int fd, long timeout)
 
 }
 
+static int serial_wait_until(int fd, int64_t deadline)
+{
+	return serial_poll_until(fd, POLLIN, deadline);
+}
+
+/*
+ * Legge tutto quello che e' disponibile (al massimo len bytes) con una
+ * sola read(). Restituisce il numero di caratteri letti, 0 se non c'e'
+ * niente (EAGAIN/EINTR) oppure < 0 in caso di errore.
+ * Con la porta chiusa dall'altro lato (EOF) restituisce -ECERR_IO.
+ */
+static int serial_drain(int fd, unsigned char *buffer, int len)
+{
+	struct iovec iov = { .iov_base = buffer, .iov_len = len };
+	int rval;
+
+	rval = transport_of(fd)->readv(fd, &iov, 1);
+	transport_counters(fd)->reads++;
+	if (rval < 0)
+	{
+		if (errno == EINTR || errno == EAGAIN)
+		{
+			DRIVER_NOISY("-- READ EINTR/EAGAIN --\n");
+			return 0;
+		}
+		DRIVER_NOISY("READ Error %d -- Retval: %d\n", errno, rval);
+		return rval;
+	}
+	if (rval == 0)
+	{
+		// poll() ci ha detto che la porta era leggibile ma non c'e'
+		// nulla: l'altro capo ha chiuso (hangup).
+		DRIVER_NOISY("READ EOF\n");
+		errno = EIO;
+		return -ECERR_IO;
+	}
+	transport_counters(fd)->rx_bytes += rval;
+	if (capture_active())
+		capture_data(fd, CAPTURE_RX, buffer, rval);
+	return rval;
+}
+
 /*
  * Restituisce < 0 se errore,
  * altrimenti 0 se non ci sono caratteri da leggere, altrimenti
- * se ne ho letti restituisco quanti ne ho letti ed il buffer
+ * se ne ho letti restituisco quanti ne ho letti ed il buffer.
+ * Tutta la stringa deve arrivare entro la deadline.
  */
-int serial_read_string(int fd, unsigned char *buf, long to)
+int serial_read_string_until(int fd, unsigned char *buf, int64_t deadline)
 {
 	int retval;
 	int rval;
 	unsigned char *buffer = buf;
-	int serialread;
-	long timeout;
 	int i;
 
-	// Se entro 2.5 secondi non ho nulla, allora posso dire che il
-	// modem non risponde!
 	DRIVER_NOISY("Enter\n");
 
 	if (fd < 0)
@@ -415,14 +776,7 @@ int serial_read_string(int fd, unsigned char *buf, long to)
 		return -ECERR_IO;
 	}
 
-	/*
-	 * Stiamo in attesa di avere dei dati su seriale...
-	 * almeno 2.5 secondi
-	 */
-	if (to < 0)
-		to = 2500;
-
-	rval = serial_wait_data(fd, to);
+	rval = serial_wait_until(fd, deadline);
 	if (rval <= 0)
 	{
 		DRIVER_VERBOSE("Timeout waiting serial response\n");
@@ -436,105 +790,71 @@ int serial_read_string(int fd, unsigned char *buf, long to)
 		 */
 		int toexit = 0;
 		rval = 0;
-		serialread = -1;
-		/* Abbiamo circa un secondo per leggere tutto quello che arriva
-		 * dal modem (almeno tra un carattere e l'altro...) */
-		double timing_usec = 5000;
-		timeout = (1000000L / timing_usec);
 		do
 		{
 			/*
-			 * Leggiamo i caratteri presenti volta per volta...
+			 * Leggiamo in un colpo solo tutti i caratteri presenti,
+			 * lasciando posto per il fine stringa.
 			 */
-			ioctl(fd, FIONREAD, &serialread);
-			if (serialread > 0)
+			retval = serial_drain(fd, buffer, SERIAL_STRING_MAXLEN - 1 - rval);
+			if (retval < 0)
 			{
-				/*
-				 * Ci sono dei caratteri nel buffer della seriale,
-				 * leggiamoli tutti!
-				 */
-				retval = read(fd, buffer, serialread);
-				if (retval < 0)
+				int err = errno;
+				DRIVER_ERROR("Error on serial: Errno: %d!\n", err);
+				break;
+			}
+			if (retval > 0)
+			{
+				DRIVER_VERBOSE("Read: %d Characters from Serial\n", retval);
+				if (DBG_ENABLED(debuglevelDriver, DBG_VERBOSE))
 				{
-					int err = errno;
-					DRIVER_ERROR("Error on serial: Errno: %d!\n", err);
-					toexit = 1;
+					DRIVER_NOISY("READ (1): ");
+					dump_raw_data(buffer, retval);
 				}
-				else
+				// Controllo solo i caratteri nuovi (piu' l'ultimo del
+				// blocco precedente) per vedere se c'e' la fine del
+				// comando \r\n! SEQUENZA: 0x0d 0x0a
+				i = (rval > 0) ? rval - 1 : 0;
+				rval += retval;
+				buffer += retval;
+				DRIVER_NOISY("Overall Read: %d Chars Read\n", rval);
+				for (; i < rval; i++)
 				{
-					/*
-					 * Ne ho letti meno di quelli presenti! Qualche
-					 * errore? In ogni caso abbiamo in buffer quelli
-					 * che sono riuscito a leggere!
-					 */
-					if (retval != serialread)
+					DRIVER_NOISY("[%02d] = %c - 0x%02x\n", i,
+						buf[i] >= ' ' ? buf[i] : '.',
+						buf[i]);
+					if (buf[i] == 0x0d && i + 1 < rval && buf[i + 1] == 0x0a)
 					{
-						DRIVER_ERROR("Error on serial: %d!\n", retval);
-						toexit = 1;
-					}
-					else
-					{
-						/* Reload Timeout for next chars... */
-						timeout = (1000000L / timing_usec);
-						DRIVER_VERBOSE("Read: %d Characters from Serial\n",
-							serialread);
-						/*
-						 * Aggiorno il conteggio dei caratteri letti
-						 * ed il puntatore al buffer per i prossimi
-						 * caratteri da leggere!
-						 */
-						if (debuglevelDriver >= DBG_VERBOSE)
-						{
-							DRIVER_NOISY("READ (1): ");
-							dump_raw_data(buffer, retval);
-						}
-					}
-					rval += retval;
-					buffer += retval;
-					DRIVER_NOISY("Overall Read: %d Chars Read\n", rval);
-					// Controllo il buffer dall'inizio per vedere se
-					// tra i caratteri letti c'era la fine del comando
-					// \r\n! SEQUENZA: 0x0d 0x0a
-					for (i = 0; i < rval; i++)
-					{
-						DRIVER_NOISY("[%02d] = %c - 0x%02x\n", i,
-							buf[i] >= ' ' ? buf[i] : '.',
-							buf[i]);
-						if (buf[i] == 0x0d && buf[i + 1] == 0x0a)
+						// Stampiamo anche quello che, di fatto,
+						// costruisce il match.
+						DRIVER_NOISY("[%02d] = . - 0x%02x\n", i + 1,
+							buf[i + 1]);
+						DRIVER_NOISY("<END-OF-COMMAND> Found.\n");
+						if (DBG_ENABLED(debuglevelDriver, DBG_VERBOSE) && rval > 0)
 						{
-							// Stampiamo anche quello che, di fatto,
-							// costruisce il match.
-							DRIVER_NOISY("[%02d] = . - 0x%02x\n", i + 1,
-								buf[i + 1]);
-							DRIVER_NOISY("<END-OF-COMMAND> Found.\n");
-							if (debuglevelDriver >= DBG_VERBOSE && rval > 0)
-							{
-								DRIVER_NOISY("EXITING READ (2): ");
-								dump_raw_data(buf, rval);
-							}
-							toexit = 1;
-							break;
+							DRIVER_NOISY("EXITING READ (2): ");
+							dump_raw_data(buf, rval);
 						}
+						toexit = 1;
+						break;
 					}
 				}
+				if (rval >= SERIAL_STRING_MAXLEN - 1)
+				{
+					DRIVER_ERROR("String too long: %d chars without EOL\n", rval);
+					toexit = 1;
+				}
 			}
-			// Se non dovessimo uscire, allora attendiamo un po' e
-			// decrementiamo il timeout...
+			// Se non dovessimo uscire, allora attendiamo il prossimo
+			// blocco di caratteri fino alla deadline...
 			if (! toexit)
 			{
-				usleep(timing_usec);
-				timeout--;
-			}
-			if (timeout < 0)
-			{
-				DRIVER_NOISY("TIMEOUT REACHED!\n");
-				toexit = 1;
-			}
-			else
-			{
-				DRIVER_NOISY("TIMEOUT: %ld\n", timeout);
+				if (serial_wait_until(fd, deadline) <= 0)
+				{
+					DRIVER_NOISY("TIMEOUT REACHED!\n");
+					toexit = 1;
+				}
 			}
-			serialread = -1; /* Invalidiamo per la prossima lettura */
 		} while (toexit == 0) ;
 		/*
 		 * Giunto a questo punto ho letto almeno rval caratteri...
@@ -546,15 +866,33 @@ int serial_read_string(int fd, unsigned char *buf, long to)
 	return rval;
 }
 
-int serial_read_raw(int fd, unsigned char *buf, int len)
+/* Tempo massimo di silenzio tra un blocco di caratteri e il successivo */
+#define SERIAL_INTERCHAR_TIMEOUT_MS	1000L
+
+int serial_read_string(int fd, unsigned char *buf, long to)
+{
+	// Se entro 2.5 secondi non ho nulla, allora posso dire che il
+	// modem non risponde!
+	if (to < 0)
+		to = 2500;
+
+	// Il primo carattere entro 'to', poi al massimo un altro secondo
+	// per il resto della stringa.
+	return serial_read_string_until(fd, buf,
+		serial_deadline_in(to + SERIAL_INTERCHAR_TIMEOUT_MS));
+}
+
+/*
+ * Legge esattamente len caratteri, a meno che la deadline assoluta
+ * non scada prima: in quel caso restituisce quelli letti fino a quel
+ * momento (0 se nessuno). < 0 se errore.
+ */
+int serial_read_raw_until(int fd, unsigned char *buf, int len, int64_t deadline)
 {
 	int retval;
 	int rval;
 	unsigned char *buffer = buf;
-	int serialread = -1;
 	int toread = len;
-	double timing_usec = 5000; // 5 msec ogni interruzione
-	long timeout = 1000000 / timing_usec;
 
 	DRIVER_NOISY("Enter\n");
 
@@ -570,11 +908,13 @@ int serial_read_raw(int fd, unsigned char *buf, int len)
 		return -ECERR_IO;
 	}
 
-	/*
-	 * Stiamo in attesa di avere dei dati su seriale...
-	 * Diciamo almeno 4 secondi...
-	 */
-	rval = serial_wait_data(fd, 4000);
+	if (len <= 0)
+	{
+		DRIVER_NOISY("Nothing to read\n");
+		return 0;
+	}
+
+	rval = serial_wait_until(fd, deadline);
 	if (rval <= 0)
 	{
 		DRIVER_VERBOSE("Timeout waiting serial response\n");
@@ -586,107 +926,43 @@ int serial_read_raw(int fd, unsigned char *buf, int len)
 		DRIVER_NOISY("READ LOOP START - WAITING %d BYTES\n", len);
 		for (;;)
 		{
-			// Ci sono dei dati da leggere!
-			retval = ioctl(fd, FIONREAD, &serialread);
+			// La porta e' leggibile: prendiamo in un colpo solo tutto
+			// quello che c'e', al massimo quelli che ci spettano!
+			retval = serial_drain(fd, buffer, toread);
+			DRIVER_NOISY("read() RETURNS: %d - TOREAD: %d\n", retval, toread);
 			if (retval < 0)
 			{
-				if (errno != EINTR && errno != EAGAIN)
-				{
-					DRIVER_NOISY("IOCTL FIONREAD Error %d -- Retval: %d\n",
-						errno, retval);
-					// Questo e' un errore! Deve pensarci il chiamante!
-					return retval;
-				}
-				else
-				{
-					DRIVER_NOISY("-- IOCTL FIONREAD EINTR/EAGAIN --\n");
-				}
+				// Questo e' un errore! Deve pensarci il chiamante!
+				return retval;
 			}
-			else
+
+			// Aggiorno il totale...
+			rval += retval;
+			toread -= retval;
+			buffer += retval;
+			DRIVER_NOISY("READ: %d CHARS - TO READ: %d\n", rval, toread);
+			if (toread == 0)
 			{
-				DRIVER_NOISY("SOMETHING TO READ (FROM IOCTL): %d SERIALREAD\n", serialread);
-				// La ioctl mi ha detto che potrebbero esserci (forse)
-				// dei caratteri
-				if (serialread > 0)
-				{
-					// Al massimo leggiamo quelli che ci spettano!
-					if (serialread > toread)
-					{
-						DRIVER_NOISY("LIMIT SERIALREAD TO: %d\n", toread); 
-						serialread = toread;
-					}
+				DRIVER_NOISY("READ DONE %d CHARS\n", len);
+				break;
+			}
 
-					retval = read(fd, buffer, serialread);
-					DRIVER_NOISY("read() RETURNS: %d - SERIALREAD: %d\n",
-						retval, serialread);
-					if (retval < 0)
-					{
-						if (errno != EINTR && errno != EAGAIN)
-						{
-							// Questo e' un errore
-							DRIVER_NOISY("READ Error %d -- Retval: %d\n",
-								errno, retval);
-							return retval;
-						}
-						else
-						{
-							DRIVER_NOISY("-- READ EINTR/EAGAIN --\n");
-						}
-					}
-					else
-					{
-						if (retval == 0)
-						{
-							// Deleghiamo il controllo al chiamante.
-							// Ho detto di leggere 'len' bytes e non 
-							// ne ho letto nessuno...
-							DRIVER_NOISY("NO CHARACTERS TO READ! ???\n");
-							return 0;
-						}
-						else
-						{
-							// Aggiorno il totale...
-							rval += retval;
-							DRIVER_NOISY("READ: %d CHARS\n", rval);
-							if (rval == len)
-							{
-								DRIVER_NOISY("READ DONE %d CHARS\n", len);
-								break;
-							}
-
-							// Se non ne ho letti tutti, aggiorno che
-							// devo leggerne i rimanenti!
-							toread -= retval;
-							DRIVER_NOISY("TO READ: %d\n", toread);
-
-							// Aggiorno il puntatore al buffer
-							buffer += retval;
-						}
-					}
-				}
-				// Se sono qui, vuol dire che non ho letto tutti
-				// i caratteri che mi occorrono oppure che non mi
-				// sono arrivati ancora tutti...
-				// Attendo un po' e poi ci riproviamo!
-
-				timeout = (1000000 / timing_usec);
-				usleep(timing_usec);
-				timeout--;
-				if (timeout < 0)
-				{
-					DRIVER_NOISY("TIMEOUT REACHED!\n");
-					break;
-				}
+			// Se sono qui, vuol dire che non mi sono arrivati ancora
+			// tutti i caratteri: dormiamo nel kernel finche' non ne
+			// arrivano altri, ma non oltre la deadline anche se la
+			// porta continua a ricevere qualche carattere ogni tanto.
+			if (serial_wait_until(fd, deadline) <= 0)
+			{
+				DRIVER_NOISY("TIMEOUT REACHED!\n");
+				break;
 			}
-			serialread = -1; /* Invalidiamo per la prossima lettura */
 			DRIVER_NOISY("\t*** REPLAY LOOP ***\n");
 		}
 	}
 
 	DRIVER_NOISY("Exit with: %d\n", rval);
-//	fprintf(stdout, "READ LEN: %d Exit with: %d\n", len, rval);
 
-	if (debuglevelDriver >= DBG_VERBOSE && rval > 0)
+	if (DBG_ENABLED(debuglevelDriver, DBG_VERBOSE) && rval > 0)
 	{
 		DRIVER_NOISY("EXITING READ: ");
 		dump_raw_data(buf, rval);
@@ -695,6 +971,87 @@ int serial_read_raw(int fd, unsigned char *buf, int len)
 	return rval;
 }
 
+// Gli ultimi len caratteri scritti nel ring, uno o due pezzi
+static void serial_capture_ring(int fd, t_ringbuf *rb, int len)
+{
+	uint32_t off = (rb->head - len) & rb->mask;
+	struct iovec iov[2];
+
+	iov[0].iov_base = rb->data + off;
+	iov[0].iov_len = rb->size - off < (uint32_t) len ? rb->size - off : (uint32_t) len;
+	iov[1].iov_base = rb->data;
+	iov[1].iov_len = len - iov[0].iov_len;
+	capture_iov(fd, CAPTURE_RX, iov, 2, len);
+}
+
+/*
+ * Come serial_read_raw_until() ma i caratteri finiscono nel ring di
+ * ricezione della porta: ogni risveglio svuota con una sola readv()
+ * tutto quello che c'e', anche oltre len, cosi' il frame successivo e'
+ * gia' pronto senza altre chiamate di sistema.
+ * Restituisce quanti dei len caratteri richiesti sono nel ring.
+ */
+int serial_read_ring_until(int fd, t_ringbuf *rb, int len, int64_t deadline)
+{
+	t_transport_stats *st = transport_counters(fd);
+	int retval;
+	int rval;
+
+	DRIVER_NOISY("Enter\n");
+
+	if (fd < 0)
+	{
+		DRIVER_ERROR("Serial File Handler not ready\n");
+		return -ECERR_IO;
+	}
+
+	if (rb == NULL || len < 0 || (uint32_t) len > rb->size)
+	{
+		DRIVER_ERROR("BAD PARAMETER\n");
+		return -ECERR_BADPARAM;
+	}
+
+	while ((int) ringbuf_used(rb) < len)
+	{
+		rval = serial_wait_until(fd, deadline);
+		if (rval < 0)
+			return rval;
+		if (rval == 0)
+		{
+			DRIVER_NOISY("TIMEOUT REACHED!\n");
+			break;
+		}
+		// Il ring legge direttamente con la readv() del trasporto
+		retval = ringbuf_fill_fd(rb, fd, transport_of(fd)->readv);
+		DRIVER_NOISY("readv() RETURNS: %d - IN RING: %u\n", retval, ringbuf_used(rb));
+		st->reads++;
+		if (retval < 0)
+		{
+			// Questo e' un errore! Deve pensarci il chiamante!
+			return retval;
+		}
+		st->rx_bytes += retval;
+		if (capture_active() && retval > 0)
+			serial_capture_ring(fd, rb, retval);
+	}
+
+	rval = ringbuf_used(rb);
+	if (rval > len)
+		rval = len;
+	DRIVER_NOISY("Exit with: %d\n", rval);
+	return rval;
+}
+
+int serial_read_raw(int fd, unsigned char *buf, int len)
+{
+	/*
+	 * Stiamo in attesa di avere dei dati su seriale...
+	 * Diciamo almeno 4 secondi, piu' il tempo di trasmissione
+	 * dei caratteri richiesti.
+	 */
+	return serial_read_raw_until(fd, buf, len, serial_transfer_deadline(fd, len, 4000));
+}
+
 
 int serial_send_raw(int fd, const unsigned char *string, int len)
 {
@@ -726,12 +1083,56 @@ void serial_flush_rx(int serfd)
 {
 	DRIVER_NOISY("Serial Flush INPUT\n");
 	if (serfd >= 0)
-		tcflush(serfd, TCIFLUSH);
+		transport_of(serfd)->flush_rx(serfd);
 }
 
 void serial_flush_tx(int serfd)
 {
 	DRIVER_NOISY("Serial Flush OUTPUT\n");
 	if (serfd >= 0)
-		tcflush(serfd, TCOFLUSH);
+		transport_of(serfd)->flush_tx(serfd);
+}
+
+static void tty_flush_rx(int fd)
+{
+	tcflush(fd, TCIFLUSH);
+}
+
+static void tty_flush_tx(int fd)
+{
+	tcflush(fd, TCOFLUSH);
 }
+
+/*
+ * Seriale vera e pseudo terminale: stesso percorso termios, cambia
+ * solo l'apertura (il pty crea la coppia, vedi vlink.c)
+ */
+const t_transport_ops transport_tty = {
+	.name = "tty",
+	.prefix = NULL,
+	.open = tty_open,
+	.reset = tty_reset,
+	.get_baudrate = tty_get_baudrate,
+	.readv = transport_fd_readv,
+	.writev = transport_fd_writev,
+	.wait = transport_fd_wait,
+	.send_break = tty_send_break,
+	.flush_rx = tty_flush_rx,
+	.flush_tx = tty_flush_tx,
+	.stats = tty_stats,
+};
+
+const t_transport_ops transport_pty = {
+	.name = "pty",
+	.prefix = VLINK_PTY,
+	.open = vlink_open,
+	.reset = tty_reset,
+	.get_baudrate = tty_get_baudrate,
+	.readv = transport_fd_readv,
+	.writev = transport_fd_writev,
+	.wait = transport_fd_wait,
+	.send_break = tty_send_break,
+	.flush_rx = tty_flush_rx,
+	.flush_tx = tty_flush_tx,
+	.stats = tty_stats,
+};
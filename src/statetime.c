@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "statetime.h"
+#include "ec_types.h"
+#include "debug.h"
+
+DBG_MODULE(debuglevelDriver, "statetime", DBG_ERROR)
+
+static t_statetime table[STATETIME_MAX];
+static int table_used = 0;
+
+unsigned int statetime_requests = 0;
+
+t_statetime *statetime_attach(int fd, const char *name, int nstates, const char *const names[])
+{
+	t_statetime *st;
+	int n = table_used;
+
+	if (n >= STATETIME_MAX)
+	{
+		DRIVER_ERROR("No room for the state times of FD %d\n", fd);
+		return NULL;
+	}
+
+	st = &table[n];
+	memset(st, 0, sizeof(t_statetime));
+	st->time = calloc(nstates, sizeof(t_histogram));
+	st->transitions = calloc(nstates * nstates, sizeof(uint64_t));
+	if (st->time == NULL || st->transitions == NULL)
+	{
+		DRIVER_ERROR("Out of memory for the state times of FD %d\n", fd);
+		free(st->time);
+		free(st->transitions);
+		return NULL;
+	}
+	st->fd = fd;
+	snprintf(st->name, sizeof(st->name), "%s", name);
+	st->nstates = nstates;
+	st->names = names;
+	st->start = statetime_now();
+	st->seen = __atomic_load_n(&statetime_requests, __ATOMIC_RELAXED);
+	__atomic_store_n(&table_used, n + 1, __ATOMIC_RELEASE);
+	DRIVER_NOISY("FD %d state times in slot %d as %s, %d states\n", fd, n, st->name, nstates);
+	return st;
+}
+
+t_statetime *statetime_of(int fd)
+{
+	int i, n = __atomic_load_n(&table_used, __ATOMIC_ACQUIRE);
+
+	for (i = 0; i < n; i++)
+	{
+		if (table[i].fd == fd)
+			return &table[i];
+	}
+	return NULL;
+}
+
+void statetime_request(void)
+{
+	__atomic_fetch_add(&statetime_requests, 1, __ATOMIC_RELAXED);
+}
+
+void statetime_print(const t_statetime *st)
+{
+	const t_histogram *h;
+	double elapsed = statetime_now() - st->start;
+	uint64_t n;
+	char line[1024];
+	int i, j, len;
+
+	printR("%s FD %d: %-40s %9s %11s %6s %8s %8s %8s %8s\n", st->name, st->fd,
+		"STATE TIME (us)", "PASSES", "TOTAL(ms)", "SHARE", "P50", "P90", "P99", "MAX");
+	for (i = 0; i < st->nstates; i++)
+	{
+		h = &st->time[i];
+		if (h->count == 0)
+			continue;
+		printR("%s FD %d: %-40s %9llu %11.1f %5.1f%% %8llu %8llu %8llu %8llu\n", st->name, st->fd,
+			st->names[i], (unsigned long long) h->count, h->sum / 1000.0,
+			elapsed > 0 ? 100.0 * h->sum / elapsed : 0.0,
+			(unsigned long long) hist_percentile(h, 50),
+			(unsigned long long) hist_percentile(h, 90),
+			(unsigned long long) hist_percentile(h, 99),
+			(unsigned long long) h->max);
+	}
+	// Una riga per stato di partenza con le transizioni avvenute
+	for (i = 0; i < st->nstates; i++)
+	{
+		len = 0;
+		for (j = 0; j < st->nstates; j++)
+		{
+			n = st->transitions[i * st->nstates + j];
+			if (n == 0 || len >= (int) sizeof(line))
+				continue;
+			len += snprintf(line + len, sizeof(line) - len, "%s%s %llu",
+				len ? ", " : "", st->names[j], (unsigned long long) n);
+		}
+		if (len > 0)
+			printR("%s FD %d: %s -> %s\n", st->name, st->fd, st->names[i], line);
+	}
+}
+
+void statetime_print_all(void)
+{
+	int i, n = __atomic_load_n(&table_used, __ATOMIC_ACQUIRE);
+
+	for (i = 0; i < n; i++)
+		statetime_print(&table[i]);
+}
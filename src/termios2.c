@@ -0,0 +1,37 @@
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <asm/termbits.h>
+#include "termios2.h"
+#include "ec_types.h"
+
+int serial_termios2_set_speed(int fd, int baudrate)
+{
+	struct termios2 term;
+
+	if (fd < 0 || baudrate <= 0)
+		return -ECERR_BADPARAM;
+
+	if (ioctl(fd, TCGETS2, &term) < 0)
+		return -errno;
+
+	term.c_cflag &= ~(CBAUD | (CBAUD << IBSHIFT));
+	term.c_cflag |= BOTHER | (BOTHER << IBSHIFT);
+	term.c_ispeed = baudrate;
+	term.c_ospeed = baudrate;
+
+	if (ioctl(fd, TCSETS2, &term) < 0)
+		return -errno;
+	return 0;
+}
+
+int serial_termios2_get_speed(int fd)
+{
+	struct termios2 term;
+
+	if (fd < 0)
+		return -ECERR_BADPARAM;
+
+	if (ioctl(fd, TCGETS2, &term) < 0)
+		return -errno;
+	return (int) term.c_ospeed;
+}
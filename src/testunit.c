@@ -30,14 +30,17 @@
 #include <ctype.h>
 #include <errno.h>
 #include <signal.h>
+#include <semaphore.h>
 #include <linux/serial.h>
 #include <sys/types.h>
 #include <pthread.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <stdbool.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/utsname.h>
 #include <inttypes.h>
 #include <fcntl.h>
 /* Include definition for RS485 ioctls: TIOCGRS485 and TIOCSRS485 */
@@ -45,16 +48,69 @@
 #include <errno.h>
 #include <termios.h>
 #include "serial.h"
+#include "protocol.h"
+#include "window.h"
+#include "crc32.h"
+#include "resync.h"
+#include "portstats.h"
+#include "bench.h"
+#include "results.h"
+#include "statetime.h"
+#include "capture.h"
+#include "replay.h"
+#include "engine.h"
+#include "multiport.h"
+#include "hexdump.h"
 #include "debug.h"
 #include "ec_types.h"
 
-static int debuglevel = DBG_INFO;
-static int debuglevelThread = DBG_INFO;
-static int errornumbersMain = 0;
-static int errornumbersThread = 0;
+DBG_MODULE(debuglevel, "main", DBG_INFO)
+DBG_MODULE(debuglevelThread, "thread", DBG_INFO)
 
 #define TIMER_TICK        (50 * 1000L) /* 50msec TIMER RESOLUTION */
 
+// Pausa tra uno stato e l'altro. Di default nessuna: la macchina a stati
+// avanza appena l'I/O e' completato e aspetta solo sull'I/O stesso.
+// Con -p (o -t) si torna alla vecchia modalita' cadenzata.
+static long timer_tick = 0;
+
+// Modalita' a finestra (-w): frame in pipeline con ACK cumulativi invece
+// dello stop-and-wait con l'eco. 0 = stop-and-wait.
+static int window_size = 0;
+
+// Controllo di integrita' (-c): CRC in coda al frame e solo ACK/NAK
+// come risposta invece dell'eco di tutto il pacchetto
+static t_crc_type checksum = CRC_NONE;
+// Payload PRBS (-P 7|15|31) verificato bit per bit al volo, invece di str
+static t_prbs_type prbs_payload = PRBS_NONE;
+// Secondi tra due stampe delle statistiche, 0: nessun monitor (-m)
+static long monitor_period = 0;
+// Secondi per ogni passo del benchmark, 0: test normale (-b)
+static int bench_seconds = 0;
+static const int bench_payloads[] = { 16, 64, 256, 1024, 4096 };
+// Ripetizioni di ogni passo e secondi di riscaldamento scartati (-r, -W)
+static int bench_repeats = 1;
+static int bench_warmup = 0;
+// File dei risultati (-o) e soglia in % del confronto (-T)
+static const char *results_path = NULL;
+static double compare_threshold = 5.0;
+static t_results results;
+// Cattura del traffico (-k FILE, -K MB) e replay (-R FILE, -S tempi originali)
+static const char *capture_path = NULL;
+static long capture_mb = 16;
+static int64_t run_start_ms;
+// Prova di molte porte da file (-f FILE), worker che le aprono (-j N), durata (-D SECS)
+static const char *multiport_path = NULL;
+static int multiport_workers = MULTIPORT_WORKERS;
+static int multiport_seconds = 0;
+// SIGINT/SIGTERM: il gestore salva il segnale e sveglia signal_pthread()
+static volatile sig_atomic_t signal_caught = 0;
+static sem_t signal_sem;
+#define TRAILER_LEN  (checksum != CRC_NONE ? sizeof(t_trailer) : 0)
+
+// Un indice oltre la tabella e' direttamente la velocita' (anche non standard)
+#define BAUDRATE_MIN  1200
+
 #define TIMEOUT_THREAD_MS    (1000)
 #define TIMEOUT_MAIN_MS      (5000)
 
@@ -66,72 +122,6 @@ static int errornumbersThread = 0;
 #define HOUR(a)       (MIN(a * 60))
 #define DAY(a)        (HOUR(a * 24))
 
-static pthread_mutex_t mutexLock;
-
-//
-// Definizioni degli stati
-//
-typedef enum {
-	STATE_START = 0,
-
-	// SLAVE STATES
-	STATE_WAIT_COMMAND,
-	STATE_COMMAND_RECEIVED,
-	STATE_SEND_COMMAND_ACK,
-	STATE_WAIT_SERIAL_PACKET_SIGNATURE,
-	STATE_READ_SERIAL_PACKET,
-	STATE_WRITE_SERIAL_PACKET_ACK,
-	STATE_WRITE_SERIAL_PACKET_SIGNATURE_SLAVE,
-
-	// MASTER STATES
-	STATE_SEND_COMMAND,
-	STATE_SEND_BREAK,
-	STATE_WAIT_COMMAND_ACK,
-	STATE_WRITE_SERIAL_PACKET,
-	STATE_WAIT_SERIAL_PACKET_ACK,
-	STATE_WRITE_SERIAL_PACKET_SIGNATURE_MASTER,
-	STATE_WAIT_SERIAL_PACKET_ACK_SIGNATURE,
-
-	// ISSUE STATES
-	STATE_RESET_SERIAL,
-	STATE_RESET,
-	STATE_LAST, // Deve essere l'ultimo!
-} t_state;
-
-static const char *state_name[] = {
-	[STATE_START] = "STATE_START",
-
-	// SLAVE STATES
-	[STATE_WAIT_COMMAND] = "STATE_WAIT_COMMAND",
-	[STATE_COMMAND_RECEIVED] = "STATE_COMMAND_RECEIVED",
-	[STATE_READ_SERIAL_PACKET] = "STATE_READ_SERIAL_PACKET",
-	[STATE_WAIT_SERIAL_PACKET_SIGNATURE] = "STATE_WAIT_SERIAL_PACKET_SIGNATURE",
-	[STATE_WRITE_SERIAL_PACKET_SIGNATURE_SLAVE] = "STATE_WRITE_SERIAL_PACKET_SIGNATURE_SLAVE",
-	[STATE_WRITE_SERIAL_PACKET_ACK] = "STATE_WRITE_SERIAL_PACKET_ACK",
-	[STATE_SEND_COMMAND_ACK] = "STATE_SEND_COMMAND_ACK",
-
-	// MASTER STATES
-	[STATE_SEND_COMMAND] = "STATE_SEND_COMMAND",
-	[STATE_SEND_BREAK] = "STATE_SEND_BREAK",
-	[STATE_WAIT_COMMAND_ACK] = "STATE_WAIT_COMMAND_ACK",
-	[STATE_WRITE_SERIAL_PACKET] = "STATE_WRITE_SERIAL_PACKET",
-	[STATE_WRITE_SERIAL_PACKET_SIGNATURE_MASTER] = "STATE_WRITE_SERIAL_PACKET_SIGNATURE_MASTER",
-	[STATE_WAIT_SERIAL_PACKET_ACK] = "STATE_WAIT_SERIAL_PACKET_ACK",
-	[STATE_WAIT_SERIAL_PACKET_ACK_SIGNATURE] = "STATE_WAIT_SERIAL_PACKET_ACK_SIGNATURE",
-
-	[STATE_RESET_SERIAL] = "STATE_RESET_SERIAL",
-	[STATE_RESET] = "STATE_RESET",
-	[STATE_LAST] = "STATE_LAST",
-};
-
-#define SERIAL_SIGNATURE_HEADER  0x12345678
-#define SERIAL_SIGNATURE_FOOTER  0xdeadbeef
-typedef struct {
-	uint32_t header;
-	uint32_t len;
-	uint32_t footer;
-} t_signature;
-
 typedef struct {
 	int fd;
 	int baudrate;
@@ -139,70 +129,9 @@ typedef struct {
 	int post;
 } t_port;
 
-#define BUFFER_SIZE (4096)
-
-static void print_hex_ascii_line(const unsigned char *payload, int len, int offset)
-{
-	int i;
-	int gap;
-	const unsigned char *ch;
-
-	// offset
-	printR("%05x   ", offset);
-
-	// hex
-	ch = payload;
-	for (i = 0; i < len; i++)
-	{
-		printR("%02x ", *ch);
-		ch++;
-		// print extra space after 8th byte for visual aid
-		if (i == 7)
-			printR(" ");
-	}
-	// print space to handle line less than 8 bytes
-	if (len < 8)
-	{
-		printR(" ");
-	}
-
-	// fill hex gap with spaces if not full line
-	if (len < 16)
-	{
-		gap = 16 - len;
-		for (i = 0; i < gap; i++)
-		{
-			printR("   ");
-		}
-	}
-	printR("   ");
-
-	// ascii (if printable)
-	ch = payload;
-	for(i = 0; i < len; i++)
-	{
-		if (isprint(*ch))
-		{
-			printR("%c", *ch);
-		}
-		else
-		{
-			printR(".");
-		}
-		ch++;
-	}
-	printR("\n");
-}
-
 // print packet payload data (avoid printing binary data)
 void print_payload(const char *func, const unsigned char *payload, int len, int dbglvl)
 {
-	int len_rem = len;
-	int line_width = 16;           // number of bytes per line
-	int line_len;
-	int offset = 0;                // zero-based offset counter
-	const unsigned char *ch = payload;
-
 	// Stampiamo il payload se siamo >= DBG_VERBOSE oppure
 	// in errore.
 	if ((dbglvl >= DBG_VERBOSE) || (dbglvl == DBG_ERROR))
@@ -214,104 +143,11 @@ void print_payload(const char *func, const unsigned char *payload, int len, int
 			printR("No LEN. Exit\n");
 			return;
 		}
-
-		// data fits on one line
-		if (len <= line_width)
-		{
-			print_hex_ascii_line(ch, len, offset);
-			printR("Small Line. Exiting\n");
-			return;
-		}
-
-		// data spans multiple lines
-		for (;;)
-		{
-			// compute current line length
-			line_len = line_width % len_rem;
-			// print line
-			print_hex_ascii_line(ch, line_len, offset);
-			// compute total remaining
-			len_rem = len_rem - line_len;
-			// shift pointer to remaining bytes to print
-			ch = ch + line_len;
-			// add offset
-			offset = offset + line_width;
-			// check if we have line width chars or less
-			if (len_rem <= line_width)
-			{
-				// print last line and get out
-				print_hex_ascii_line(ch, len_rem, offset);
-				break;
-			}
-		}
+		hexdump(payload, len);
 		printR("Exit\n");
 	}
 }
 
-static inline void fill(unsigned char *buf, const char *str, size_t len, int times)
-{
-	int z;
-	for (z = 0; z < times; z++)
-	{
-		memcpy((char *) buf, (char *) str, len);
-		buf += len;
-	}
-}
-
-static const char *str = "0123456789ABCDEFABCDEFGHIJKLMNOPQRSTUVWXYZ[]=-,.";
-
-static inline int bufferlen(int baudrate)
-{
-	int rval;
-
-	// La regola e' piu' andiamo veloci piu' scriviamo (potrebbe essere anche l'opposto)
-	switch (baudrate)
-	{
-		case 230400:
-			rval = 70;
-			break;
-		case 115200:
-			rval = 45;
-			break;
-		case 57600:
-			rval = 42;
-			break;
-		case 38400:
-			rval = 40;
-			break;
-		case 19200:
-			rval = 38;
-			break;
-		case 9600:
-			rval = 35;
-			break;
-		case 4800:
-			rval = 30;
-			break;
-		case 2400:
-			rval = 20;
-			break;
-		default:
-		case 1200:
-			rval = 10;
-			break;
-	}
-	return rval;
-}
-
-static inline void fillbuffer(unsigned char *buf, size_t len, int baudrate)
-{
-	int l = strlen(str);
-	(void) len; // Avoid GCC warning
-
-	// Questa funzione essendo chiamata da entrambi i thread, e' meglio
-	// controllarla tramite il mutex
-	pthread_mutex_lock(&mutexLock);
-	fill(buf, str, l, bufferlen(baudrate));
-	pthread_mutex_unlock(&mutexLock);
-	//print_hex_ascii_line(buf,strlen( (const char *) buf), 0);
-}
-
 static void *break_pthread(void *data)
 {
 	int * ptr = (int *) data;
@@ -343,627 +179,15 @@ static void *break_pthread(void *data)
 		}
 		else
 		{
+			portstats_break_sent(serial[idx]);
 			THREAD_PRINT("*** Sending BREAK signal to Port %d FH: %d ***\n",
 				idx, serial[idx]);
 		}
 	}
 
-outBreakThread:
-	// cleanup
-	THREAD_NOISY("Exit\n");
-	return NULL;
-}
-
-static void *serial_2_pthread(void *data)
-{
-	t_port port = *((t_port *) data);
-	int serfd = port.fd;
-	int baudrate2 = port.baudrate;
-
-	t_state state = STATE_RESET;
-	t_state state_next = STATE_LAST;
-	unsigned char sbufferread[BUFFER_SIZE];
-	unsigned char sbufferwrite[BUFFER_SIZE];
-	long timeout = TIMEOUT_THREAD_MS;
-	int rval = 0;
-	int pre, post;
-	t_signature signatureread;
-	signatureread.header = SERIAL_SIGNATURE_HEADER;
-	signatureread.footer = SERIAL_SIGNATURE_FOOTER;
-	signatureread.len = 0;
-
-	t_signature signaturewrite;
-	signaturewrite.header = SERIAL_SIGNATURE_HEADER;
-	signaturewrite.footer = SERIAL_SIGNATURE_FOOTER;
-	signaturewrite.len = 0;
-
-	int goodpackettx = 0;
-	int goodpacketrx = 0;
-
-	pre = port.pre;
-	post = port.post;
-
-	THREAD_PRINT("Enter: Port: fd: %d - BaudRate: %d PRE: %d - POST: %d\n",
-		serfd, baudrate2, pre, post);
-
-	for (;;)
-	{
-		switch (state)
-		{
-			case STATE_START:
-				THREAD_NOISY("STATE_START\n");
-				serial_flush_rx(serfd);
-				serial_flush_tx(serfd);
-				state_next = STATE_WAIT_COMMAND;
-				break;
-
-			// SLAVE STATES
-			case STATE_WAIT_COMMAND:
-				// Ci sono caratteri da leggere entro 15 secondi!
-				// i 15 secondi possono aumentare o diminuire a seconda
-				// del livello raggiunto dal test
-				rval = serial_read_string(serfd, sbufferread, timeout);
-				if (rval < 0)
-				{
-					if (errno != EAGAIN && errno != EINTR)
-					{
-						THREAD_ERROR("Error on WAITING COMMAND\n");
-						state_next = STATE_RESET;
-					}
-					// Se siamo stati interrotti ci riproviamo
-				}
-				else
-				{
-					if (rval == 0)
-					{
-						THREAD_NOISY("Nothing to read within %ld msecs\n", timeout);
-						THREAD_VERBOSE("\t\t*** NOW SEND BREAK ***\n");
-						state_next = STATE_SEND_BREAK;
-					}
-					else
-					{
-						THREAD_NOISY("Read %d from serial.\n", rval);
-						state_next = STATE_COMMAND_RECEIVED;
-					}
-				}
-				break;
-
-			case STATE_SEND_BREAK:
-				rval = serial_send_break(serfd);
-				if (rval < 0)
-				{
-					if (errno != EAGAIN && errno != EINTR)
-					{
-						THREAD_ERROR("Error on SENDING BREAK COMMAND\n");
-						state_next = STATE_RESET;
-					}
-					// Se siamo stati interrotti ci riproviamo
-				}
-				else
-				{
-					if (rval == 0)
-					{
-						THREAD_VERBOSE("\t\t*** NOW MASTER ***\n");
-						state_next = STATE_SEND_COMMAND;
-					}
-					else
-					{
-						THREAD_ERROR("SEND BREAK - IS THIS A BUG??? rval: %d\n", rval);
-						state_next = STATE_RESET;
-					}
-				}
-				break;
-
-			case STATE_COMMAND_RECEIVED:
-				THREAD_NOISY("STATE_COMMAND_RECEIVED\n");
-				if (strcmp("DOSLAVE\r\n", (const char *) sbufferread) == 0)
-				{
-					THREAD_NOISY("DO SLAVE RECEIVED. SENDING ACK\n");
-					state_next = STATE_SEND_COMMAND_ACK;
-				}
-				else
-				{
-					// Ho ricevuto caratteri spuri. E' un problema, ritorno
-					// allo stato di MASTER...
-					THREAD_NOISY("UNKNOWN COMMAND / JUNK RECEIVED\n");
-					THREAD_VERBOSE("\t\t*** NOW MASTER ***\n");
-					serial_device_status(serfd);
-					state_next = STATE_SEND_COMMAND;
-				}
-				break;
-
-			case STATE_SEND_COMMAND_ACK:
-				THREAD_NOISY("SENDING DOSLAVE CMD ACK\n");
-				rval = serial_send_string(serfd, (const unsigned char *) "DOSLAVECMDACK\r\n");
-				if (rval < 0)
-				{
-					if (errno != EAGAIN && errno != EINTR)
-					{
-						THREAD_ERROR("Error on SEND COMMAND ACK\n");
-						state_next = STATE_RESET;
-						errornumbersThread++;
-					}
-				}
-				else
-				{
-					if (rval == 0)
-					{
-						THREAD_VERBOSE("*** STATE_SEND_COMMAND_ACK NOT SENDING? Retry ***\n");
-					}
-					else
-					{
-						THREAD_NOISY("Switching STATE_WAIT_SERIAL_PACKET_SIGNATURE FROM MASTER\n");
-						state_next = STATE_WAIT_SERIAL_PACKET_SIGNATURE;
-					}
-				}
-				break;
-
-			case STATE_WAIT_SERIAL_PACKET_SIGNATURE:
-				rval = serial_read_raw(serfd, (unsigned char *) &signatureread, sizeof(t_signature));
-				if (rval < 0)
-				{
-					if (errno != EAGAIN && errno != EINTR)
-					{
-						THREAD_ERROR("Error on WAIT SERIAL PACKET SIGNATURE\n");
-						state_next = STATE_RESET;
-						errornumbersThread++;
-					}
-				}
-				else
-				{
-					if (rval == 0)
-					{
-						THREAD_NOISY("*** NOTHING TO READ/SIGNATURE ***\n");
-						state_next = STATE_RESET;
-					}
-					else
-					{
-						DBG_N("SIGNATURE PACKET RECIVED FROM MASTER\n");
-						if (rval != sizeof(t_signature))
-						{
-							THREAD_ERROR("RVAL: %d -- BAD SIGNATURE STATE_WAIT_SERIAL_PACKET_SIGNATURE:"
-									"\n\tHEADER: 0x%08x\n\tLEN: 0x%08x\n\tFOOTER: 0x%08x\n",
-								rval, signatureread.header, signatureread.len, signatureread.footer);
-							serial_device_status(serfd);
-							state_next = STATE_RESET;
-							errornumbersThread++;
-						}
-						else
-						{
-							THREAD_NOISY("STATE_WAIT_SERIAL_PACKET_SIGNATURE:"
-									"\n\tHEADER: 0x%08x\n\tLEN: 0x%08x\n\tFOOTER: 0x%08x\n",
-								signatureread.header, signatureread.len, signatureread.footer);
-							state_next = STATE_READ_SERIAL_PACKET;
-						}
-					}
-				}
-				break;
-
-			case STATE_READ_SERIAL_PACKET:
-				THREAD_NOISY("STATE_READ_SERIAL_PACKET\n");
-				// Verifichiamo la validita' della signature ricevuta.
-				// Dobbiamo metterci il meno possibile perche' i dati
-				// stanno arrivando dalla seriale. E tra la lettura della
-				// firma ad adesso ho gia' perso almeno 12 millisecondi
-				// che e' il TIMER_TICK
-				if (signatureread.header == SERIAL_SIGNATURE_HEADER &&
-					signatureread.footer == SERIAL_SIGNATURE_FOOTER)
-				{
-					// La firma ricevuta va bene, leggiamo tutto il contenuto
-					// del pacchetto
-					rval = serial_read_raw(serfd, sbufferread, signatureread.len);
-					if (rval < 0)
-					{
-						if (errno != EAGAIN && errno != EINTR)
-						{
-							THREAD_ERROR("Error on STATE_READ_SERIAL_PACKET\n");
-							state_next = STATE_RESET;
-							errornumbersThread++;
-						}
-					}
-					else
-					{
-						if (rval == 0)
-						{
-							THREAD_NOISY("*** NOTHING TO READ ***\n");
-							state_next = STATE_RESET;
-						}
-						else
-						{
-							THREAD_NOISY("STATE_READ_SERIAL_PACKET FROM MASTER\n\tRead: %d -- To Read: %d\n", rval, signatureread.len);
-							if (rval != (int) signatureread.len)
-							{
-								THREAD_ERROR("BAD STATE_READ_SERIAL_PACKET LEN\n");
-								serial_device_status(serfd);
-								state_next = STATE_RESET;
-								errornumbersThread++;
-							}
-							else
-							{
-								// Adesso ho letto tutto, rispediamo la firma indietro
-								// e tutto il pacchetto al chiamante!
-								THREAD_NOISY("STATE_READ_SERIAL_PACKETREAD\n");
-								state_next = STATE_WRITE_SERIAL_PACKET_SIGNATURE_SLAVE;
-							}
-						}
-					}
-				}
-				else
-				{
-					THREAD_ERROR("STATE_READ_SERIAL_PACKET: BAD SIGNATURE RECEIVED\n");
-					serial_device_status(serfd);
-					state_next = STATE_RESET;
-					errornumbersThread++;
-				}
-				break;
-
-			case STATE_WRITE_SERIAL_PACKET_SIGNATURE_SLAVE:
-				THREAD_NOISY("STATE_WRITE_SERIAL_PACKET_SIGNATURE\n");
-				signaturewrite.header = signatureread.header;
-				signaturewrite.len = signatureread.len;
-				signaturewrite.footer = signatureread.footer;
-				rval = serial_send_raw(serfd, (const unsigned char *) &signaturewrite, sizeof(t_signature));
-				if (rval < 0)
-				{
-					if (errno != EAGAIN && errno != EINTR)
-					{
-						THREAD_ERROR("STATE_WRITE_SERIAL_PACKET_SIGNATURE ERROR\n");
-						state_next = STATE_RESET;
-						errornumbersThread++;
-					}
-				}
-				else
-				{
-					switch (rval)
-					{
-						case 0:
-							THREAD_NOISY("STATE_WRITE_SERIAL_PACKET_SIGNATURE NOT WRITE. RETRY\n");
-							break;
-
-						case sizeof(t_signature):
-							// Ho scritto la firma, adesso il prima possibile
-							// scrivo tutto il resto!
-							THREAD_NOISY("STATE_WRITE_SERIAL_PACKET_SIGNATURE OK\n");
-							state_next = STATE_WRITE_SERIAL_PACKET_ACK;
-							break;
-
-						default:
-							THREAD_ERROR("STATE_WRITE_SERIAL_PACKET_SIGNATURE not writing everything: %d\n",
-								rval);
-							state_next = STATE_RESET;
-							errornumbersThread++;
-							break;
-					}
-				}
-				break;
-
-			case STATE_WRITE_SERIAL_PACKET_ACK:
-				// Il messaggio di risposta al pacchetto ricevuto,
-				// e' lo stesso pacchetto...
-				THREAD_NOISY("STATE_WRITE_SERIAL_PACKET_ACK --- SAME PACKET BACK!\n");
-				memcpy(sbufferwrite, sbufferread, signatureread.len);
-				rval = serial_send_raw(serfd, sbufferwrite, signatureread.len);
-				if (rval < 0)
-				{
-					if (errno != EAGAIN && errno != EINTR)
-					{
-						THREAD_ERROR("Error on WRITING SERIAL PACKET ACK\n");
-						state_next = STATE_RESET;
-						errornumbersThread++;
-					}
-				}
-				else
-				{
-					if (rval == 0)
-					{
-						THREAD_ERROR("*** NOT WRITING - Retry ***\n");
-					}
-					else
-					{
-						THREAD_PRINT("SENT PACKET ACK FROM SLAVE OK: %d\n", goodpacketrx++);
-						state_next = STATE_WAIT_SERIAL_PACKET_SIGNATURE;
-					}
-				}
-				break;
-
-			// MASTER STATES
-			case STATE_SEND_COMMAND:
-				THREAD_NOISY("STATE_SEND_COMMAND\n");
-				rval = serial_send_string(serfd, (const unsigned char *) "DOSLAVE\r\n");
-				if (rval < 0)
-				{
-					if (errno != EAGAIN && errno != EINTR)
-					{
-						THREAD_ERROR("Error on SEND COMMAND DO SLAVE r:%d -- e: %d\n", rval, errno);
-						state_next = STATE_RESET_SERIAL;
-						errornumbersThread++;
-					}
-				}
-				else
-				{
-					if (rval == 0)
-					{
-						THREAD_VERBOSE("Why NOT SENDING? Retry\n");
-					}
-					else
-					{
-						THREAD_NOISY("Switching to WAITING CMD ACK FROM SLAVE\n");
-						state_next = STATE_WAIT_COMMAND_ACK;
-					}
-				}
-				break;
-
-			case STATE_WAIT_COMMAND_ACK:
-				THREAD_NOISY("STATE_WAIT_COMMAND_ACK\n");
-				// se stiamo andando a 1200bps la stringa di 32 caratteri
-				// arriva in poco meno di 400 msec. mettiamoci anche
-				// un tempo di elaborazione di altri 400 msec. Totale: 800
-				rval = serial_read_string(serfd, sbufferread, 800);
-				if (rval < 0)
-				{
-					if (errno != EAGAIN && errno != EINTR)
-					{
-						THREAD_ERROR("Error on STATE_WAIT_COMMAND_ACK\n");
-						state_next = STATE_RESET;
-						errornumbersThread++;
-					}
-				}
-				else
-				{
-					if (rval == 0)
-					{
-						THREAD_VERBOSE("TIMEOUT ERROR. RESET\n");
-						state_next = STATE_RESET;
-						errornumbersThread++;
-					}
-					else
-					{
-						if (strcmp("DOSLAVECMDACK\r\n", (const char *) sbufferread) == 0)
-						{
-							THREAD_NOISY("DO SLAVE CMD ACKNOWLEDGED.\n");
-							state_next = STATE_WRITE_SERIAL_PACKET_SIGNATURE_MASTER;
-						}
-						else
-						{
-							THREAD_ERROR("GARBAGE/JUNK ON RECEIVING WAIT CMD ACK %s\n", sbufferread);
-							serial_device_status(serfd);
-							state_next = STATE_RESET;
-							errornumbersThread++;
-						}
-					}
-				}
-				break;
-
-			case STATE_WRITE_SERIAL_PACKET_SIGNATURE_MASTER:
-				// Prima di scrivere il pacchetto, occorre preparare la signature
-				// corretta...
-				signaturewrite.header = SERIAL_SIGNATURE_HEADER;
-				signaturewrite.footer = SERIAL_SIGNATURE_FOOTER;
-				signaturewrite.len = bufferlen(baudrate2);
-				THREAD_NOISY("STATE_WRITE_SERIAL_PACKET_SIGNATURE_MASTER:"
-					"\n\tHEADER: 0x%08x\n\tLEN: 0x%08x\n\tFOOTER: 0x%08x\n",
-					signaturewrite.header, signaturewrite.len, signaturewrite.footer);
-				rval = serial_send_raw(serfd, (const unsigned char *) &signaturewrite, sizeof(t_signature));
-				if (rval < 0)
-				{
-					if (errno != EINTR && errno != EAGAIN)
-					{
-						THREAD_ERROR("STATE_WRITE_SERIAL_PACKET_SIGNATURE! Unable to write data!\n");
-						state_next = STATE_RESET;
-						errornumbersThread++;
-					}
-				}
-				else
-				{
-					if (rval == 0)
-					{
-						THREAD_NOISY("Timeout STATE_WRITE_SERIAL_PACKET_SIGNATURE. Wait...\n");
-						// Retry
-					}
-					else
-					{
-						THREAD_NOISY("STATE_WRITE_SERIAL_PACKET_SIGNATURE OK\n");
-						state_next = STATE_WRITE_SERIAL_PACKET;
-					}
-				}
-				break;
-
-			case STATE_WRITE_SERIAL_PACKET:
-				THREAD_NOISY("STATE_WRITE_SERIAL_PACKET\n");
-				fillbuffer(sbufferwrite, sizeof(sbufferwrite), baudrate2);
-				rval = serial_send_raw(serfd, (const unsigned char *) sbufferwrite, signaturewrite.len);
-				if (rval < 0)
-				{
-					if (errno != EINTR && errno != EAGAIN)
-					{
-						THREAD_ERROR("STATE_WRITE_SERIAL_PACKET! Unable to write data!\n");
-						state_next = STATE_RESET;
-						errornumbersThread++;
-					}
-				}
-				else
-				{
-					if (rval == 0)
-					{
-						THREAD_NOISY("Timeout STATE_WRITE_SERIAL_PACKET. Wait...\n");
-						// Retry write
-					}
-					else
-					{
-						if (rval == (int) signaturewrite.len)
-						{
-							THREAD_NOISY("STATE_WRITE_SERIAL_PACKET OK.\n");
-							state_next = STATE_WAIT_SERIAL_PACKET_ACK_SIGNATURE;
-						}
-						else
-						{
-							THREAD_ERROR("STATE_WRITE_SERIAL_PACKET Error\n");
-							serial_device_status(serfd);
-							state_next = STATE_RESET;
-							errornumbersThread++;
-						}
-					}
-				}
-				break;
-
-			case STATE_WAIT_SERIAL_PACKET_ACK_SIGNATURE:
-				// Aspettiamo la firma dallo slave...
-				THREAD_NOISY("STATE_WAIT_SERIAL_PACKET_ACK_SIGNATURE\n");
-				rval = serial_read_raw(serfd, (unsigned char *) &signatureread, sizeof(t_signature));
-				if (rval < 0)
-				{
-					if (errno != EINTR || errno != EAGAIN)
-					{
-						THREAD_ERROR("STATE_WAIT_SERIAL_PACKET_ACK_SIGNATURE ERROR on reading!\n");
-						state_next = STATE_RESET;
-						errornumbersThread++;
-					}
-				}
-				else
-				{
-					if (rval == 0)
-					{
-						THREAD_ERROR("Timeout STATE_WAIT_SERIAL_PACKET_ACK_SIGNATURE. Check SLAVE\n");
-						serial_device_status(serfd);
-						state_next = STATE_RESET;
-						errornumbersThread++;
-					}
-					else
-					{
-						if (rval != sizeof(t_signature))
-						{
-							THREAD_ERROR("STATE_WAIT_SERIAL_PACKET_ACK_SIGNATURE ERROR\n");
-							state_next = STATE_RESET;
-							serial_device_status(serfd);
-							errornumbersThread++;
-						}
-						else
-						{
-							THREAD_NOISY("STATE_WAIT_SERIAL_PACKET_ACK_SIGNATURE OK\n");
-							state_next = STATE_WAIT_SERIAL_PACKET_ACK;
-						}
-					}
-				}
-				break;
-
-			case STATE_WAIT_SERIAL_PACKET_ACK:
-				THREAD_NOISY("STATE_WAIT_SERIAL_PACKET_ACK\n");
-				// Proseguiamo nella lettura del pacchetto solo
-				// se quello che abbiamo ricevuto ha l'header uguale
-				// a quello che abbiamo spedito
-				if (memcmp((unsigned char *) &signatureread, (unsigned char *) &signaturewrite, sizeof(t_signature)) == 0)
-				{
-					THREAD_NOISY("STATE_WAIT_SERIAL_PACKET_ACK SIGNATURE OK.\n");
-					rval = serial_read_raw(serfd, sbufferread, signatureread.len);
-					if (rval < 0)
-					{
-						if (errno != EAGAIN && errno != EINTR)
-						{
-							THREAD_ERROR("ERROR: STATE_WAIT_SERIAL_PACKET_ACK\n");
-							state_next = STATE_RESET;
-							errornumbersThread++;
-						}
-					}
-					else
-					{
-						if (rval == 0)
-						{
-							THREAD_ERROR("STATE_WAIT_SERIAL_PACKET_ACK TIMEOUT\n");
-							state_next = STATE_RESET;
-							errornumbersThread++;
-						}
-						else
-						{
-							if (rval == (int) signatureread.len)
-							{
-								// Abbiamo letto tutto il pacchetto,
-								// verifichiamo che sia corretto!
-								if (memcmp(sbufferread, sbufferwrite, signatureread.len) == 0)
-								{
-									goodpackettx++;
-									THREAD_PRINT("STATE_WAIT_SERIAL_PACKET_ACK Good Packet: %d\n", goodpackettx);
-									state_next = STATE_WRITE_SERIAL_PACKET_SIGNATURE_MASTER;
-								}
-								else
-								{
-									THREAD_ERROR("ERROR ON STATE_WAIT_SERIAL_PACKET_ACK\n");
-									state_next = STATE_RESET;
-									serial_device_status(serfd);
-									errornumbersThread++;
-								}
-							}
-							else
-							{
-								THREAD_ERROR("STATE_WAIT_SERIAL_PACKET_ACK ERROR ON READING PACKET\n");
-								state_next = STATE_RESET;
-								serial_device_status(serfd);
-								errornumbersThread++;
-							}
-						}
-					}
-				}
-				else
-				{
-					THREAD_ERROR("STATE_WAIT_SERIAL_PACKET_ACK WRONG SIGNATURE\n");
-					state_next = STATE_RESET;
-					errornumbersThread++;
-				} 
-				break;
-
-			// ISSUE STATES
-			case STATE_RESET_SERIAL:
-				THREAD_NOISY("STATE_RESET_SERIAL\n");
-				rval = serial_device_reset(serfd, baudrate2, pre, post);
-				if (rval < 0)
-				{
-					if (errno != EAGAIN && errno != EINTR)
-					{
-						THREAD_ERROR("STATE_RESET_SERIAL ERROR\n");
-						errornumbersThread++;
-						goto outThread;
-					}
-				}
-				else
-				{
-					THREAD_NOISY("PORT RESETTED TO DEFAULT\n");
-				}
-				state_next = STATE_RESET;
-				break;
-
-			case STATE_RESET:
-				// Ogni volta che c'e' un'errore riduco il tempo di
-				// attesa...
-				if (timeout > 1000) timeout -= 1000; else timeout = TIMEOUT_THREAD_MS;
-				memset(sbufferread, 0, sizeof(sbufferread));
-				memset(sbufferwrite, 0, sizeof(sbufferwrite));
-				memset(&signatureread, 0, sizeof(t_signature));
-				memset(&signaturewrite, 0, sizeof(t_signature));
-				state_next = STATE_START;
-				goodpacketrx = 0;
-				goodpackettx = 0;
-				break;
-
-			case STATE_LAST:
-				// Deve essere l'ultimo!
-				break;
-		}
-
-		if (state != state_next)
-		{
-			THREAD_NOISY("<LOOP> Changing state from %s to %s\n", state_name[state], state_name[state_next]);
-			state = state_next;
-		}
-		// Non consumiamo troppa CPU!!
-		usleep(TIMER_TICK);
-	}
-
-outThread:
-	// cleanup
-	THREAD_NOISY("Exit\n");
 	return NULL;
 }
 
-
 //static void timerstart(void)
 //{
 //	gettimeofday( &startTimer, NULL);
@@ -1002,41 +226,204 @@ static void banner(void)
 	fprintf(stdout, "\n\n");
 }
 
+/*
+ * Legge le statistiche senza lock: puo' girare in un altro thread mentre
+ * le porte lavorano
+ */
+static void print_portstats(void)
+{
+	t_portstats_counters c;
+	t_portstats *ps;
+	int i;
+
+	for (i = 0; (ps = portstats_at(i)) != NULL; i++)
+	{
+		portstats_read(ps, &c);
+		DBG_E("%s FD %d: frames tx %lu rx %lu - bytes tx %lu rx %lu - resets %lu - resyncs %lu (%lu bytes)"
+			" - breaks sent %lu seen %lu\n",
+			ps->name, ps->fd, c.frames_tx, c.frames_rx, c.bytes_tx, c.bytes_rx, c.resets,
+			c.resyncs, c.resync_bytes, c.breaks_sent, c.brk);
+		DBG_E("%s FD %d: errors %lu - io %lu timeout %lu short %lu signature %lu payload %lu command %lu\n",
+			ps->name, ps->fd, portstats_errors(&c),
+			c.errors[PORTSTATS_ERR_IO], c.errors[PORTSTATS_ERR_TIMEOUT], c.errors[PORTSTATS_ERR_SHORT],
+			c.errors[PORTSTATS_ERR_SIGNATURE], c.errors[PORTSTATS_ERR_PAYLOAD], c.errors[PORTSTATS_ERR_COMMAND]);
+		if (c.prbs_bits > 0 || c.prbs_losses > 0)
+			DBG_E("%s FD %d: %s bits %lu errors %lu BER %.3e - locks lost %lu\n",
+				ps->name, ps->fd, prbs_name(prbs_payload), c.prbs_bits, c.prbs_errors,
+				c.prbs_bits > 0 ? (double) c.prbs_errors / c.prbs_bits : 0.0, c.prbs_losses);
+		DBG_E("%s FD %d: line rx %lu tx %lu - frame %lu overrun %lu parity %lu buf_overrun %lu\n",
+			ps->name, ps->fd, c.line_rx, c.line_tx, c.frame, c.overrun, c.parity, c.buf_overrun);
+	}
+}
+
+/*
+ * Risultati leggibili da una macchina (-o): configurazione, contatori
+ * delle porte e metriche.
+ */
+static void results_setup(const char *program, const char *device1, const char *device2,
+	int baudrate1, int baudrate2, int low_latency)
+{
+	struct utsname un;
+
+	results_init(&results);
+	results_config(&results, "program", "%s", program);
+	results_config(&results, "version", "%s", fwBuild);
+	if (uname(&un) == 0)
+	{
+		results_config(&results, "host", "%s", un.nodename);
+		results_config(&results, "kernel", "%s", un.release);
+	}
+	results_config(&results, "device1", "%s", device1);
+	results_config(&results, "device2", "%s", device2);
+	results_config(&results, "baudrate1", "%d", baudrate1);
+	results_config(&results, "baudrate2", "%d", baudrate2);
+	results_config(&results, "mode", "%s",
+		bench_seconds > 0 ? "bench" : window_size > 0 ? "window" : "pingpong");
+	results_config(&results, "check", "%s", crc_name(checksum));
+	results_config(&results, "payload", "%s", prbs_name(prbs_payload));
+	results_config(&results, "window", "%d", window_size);
+	results_config(&results, "pace_ms", "%ld", timer_tick / 1000L);
+	results_config(&results, "low_latency", "%d", low_latency);
+	if (bench_seconds > 0)
+	{
+		results_config(&results, "step_seconds", "%d", bench_seconds);
+		results_config(&results, "repeats", "%d", bench_repeats);
+		results_config(&results, "warmup_seconds", "%d", bench_warmup);
+	}
+}
+
+static void save_results(void)
+{
+	t_portstats_counters c;
+	t_portstats_cnt value;
+	t_portstats *ps;
+	const char *name;
+	char port[16];
+	double secs;
+	int i, j;
+
+	if (results_path == NULL)
+		return;
+
+	if (bench_seconds == 0)
+	{
+		secs = (serial_now_ms() - run_start_ms) / 1000.0;
+		results_config(&results, "seconds", "%.1f", secs);
+		for (i = 0; (ps = portstats_at(i)) != NULL; i++)
+		{
+			portstats_read(ps, &c);
+			snprintf(port, sizeof(port), "port%d", i + 1);
+			for (j = 0; (name = portstats_field(&c, j, &value)) != NULL; j++)
+				results_counter(&results, port, name, value);
+			if (secs > 0)
+				results_sample(results_metric(&results, "B/s", RESULTS_HIGHER, "%s/goodput", port),
+					(c.bytes_tx + c.bytes_rx) / secs);
+			results_sample(results_metric(&results, "count", RESULTS_LOWER, "%s/errors", port),
+				portstats_errors(&c));
+			if (c.prbs_bits > 0)
+				results_sample(results_metric(&results, "ratio", RESULTS_LOWER, "%s/ber", port),
+					(double) c.prbs_errors / c.prbs_bits);
+			// Letto mentre la porta lavora: una fotografia approssimata
+			if (ps->recovery.count > 0)
+			{
+				results_sample(results_metric(&results, "us", RESULTS_LOWER, "%s/recovery_p50", port),
+					hist_percentile(&ps->recovery, 50));
+				results_sample(results_metric(&results, "us", RESULTS_LOWER, "%s/recovery_max", port),
+					ps->recovery.max);
+			}
+		}
+	}
+	if (results_write(&results, results_path) == 0)
+		DBG_I("Results written to %s\n", results_path);
+}
+
+static int compare_results(const char *base, const char *cand)
+{
+	static t_results b, c;
+
+	if (cand == NULL)
+	{
+		DBG_E("Compare mode needs the baseline and the candidate results file\n");
+		return -1;
+	}
+	if (results_load(&b, base) < 0 || results_load(&c, cand) < 0)
+		return -1;
+	DBG_I("Comparing %s (baseline) with %s\n", base, cand);
+	return results_compare(&b, &c, compare_threshold);
+}
+
+static void *monitor_pthread(void *data)
+{
+	(void) data;
+
+	for (;;)
+	{
+		sleep(monitor_period);
+		print_portstats();
+	}
+	return NULL;
+}
+
+/*
+ * Statistiche e risultati alla fine li stampa questo thread, svegliato
+ * dal gestore dei segnali: nel gestore il logger e stdio non si possono
+ * usare, il segnale puo' interrompere il thread a meta' di una scrittura
+ * nel suo ring.
+ */
+static void *signal_pthread(void *data)
+{
+	const char *signame;
+	int sig;
+
+	(void) data;
+	while (sem_wait(&signal_sem) < 0 && errno == EINTR)
+		;
+	sig = signal_caught;
+	switch (sig)
+	{
+		case SIGINT:  signame = "SIGINT"; break;
+		case SIGTERM: signame = "SIGTERM"; break;
+		default:      signame = "UNKNOWN"; break;
+	}
+	DBG_E("signal %s - %d caught\n", signame, sig);
+	print_portstats();
+	multiport_print();
+	statetime_print_all();
+	save_results();
+	exit(sig);
+	return NULL;
+}
+
 static void signal_handle(int sig)
 {
-	char signame[8];
+	static const char segv[] = "signal SIGSEGV caught\n";
+	ssize_t written;
 
 	switch( sig )
 	{
 		case SIGSEGV:
-			sprintf(signame, "SIGSEGV");
-			DBG_E("signal %s - %d caught\n", signame, sig);
-			break;
-		case SIGINT:
-			sprintf(signame, "SIGINT");
-			DBG_E("signal %s - %d caught\n", signame, sig);
-			DBG_E("ErrorMain %d - ErrorThread %d\n", errornumbersMain, errornumbersThread);
-			break;
-		case SIGTERM:
-			sprintf(signame, "SIGTERM");
-			DBG_E("signal %s - %d caught\n", signame, sig);
-			DBG_E("ErrorMain %d - ErrorThread %d\n", errornumbersMain, errornumbersThread);
-			pthread_mutex_lock(&mutexLock);
-			pthread_mutex_unlock(&mutexLock);
-			break;
-		case SIGUSR1:
-			return;
+			// Niente da salvare: il processo non puo' andare avanti
+			written = write(STDERR_FILENO, segv, sizeof(segv) - 1);
+			(void) written;
+			_exit(sig);
 			break; // NEVERREACHED
+		case SIGUSR1:
+			// Ogni porta stampa i suoi tempi per stato dal suo thread
+			statetime_request();
+			break;
 		case SIGUSR2:
-			return;
-			break; // NEVERREACHED
+			// I livelli di log li rilegge il thread del logger
+			log_levels_request();
+			break;
 		default:
-			sprintf(signame, "UNKNOWN");
-			DBG_E("signal %s - %d caught\n", signame, sig);
+			// Il primo vince, gli altri li ignoriamo
+			if (signal_caught == 0)
+			{
+				signal_caught = sig;
+				sem_post(&signal_sem);
+			}
 			break;
 	}
-	pthread_mutex_destroy(&mutexLock);
-	exit(sig);
 }
 
 static void version(const char * filename, const char *ver)
@@ -1056,71 +443,380 @@ static void version(const char * filename, const char *ver)
 	}
 }
 
+static void usage(const char *name)
+{
+	fprintf(stdout, "usage: %s [OPTIONS] [SERIAL 1] [SERIAL 2] [SPEED IDX 1] [SPEED IDX 2] "
+		"[DELAY RTS 1 BEFORE] [DELAY RTS 1 AFTER] [DELAY RTS 2 BEFORE] [DELAY RTS 2 AFTER]\n", name);
+	fprintf(stdout, "\tSERIAL can be a virtual link without hardware: pty, null, null:paced, unix[:PATH], tcp[:PORT]\n"
+		"\t(same name for both ports)\n");
+	fprintf(stdout, "\tSPEED IDX >= %d is the baud rate itself, any integer rate the driver accepts\n",
+		BAUDRATE_MIN);
+	fprintf(stdout, "\t-p       paced mode: sleep %ld msecs between states (old behaviour)\n",
+		TIMER_TICK / 1000L);
+	fprintf(stdout, "\t-t MSEC  paced mode: sleep MSEC msecs between states\n");
+	fprintf(stdout, "\t-w N     windowed mode: N frames in flight with cumulative ACKs\n");
+	fprintf(stdout, "\t-c TYPE  integrity check: echo (default), crc32, crc32c\n");
+	fprintf(stdout, "\t-P N     payload PRBS-N (7, 15, 31) checked bit by bit: bit error rate per port,\n"
+		"\t         stop-and-wait only\n");
+	fprintf(stdout, "\t-l       low latency profile: no O_FSYNC, ASYNC_LOW_LATENCY, usb-serial latency_timer 1 msec\n");
+	fprintf(stdout, "\t-s ROOT  sysfs root for the latency_timer (default /sys)\n");
+	fprintf(stdout, "\t-m SECS  print the per-port statistics every SECS seconds\n");
+	fprintf(stdout, "\t-b SECS  benchmark: round trip histogram and goodput per baud rate and payload size,\n"
+		"\t         SECS seconds each\n");
+	fprintf(stdout, "\t-r N     benchmark: run every step N times (mean and 95%% confidence interval)\n");
+	fprintf(stdout, "\t-W SECS  benchmark: SECS seconds of warm-up before every step, not counted\n");
+	fprintf(stdout, "\t-o FILE  write the results to FILE: JSON, CSV if FILE ends with .csv\n");
+	fprintf(stdout, "\t-C BASE  compare mode: %s -C BASE CANDIDATE compares two results files,\n"
+		"\t         the exit status is the number of regressions\n", name);
+	fprintf(stdout, "\t-T PCT   compare mode: smallest change reported, default %.0f%%\n", compare_threshold);
+	fprintf(stdout, "\t-k FILE  capture every chunk read and written on the ports in the ring file FILE\n");
+	fprintf(stdout, "\t-K MB    size of the capture ring, default %ld MiB\n", capture_mb);
+	fprintf(stdout, "\t-R FILE  replay mode: %s -R FILE parses the bytes received in a capture,\n"
+		"\t         at full speed (-r N passes) or with -S at the original timing\n", name);
+	fprintf(stdout, "\t-E N     engine scaling: 1, 2, 4... N pairs of protocol engines on N virtual links\n"
+		"\t         SERIAL 1, at SPEED IDX 1 for -b SECS seconds (default 2) per step, max %d\n",
+		BENCH_MAX_PAIRS);
+	fprintf(stdout, "\t-f FILE  multi-port mode: the ports and their peers from FILE, one per line:\n"
+		"\t         NAME DEVICE BAUD PEER [PRE [POST]], up to %d ports\n", MULTIPORT_MAX_PORTS);
+	fprintf(stdout, "\t-j N     multi-port mode: N workers open the ports in parallel, default %d\n",
+		MULTIPORT_WORKERS);
+	fprintf(stdout, "\t-D SECS  multi-port mode: stop after SECS seconds, default at SIGINT\n");
+	fprintf(stdout, "\t-x N     hex dumps of the verbose level: only the first and the last N bytes\n");
+	fprintf(stdout, "\t-h       this help\n");
+}
+
+static void print_low_latency(const char *device, int fd)
+{
+	unsigned int applied = serial_low_latency_applied(fd);
+
+	if (applied == 0)
+		return;
+	DBG_I("Low latency on %s: O_FSYNC %s - ASYNC_LOW_LATENCY %s - latency_timer %s\n", device,
+		applied & SERIAL_LOWLAT_NO_FSYNC ? "off" : "on",
+		applied & SERIAL_LOWLAT_ASYNC ? "set" : "not available",
+		applied & SERIAL_LOWLAT_USB_TIMER ? "1 msec" : "not available");
+}
+
 static int baud_rate_test[] = {
-	38400, 1200, 19200, 2400, 115200, 4800, 57600, 4800, 38400, 9600, 230400, -1 };
+	38400, 1200, 19200, 2400, 115200, 4800, 57600, 4800, 38400, 9600, 230400,
+	250000, 460800, 500000, 921600, 1000000, 1500000, 2000000, 3000000, 4000000, -1 };
+
+static int baudrate_from_arg(const char *arg)
+{
+	int rval = strtoul(arg, NULL, 10);
+
+	if (rval >= BAUDRATE_MIN)
+		return rval;
+	rval = rval % ArraySize(baud_rate_test); // Limit the index to the array size
+	return baud_rate_test[ rval ];
+}
+
+// Ogni ripetizione e' un campione delle metriche del passo
+static void bench_record(const t_bench_result *res)
+{
+	results_sample(results_metric(&results, "B/s", RESULTS_HIGHER, "bench/%d/%d/goodput",
+		res->baudrate, res->payload), res->goodput);
+	results_sample(results_metric(&results, "us", RESULTS_LOWER, "bench/%d/%d/p50",
+		res->baudrate, res->payload), hist_percentile(&res->rtt, 50));
+	results_sample(results_metric(&results, "us", RESULTS_LOWER, "bench/%d/%d/p99",
+		res->baudrate, res->payload), hist_percentile(&res->rtt, 99));
+	results_sample(results_metric(&results, "us", RESULTS_LOWER, "bench/%d/%d/p999",
+		res->baudrate, res->payload), hist_percentile(&res->rtt, 99.9));
+	results_sample(results_metric(&results, "count", RESULTS_LOWER, "bench/%d/%d/errors",
+		res->baudrate, res->payload), res->timeouts + res->errors);
+}
+
+/*
+ * Benchmark: la porta 1 misura, la porta 2 risponde. Per ogni baud rate
+ * delle due porte e per ogni dimensione del payload una riga con goodput,
+ * efficienza e percentili del round trip.
+ */
+static int benchmark(const t_port *master, const t_port *slave)
+{
+	int bauds[2] = { master->baudrate, slave->baudrate };
+	int nbauds = bauds[0] == bauds[1] ? 1 : 2;
+	int frame, b, i, r, rval;
+	t_bench_result res, total;
+
+	DBG_I("Benchmark: %s, %d secs per step, %d run%s, %d secs of warm-up\n", crc_name(checksum),
+		bench_seconds, bench_repeats, bench_repeats > 1 ? "s" : "", bench_warmup);
+	bench_print_header();
+	for (b = 0; b < nbauds; b++)
+	{
+		if (serial_device_reset(master->fd, bauds[b], master->pre, master->post) < 0 ||
+			serial_device_reset(slave->fd, bauds[b], slave->pre, slave->post) < 0)
+		{
+			DBG_E("Cannot set both ports to %d baud\n", bauds[b]);
+			return -1;
+		}
+		for (i = 0; i < (int) ArraySize(bench_payloads); i++)
+		{
+			// Un solo round trip deve stare nel passo
+			frame = sizeof(t_signature) + bench_payloads[i] + TRAILER_LEN;
+			if (serial_transfer_time(bauds[b], 2 * frame) > bench_seconds * 1000L)
+			{
+				DBG_I("%d baud, %d bytes: a round trip takes more than %d secs, skipped\n",
+					bauds[b], bench_payloads[i], bench_seconds);
+				continue;
+			}
+			// Il riscaldamento (cache, FIFO, buffer del driver) non conta
+			rval = 0;
+			if (bench_warmup > 0)
+				rval = bench_step(master->fd, slave->fd, bauds[b], bench_payloads[i],
+					checksum, bench_warmup, &res);
+			for (r = 0; r < bench_repeats && rval >= 0; r++)
+			{
+				rval = bench_step(master->fd, slave->fd, bauds[b], bench_payloads[i],
+					checksum, bench_seconds, &res);
+				if (rval < 0)
+					break;
+				bench_record(&res);
+				if (r == 0)
+					total = res;
+				else
+					bench_merge(&total, &res);
+			}
+			if (rval < 0)
+			{
+				DBG_E("Benchmark error %d at %d baud, %d bytes\n", rval, bauds[b], bench_payloads[i]);
+				return rval;
+			}
+			bench_print(&total);
+		}
+	}
+	return 0;
+}
+
+static void engine_config(t_engine_config *cfg, const t_port *port, const char *name, int payload,
+	long timeout)
+{
+	memset(cfg, 0, sizeof(t_engine_config));
+	cfg->fd = port->fd;
+	cfg->name = name;
+	cfg->baudrate = port->baudrate;
+	cfg->pre = port->pre;
+	cfg->post = port->post;
+	cfg->payload = payload;
+	cfg->command_timeout = timeout;
+	cfg->window = window_size;
+	cfg->crc = checksum;
+	cfg->pace_us = timer_tick;
+	cfg->prbs = prbs_payload;
+}
+
+/*
+ * Tutte le porte del file insieme, con le opzioni della riga di comando
+ * (-w, -c, -p/-t) uguali per tutte. L'uscita e' il numero degli errori.
+ */
+static int multiport(const char *program, const char *path, int low_latency)
+{
+	static t_multiport_config cfg;
+	t_engine_config tmpl;
+	t_port none = { -1, 0, 0, 0 };
+	pthread_t monitorThread;
+	int rval;
 
+	if (multiport_load(&cfg, path) < 0)
+	{
+		DBG_E("Bad multi-port configuration %s\n", path);
+		return -1;
+	}
+	results_setup(program, path, path, 0, 0, low_latency);
+	results_config(&results, "mode", "multiport %s", window_size > 0 ? "window" : "pingpong");
+	results_config(&results, "ports", "%d", cfg.nports);
+
+	if (monitor_period > 0 && pthread_create(&monitorThread, NULL, monitor_pthread, NULL) != 0)
+		DBG_E("Cannot create thread for statistics\n");
+
+	// Payload e baud rate li decide ogni coppia
+	engine_config(&tmpl, &none, NULL, 0, TIMEOUT_MAIN_MS);
+	run_start_ms = serial_now_ms();
+	rval = multiport_run(&cfg, &tmpl, multiport_workers, multiport_seconds);
+	if (rval < 0)
+	{
+		DBG_E("Cannot run the ports of %s\n", path);
+		return -1;
+	}
+	save_results();
+	return rval;
+}
 
 int main(int argc, char *argv[])
 {
 	int ser1fd = -1;                // serial 1 file descriptor handle
 	int ser2fd = -1;                // serial 2 file descriptor handle
-	int serfd = -1;
 	int baudrate1;
 	int baudrate2;
-	t_state state = STATE_RESET;
-	t_state state_next = STATE_LAST;
-	unsigned char sbufferread[BUFFER_SIZE];
-	unsigned char sbufferwrite[BUFFER_SIZE];
-	long timeout = TIMEOUT_MAIN_MS;
 	int rval = 0;
 	char device1[1024];
 	char device2[1024];
-	int goodpackettx = 0;
-	int goodpacketrx = 0;
+	char loglevels[1024];
+	t_portstats *stats = NULL;
+	t_engine_config cfg1;
+	t_engine_config cfg2;
+	t_engine *engine1 = NULL;
+	t_engine *engine2 = NULL;
 	pthread_t serial2Thread;
 	pthread_t breakThread;
+	pthread_t monitorThread;
+	pthread_t signalThread;
 	int theThread;
 	int theBreakThread;
 	int pre1, pre2;
 	int post1, post2;
-	int pre, post;
 	t_port port1;
 	t_port port2;
 	int fhandle[2];
-
-	t_signature signatureread;
-	signatureread.header = SERIAL_SIGNATURE_HEADER;
-	signatureread.footer = SERIAL_SIGNATURE_FOOTER;
-	signatureread.len = 0;
-
-	t_signature signaturewrite;
-	signaturewrite.header = SERIAL_SIGNATURE_HEADER;
-	signaturewrite.footer = SERIAL_SIGNATURE_FOOTER;
-	signaturewrite.len = 0;
-
-	// avoid gcc warning
-	argv = argv;
-	argc = argc;
+	int low_latency = 0;
+	const char *compare_base = NULL;
+	const char *replay_path = NULL;
+	int replay_realtime = 0;
+	int engine_pairs = 0;
+	const char *program = argv[0];
 
 	version(argv[0], fwBuild);
 	banner();
+	// Con kill -USR2 i livelli di log vengono riletti da qui
+	snprintf(loglevels, sizeof(loglevels), "/tmp/%s/loglevel", argv[0]);
+	log_levels_file(loglevels);
 
-	// Adesso posso istanziare l'handle dei segnali che utilizza il mutex
+	while ((rval = getopt(argc, argv, "pt:w:c:P:ls:m:b:r:W:o:C:T:k:K:R:SE:f:j:D:x:h")) != -1)
+	{
+		switch (rval)
+		{
+			case 'p':
+				timer_tick = TIMER_TICK;
+				break;
+			case 't':
+				timer_tick = MSEC(strtol(optarg, NULL, 10));
+				break;
+			case 'w':
+				window_size = strtol(optarg, NULL, 10);
+				break;
+			case 'c':
+				if (strcmp(optarg, "crc32") == 0)
+					checksum = CRC_32;
+				else
+				if (strcmp(optarg, "crc32c") == 0)
+					checksum = CRC_32C;
+				else
+				if (strcmp(optarg, "echo") == 0)
+					checksum = CRC_NONE;
+				else
+				{
+					usage(argv[0]);
+					return -1;
+				}
+				break;
+			case 'P':
+				prbs_payload = prbs_type(strtol(optarg, NULL, 10));
+				if (prbs_payload == PRBS_NONE)
+				{
+					usage(argv[0]);
+					return -1;
+				}
+				break;
+			case 'l':
+				serial_set_low_latency(1);
+				low_latency = 1;
+				break;
+			case 's':
+				serial_set_sysfs_root(optarg);
+				break;
+			case 'm':
+				monitor_period = strtol(optarg, NULL, 10);
+				break;
+			case 'b':
+				bench_seconds = strtol(optarg, NULL, 10);
+				break;
+			case 'r':
+				bench_repeats = strtol(optarg, NULL, 10);
+				if (bench_repeats < 1)
+					bench_repeats = 1;
+				if (bench_repeats > RESULTS_MAX_SAMPLES)
+					bench_repeats = RESULTS_MAX_SAMPLES;
+				break;
+			case 'W':
+				bench_warmup = strtol(optarg, NULL, 10);
+				break;
+			case 'o':
+				results_path = optarg;
+				break;
+			case 'C':
+				compare_base = optarg;
+				break;
+			case 'T':
+				compare_threshold = strtod(optarg, NULL);
+				break;
+			case 'k':
+				capture_path = optarg;
+				break;
+			case 'K':
+				capture_mb = strtol(optarg, NULL, 10);
+				break;
+			case 'R':
+				replay_path = optarg;
+				break;
+			case 'S':
+				replay_realtime = 1;
+				break;
+			case 'E':
+				engine_pairs = strtol(optarg, NULL, 10);
+				break;
+			case 'f':
+				multiport_path = optarg;
+				break;
+			case 'j':
+				multiport_workers = strtol(optarg, NULL, 10);
+				break;
+			case 'D':
+				multiport_seconds = strtol(optarg, NULL, 10);
+				break;
+			case 'x':
+				hexdump_set_limit(strtol(optarg, NULL, 10));
+				break;
+			case 'h':
+			default:
+				usage(argv[0]);
+				return -1;
+		}
+	}
+	if (prbs_payload != PRBS_NONE && window_size > 0)
+	{
+		DBG_E("The PRBS payload needs the stop-and-wait mode: -P and -w do not go together\n");
+		return -1;
+	}
+	// Gli argomenti posizionali seguono le opzioni: li riportiamo
+	// alle solite posizioni argv[1]...argv[8]
+	argc -= optind - 1;
+	argv += optind - 1;
+
+	if (compare_base != NULL)
+		return compare_results(compare_base, argc > 1 ? argv[1] : NULL);
+	if (replay_path != NULL)
+		return replay_run(replay_path, replay_realtime, bench_repeats) < 0 ? -1 : 0;
+
+	// Adesso posso istanziare l'handle dei segnali
+	if (sem_init(&signal_sem, 0, 0) < 0 ||
+		pthread_create(&signalThread, NULL, signal_pthread, NULL) != 0)
+	{
+		DBG_E("Cannot create thread for signals\n");
+		return -1;
+	}
 	signal(SIGSEGV, signal_handle);
 	signal(SIGINT, signal_handle);
 	signal(SIGTERM, signal_handle);
 	signal(SIGUSR1, signal_handle);
 	signal(SIGUSR2, signal_handle);
 
+	if (multiport_path != NULL)
+		return multiport(program, multiport_path, low_latency);
+
 	// Arguments check
 	if (argc > 1) sprintf(device1, "%s", argv[1]); else sprintf(device1, "/dev/ttyUSB0");
 	if (argc > 2) sprintf(device2, "%s", argv[2]); else sprintf(device2, "/dev/ttyUSB1");
-	if (argc > 3) { rval = strtoul(argv[3], NULL, 10);
-		rval = rval % ArraySize(baud_rate_test); // Limit the index to the array size
-		baudrate1 = baud_rate_test[ rval ]; } else baudrate1 = 115200;
-	if (argc > 4) { rval = strtoul(argv[4], NULL, 10);
-		rval = rval % ArraySize(baud_rate_test); // Limit the index to the array size
-		baudrate2 = baud_rate_test[ rval ]; } else baudrate2 = 9600;
+	if (argc > 3) baudrate1 = baudrate_from_arg(argv[3]); else baudrate1 = 115200;
+	if (argc > 4) baudrate2 = baudrate_from_arg(argv[4]); else baudrate2 = 9600;
 	// Parametri di attesa pre-post
 	if (argc > 5) { rval = strtoul(argv[5], NULL, 10);
 		pre1 = rval; } else pre1 = 0;
@@ -1131,6 +827,16 @@ int main(int argc, char *argv[])
 	if (argc > 8) { rval = strtoul(argv[8], NULL, 10);
 		post2 = rval; } else post2 = 0;
 
+	if (engine_pairs > 0)
+	{
+		port1.fd = -1;
+		port1.baudrate = baudrate1;
+		port1.pre = pre1;
+		port1.post = post1;
+		engine_config(&cfg1, &port1, device1, engine_payload_len(baudrate1), TIMEOUT_MAIN_MS);
+		return bench_engines(device1, engine_pairs, bench_seconds > 0 ? bench_seconds : 2,
+			&cfg1) < 0 ? -1 : 0;
+	}
 
 	for (rval = 0; rval < (int) ArraySize(baud_rate_test); rval++)
 	{
@@ -1139,6 +845,18 @@ int main(int argc, char *argv[])
 		DBG_I("BaudRate: %7d -- Index: %2d\n", baud_rate_test[rval], rval);
 	}
 
+	if (timer_tick > 0)
+		DBG_I("Paced mode: %ld msecs between states\n", timer_tick / 1000L);
+	if (window_size > 0)
+		DBG_I("Windowed mode: %d frames in flight\n", window_size);
+	DBG_I("Integrity check: %s\n", crc_name(checksum));
+	if (prbs_payload != PRBS_NONE)
+		DBG_I("Payload: %s\n", prbs_name(prbs_payload));
+	DBG_I("Header scan: %s\n", resync_impl_name());
+
+	results_setup(program, device1, device2,
+		baudrate1, baudrate2, low_latency);
+
 	DBG_I("Using %s as device 1 @ BaudRate: %d - PRE: %d - POST: %d...\n",
 		device1, baudrate1, pre1, post1);
 	DBG_I("Using %s as device 2 @ BaudRate: %d - PRE: %d - POST: %d...\n",
@@ -1152,11 +870,12 @@ int main(int argc, char *argv[])
 	}
 	else
 	{
-		serfd = port1.fd;
+		ser1fd = port1.fd;
 		port1.baudrate = baudrate1;
-		pre = pre1;
-		post = post1;
+		port1.pre = pre1;
+		port1.post = post1;
 		DBG_I("Serial Port 1 File Handle: %d\n", port1.fd);
+		print_low_latency(device1, port1.fd);
 	}
 
 	ser2fd = serial_device_init(device2, baudrate2, pre2, post2);
@@ -1172,21 +891,59 @@ int main(int argc, char *argv[])
 		port2.pre = pre2;
 		port2.post = post2;
 		DBG_I("Serial Port 2 File Handle: %d\n", port2.fd);
+		print_low_latency(device2, port2.fd);
 	}
 
-	DBG_I("Creating mutexLock\n");
-	if (pthread_mutex_init(&mutexLock, NULL) != 0)
+	if (portstats_attach(port1.fd, device1) == NULL ||
+		portstats_attach(port2.fd, device2) == NULL)
 	{
-		DBG_E("Cannot create thread lock (mutexLock)\n");
+		DBG_E("Cannot attach the port statistics\n");
 		return -1;
 	}
-	else
+	stats = portstats_of(port1.fd);
+	// Senza i tempi per stato il test gira lo stesso
+	if (statetime_attach(port1.fd, device1, STATE_LAST, engine_state_name) == NULL ||
+		statetime_attach(port2.fd, device2, STATE_LAST, engine_state_name) == NULL)
+		DBG_E("Cannot attach the state times\n");
+
+	if (capture_path != NULL)
+	{
+		if (capture_open(capture_path, MiB(capture_mb), checksum) < 0 ||
+			capture_port(port1.fd, device1, baudrate1) < 0 ||
+			capture_port(port2.fd, device2, baudrate2) < 0)
+		{
+			DBG_E("Cannot capture to %s\n", capture_path);
+			return -1;
+		}
+		DBG_I("Capturing the traffic to %s (%ld MiB ring)\n", capture_path, capture_mb);
+	}
+
+	// Il payload dipende dalla velocita' della porta 2 su entrambe le porte.
+	// La porta 1 aspetta il DOSLAVE piu' a lungo: di solito e' lo slave
+	engine_config(&cfg1, &port1, device1, engine_payload_len(baudrate2), TIMEOUT_MAIN_MS);
+	engine_config(&cfg2, &port2, device2, engine_payload_len(baudrate2), TIMEOUT_THREAD_MS);
+	engine1 = engine_create(&cfg1);
+	engine2 = engine_create(&cfg2);
+	if (engine1 == NULL || engine2 == NULL)
+	{
+		DBG_E("Cannot create the protocol engines\n");
+		return -1;
+	}
+
+	if (bench_seconds > 0)
 	{
-		DBG_N("Thread MUTEX Created\n");
+		rval = benchmark(&port1, &port2);
+		if (rval == 0)
+			save_results();
+		capture_close();
+		engine_destroy(engine1);
+		engine_destroy(engine2);
+		return rval;
 	}
 
+	run_start_ms = serial_now_ms();
 	DBG_I("Initialize pthread\n");
-	theThread = pthread_create( &serial2Thread, NULL, serial_2_pthread, &port2 );
+	theThread = pthread_create( &serial2Thread, NULL, engine_run, engine2 );
 	if (theThread < 0)
 	{
 		DBG_E("Cannot create thread modem\n");
@@ -1203,583 +960,27 @@ int main(int argc, char *argv[])
 		goto out;
 	}
 
-	DBG_N("START STATE MACHINE\n");
-
-	for (;;)
+	if (monitor_period > 0)
 	{
-		switch (state)
-		{
-			case STATE_START:
-				DBG_N("STATE_START\n");
-				serial_flush_rx(serfd);
-				serial_flush_tx(serfd);
-				state_next = STATE_WAIT_COMMAND;
-				break;
-
-			// SLAVE STATES
-			case STATE_WAIT_COMMAND:
-				// Ci sono caratteri da leggere entro 15 secondi!
-				// i 15 secondi possono aumentare o diminuire a seconda
-				// del livello raggiunto dal test
-				rval = serial_read_string(serfd, sbufferread, timeout);
-				if (rval < 0)
-				{
-					if (errno != EAGAIN && errno != EINTR)
-					{
-						DBG_E("Error on WAITING COMMAND\n");
-						state_next = STATE_RESET;
-					}
-					// Se siamo stati interrotti ci riproviamo
-				}
-				else
-				{
-					if (rval == 0)
-					{
-						DBG_N("Nothing to read within %ld msecs\n", timeout);
-						DBG_V("\t\t*** NOW SEND BREAK ***\n");
-						state_next = STATE_SEND_BREAK;
-					}
-					else
-					{
-						DBG_N("Read %d from serial.\n", rval);
-						state_next = STATE_COMMAND_RECEIVED;
-					}
-				}
-				break;
-
-			case STATE_SEND_BREAK:
-				rval = serial_send_break(serfd);
-				if (rval < 0)
-				{
-					if (errno != EAGAIN && errno != EINTR)
-					{
-						DBG_E("Error on SENDING BREAK COMMAND\n");
-						state_next = STATE_RESET;
-					}
-					// Se siamo stati interrotti ci riproviamo
-				}
-				else
-				{
-					if (rval == 0)
-					{
-						DBG_V("\t\t*** NOW MASTER ***\n");
-						state_next = STATE_SEND_COMMAND;
-					}
-					else
-					{
-						DBG_E("SEND BREAK -- IS THIS A BUG??? rval: %d\n", rval);
-						state_next = STATE_RESET;
-					}
-				}
-				break;
-
-			case STATE_COMMAND_RECEIVED:
-				DBG_N("STATE_COMMAND_RECEIVED\n");
-				if (strcmp("DOSLAVE\r\n", (const char *) sbufferread) == 0)
-				{
-					DBG_N("DO SLAVE RECEIVED. SENDING ACK\n");
-					state_next = STATE_SEND_COMMAND_ACK;
-				}
-				else
-				{
-					// Ho ricevuto caratteri spuri. E' un problema, ritorno
-					// allo stato di MASTER...
-					DBG_N("UNKNOWN COMMAND / JUNK RECEIVED\n");
-					DBG_V("\t\t*** NOW MASTER ***\n");
-					serial_device_status(serfd);
-					state_next = STATE_SEND_COMMAND;
-				}
-				break;
-
-			case STATE_SEND_COMMAND_ACK:
-				DBG_N("SENDING DOSLAVE CMD ACK\n");
-				rval = serial_send_string(serfd, (const unsigned char *) "DOSLAVECMDACK\r\n");
-				if (rval < 0)
-				{
-					if (errno != EAGAIN && errno != EINTR)
-					{
-						DBG_E("Error on SEND COMMAND ACK\n");
-						state_next = STATE_RESET;
-						errornumbersMain++;
-					}
-				}
-				else
-				{
-					if (rval == 0)
-					{
-						DBG_V("*** STATE_SEND_COMMAND_ACK NOT SENDING? Retry ***\n");
-					}
-					else
-					{
-						DBG_N("Switching STATE_WAIT_SERIAL_PACKET_SIGNATURE FROM MASTER\n");
-						state_next = STATE_WAIT_SERIAL_PACKET_SIGNATURE;
-					}
-				}
-				break;
-
-			case STATE_WAIT_SERIAL_PACKET_SIGNATURE:
-				rval = serial_read_raw(serfd, (unsigned char *) &signatureread, sizeof(t_signature));
-				if (rval < 0)
-				{
-					if (errno != EAGAIN && errno != EINTR)
-					{
-						DBG_E("Error on WAIT SERIAL PACKET SIGNATURE\n");
-						state_next = STATE_RESET;
-						errornumbersMain++;
-					}
-				}
-				else
-				{
-					if (rval == 0)
-					{
-						DBG_N("*** NOTHING TO READ/SIGNATURE ***\n");
-						state_next = STATE_RESET;
-					}
-					else
-					{
-						DBG_N("SIGNATURE PACKET RECIVED FROM MASTER\n");
-						if (rval != sizeof(t_signature))
-						{
-							DBG_E("RVAL: %d -- BAD SIGNATURE STATE_WAIT_SERIAL_PACKET_SIGNATURE:"
-									"\n\tHEADER: 0x%08x\n\tLEN: 0x%08x\n\tFOOTER: 0x%08x\n",
-								rval, signatureread.header, signatureread.len, signatureread.footer);
-							state_next = STATE_RESET;
-							serial_device_status(serfd);
-							errornumbersMain++;
-						}
-						else
-						{
-							DBG_N("STATE_WAIT_SERIAL_PACKET_SIGNATURE:"
-									"\n\tHEADER: 0x%08x\n\tLEN: 0x%08x\n\tFOOTER: 0x%08x\n",
-								signatureread.header, signatureread.len, signatureread.footer);
-							state_next = STATE_READ_SERIAL_PACKET;
-						}
-					}
-				}
-				break;
-
-			case STATE_READ_SERIAL_PACKET:
-				DBG_N("STATE_READ_SERIAL_PACKET\n");
-				// Verifichiamo la validita' della signature ricevuta.
-				// Dobbiamo metterci il meno possibile perche' i dati
-				// stanno arrivando dalla seriale. E tra la lettura della
-				// firma ad adesso ho gia' perso almeno 12 millisecondi
-				// che e' il TIMER_TICK
-				if (signatureread.header == SERIAL_SIGNATURE_HEADER &&
-					signatureread.footer == SERIAL_SIGNATURE_FOOTER)
-				{
-					// La firma ricevuta va bene, leggiamo tutto il contenuto
-					// del pacchetto
-					rval = serial_read_raw(serfd, sbufferread, signatureread.len);
-					if (rval < 0)
-					{
-						if (errno != EAGAIN && errno != EINTR)
-						{
-							DBG_E("Error on STATE_READ_SERIAL_PACKET\n");
-							state_next = STATE_RESET;
-							errornumbersMain++;
-						}
-					}
-					else
-					{
-						if (rval == 0)
-						{
-							DBG_N("*** NOTHING TO READ ***\n");
-							state_next = STATE_RESET;
-						}
-						else
-						{
-							DBG_N("STATE_READ_SERIAL_PACKET FROM MASTER\n\tRead: %d -- To Read: %d\n", rval, signatureread.len);
-							if (rval != (int) signatureread.len)
-							{
-								DBG_E("BAD STATE_READ_SERIAL_PACKET LEN\n");
-								serial_device_status(serfd);
-								state_next = STATE_RESET;
-								errornumbersMain++;
-							}
-							else
-							{
-								// Adesso ho letto tutto, rispediamo la firma indietro
-								// e tutto il pacchetto al chiamante!
-								DBG_N("STATE_READ_SERIAL_PACKETREAD\n");
-								state_next = STATE_WRITE_SERIAL_PACKET_SIGNATURE_SLAVE;
-							}
-						}
-					}
-				}
-				else
-				{
-					DBG_E("STATE_READ_SERIAL_PACKET: BAD SIGNATURE RECEIVED\n");
-					serial_device_status(serfd);
-					state_next = STATE_RESET;
-					errornumbersMain++;
-				}
-				break;
-
-			case STATE_WRITE_SERIAL_PACKET_SIGNATURE_SLAVE:
-				DBG_N("STATE_WRITE_SERIAL_PACKET_SIGNATURE\n");
-				signaturewrite.header = signatureread.header;
-				signaturewrite.len = signatureread.len;
-				signaturewrite.footer = signatureread.footer;
-				rval = serial_send_raw(serfd, (const unsigned char *) &signaturewrite, sizeof(t_signature));
-				if (rval < 0)
-				{
-					if (errno != EAGAIN && errno != EINTR)
-					{
-						DBG_E("STATE_WRITE_SERIAL_PACKET_SIGNATURE ERROR\n");
-						state_next = STATE_RESET;
-						errornumbersMain++;
-					}
-				}
-				else
-				{
-					switch (rval)
-					{
-						case 0:
-							DBG_N("STATE_WRITE_SERIAL_PACKET_SIGNATURE NOT WRITE. RETRY\n");
-							break;
-
-						case sizeof(t_signature):
-							// Ho scritto la firma, adesso il prima possibile
-							// scrivo tutto il resto!
-							DBG_N("STATE_WRITE_SERIAL_PACKET_SIGNATURE OK\n");
-							state_next = STATE_WRITE_SERIAL_PACKET_ACK;
-							break;
-
-						default:
-							DBG_E("STATE_WRITE_SERIAL_PACKET_SIGNATURE not writing everything: %d\n",
-								rval);
-							state_next = STATE_RESET;
-							errornumbersMain++;
-							break;
-					}
-				}
-				break;
-
-			case STATE_WRITE_SERIAL_PACKET_ACK:
-				// Il messaggio di risposta al pacchetto ricevuto,
-				// e' lo stesso pacchetto...
-				DBG_N("STATE_WRITE_SERIAL_PACKET_ACK --- SAME PACKET BACK!\n");
-				memcpy(sbufferwrite, sbufferread, signatureread.len);
-				rval = serial_send_raw(serfd, sbufferwrite, signatureread.len);
-				if (rval < 0)
-				{
-					if (errno != EAGAIN && errno != EINTR)
-					{
-						DBG_E("Error on WRITING SERIAL PACKET ACK\n");
-						state_next = STATE_RESET;
-						errornumbersMain++;
-					}
-				}
-				else
-				{
-					if (rval == 0)
-					{
-						DBG_E("*** NOT WRITING - Retry ***\n");
-					}
-					else
-					{
-						DBG_N("SENT PACKET ACK FROM SLAVE OK %d\n", goodpacketrx++);
-						state_next = STATE_WAIT_SERIAL_PACKET_SIGNATURE;
-					}
-				}
-				break;
-
-			// MASTER STATES
-			case STATE_SEND_COMMAND:
-				DBG_N("STATE_SEND_COMMAND\n");
-				rval = serial_send_string(serfd, (const unsigned char *) "DOSLAVE\r\n");
-				if (rval < 0)
-				{
-					if (errno != EAGAIN && errno != EINTR)
-					{
-						DBG_E("Error on SEND COMMAND DO SLAVE r:%d -- e: %d\n", rval, errno);
-						state_next = STATE_RESET_SERIAL;
-						errornumbersMain++;
-					}
-				}
-				else
-				{
-					if (rval == 0)
-					{
-						DBG_V("Why NOT SENDING? Retry\n");
-					}
-					else
-					{
-						DBG_N("Switching to WAITING CMD ACK FROM SLAVE\n");
-						state_next = STATE_WAIT_COMMAND_ACK;
-					}
-				}
-				break;
-
-			case STATE_WAIT_COMMAND_ACK:
-				DBG_N("STATE_WAIT_COMMAND_ACK\n");
-				// se stiamo andando a 1200bps la stringa di 32 caratteri
-				// arriva in poco meno di 400 msec. mettiamoci anche
-				// un tempo di elaborazione di altri 400 msec. Totale: 800
-				rval = serial_read_string(serfd, sbufferread, 800);
-				if (rval < 0)
-				{
-					if (errno != EAGAIN && errno != EINTR)
-					{
-						DBG_E("Error on STATE_WAIT_COMMAND_ACK\n");
-						state_next = STATE_RESET;
-						errornumbersMain++;
-					}
-				}
-				else
-				{
-					if (rval == 0)
-					{
-						DBG_V("TIMEOUT ERROR. RESET\n");
-						state_next = STATE_RESET;
-						errornumbersMain++;
-					}
-					else
-					{
-						if (strcmp("DOSLAVECMDACK\r\n", (const char *) sbufferread) == 0)
-						{
-							DBG_N("DO SLAVE CMD ACKNOWLEDGED.\n");
-							state_next = STATE_WRITE_SERIAL_PACKET_SIGNATURE_MASTER;
-						}
-						else
-						{
-							DBG_E("GARBAGE/JUNK ON RECEIVING WAIT CMD ACK %s\n", sbufferread);
-							serial_device_status(serfd);
-							state_next = STATE_RESET;
-							errornumbersMain++;
-						}
-					}
-				}
-				break;
-
-			case STATE_WRITE_SERIAL_PACKET_SIGNATURE_MASTER:
-				// Prima di scrivere il pacchetto, occorre preparare la signature
-				// corretta...
-				signaturewrite.header = SERIAL_SIGNATURE_HEADER;
-				signaturewrite.footer = SERIAL_SIGNATURE_FOOTER;
-				signaturewrite.len = bufferlen(baudrate2);
-				DBG_N("STATE_WRITE_SERIAL_PACKET_SIGNATURE_MASTER:"
-					"\n\tHEADER: 0x%08x\n\tLEN: 0x%08x\n\tFOOTER: 0x%08x\n",
-					signaturewrite.header, signaturewrite.len, signaturewrite.footer);
-				rval = serial_send_raw(serfd, (const unsigned char *) &signaturewrite, sizeof(t_signature));
-				if (rval < 0)
-				{
-					if (errno != EINTR && errno != EAGAIN)
-					{
-						DBG_E("STATE_WRITE_SERIAL_PACKET_SIGNATURE! Unable to write data!\n");
-						state_next = STATE_RESET;
-						errornumbersMain++;
-					}
-				}
-				else
-				{
-					if (rval == 0)
-					{
-						DBG_N("Timeout STATE_WRITE_SERIAL_PACKET_SIGNATURE. Wait...\n");
-						// Retry
-					}
-					else
-					{
-						DBG_N("STATE_WRITE_SERIAL_PACKET_SIGNATURE OK\n");
-						state_next = STATE_WRITE_SERIAL_PACKET;
-					}
-				}
-				break;
-
-			case STATE_WRITE_SERIAL_PACKET:
-				DBG_N("STATE_WRITE_SERIAL_PACKET\n");
-				fillbuffer(sbufferwrite, sizeof(sbufferwrite), baudrate2);
-				rval = serial_send_raw(serfd, (const unsigned char *) sbufferwrite, signaturewrite.len);
-				if (rval < 0)
-				{
-					if (errno != EINTR && errno != EAGAIN)
-					{
-						DBG_E("STATE_WRITE_SERIAL_PACKET! Unable to write data!\n");
-						state_next = STATE_RESET;
-						errornumbersMain++;
-					}
-				}
-				else
-				{
-					if (rval == 0)
-					{
-						DBG_N("Timeout STATE_WRITE_SERIAL_PACKET. Wait...\n");
-						// Retry write
-					}
-					else
-					{
-						if (rval == (int) signaturewrite.len)
-						{
-							DBG_N("STATE_WRITE_SERIAL_PACKET OK.\n");
-							state_next = STATE_WAIT_SERIAL_PACKET_ACK_SIGNATURE;
-						}
-						else
-						{
-							DBG_E("STATE_WRITE_SERIAL_PACKET Error\n");
-							state_next = STATE_RESET;
-							errornumbersMain++;
-						}
-					}
-				}
-				break;
-
-			case STATE_WAIT_SERIAL_PACKET_ACK_SIGNATURE:
-				// Aspettiamo la firma dallo slave...
-				DBG_N("STATE_WAIT_SERIAL_PACKET_ACK_SIGNATURE\n");
-				rval = serial_read_raw(serfd, (unsigned char *) &signatureread, sizeof(t_signature));
-				if (rval < 0)
-				{
-					if (errno != EINTR || errno != EAGAIN)
-					{
-						DBG_E("STATE_WAIT_SERIAL_PACKET_ACK_SIGNATURE ERROR on reading!\n");
-						state_next = STATE_RESET;
-						errornumbersMain++;
-					}
-				}
-				else
-				{
-					if (rval == 0)
-					{
-						DBG_E("Timeout STATE_WAIT_SERIAL_PACKET_ACK_SIGNATURE. Check SLAVE\n");
-						serial_device_status(serfd);
-						state_next = STATE_RESET;
-						errornumbersMain++;
-					}
-					else
-					{
-						if (rval != sizeof(t_signature))
-						{
-							DBG_E("STATE_WAIT_SERIAL_PACKET_ACK_SIGNATURE ERROR\n");
-							state_next = STATE_RESET;
-							serial_device_status(serfd);
-							errornumbersMain++;
-						}
-						else
-						{
-							DBG_N("STATE_WAIT_SERIAL_PACKET_ACK_SIGNATURE OK\n");
-							state_next = STATE_WAIT_SERIAL_PACKET_ACK;
-						}
-					}
-				}
-				break;
-
-			case STATE_WAIT_SERIAL_PACKET_ACK:
-				DBG_N("STATE_WAIT_SERIAL_PACKET_ACK\n");
-				// Proseguiamo nella lettura del pacchetto solo
-				// se quello che abbiamo ricevuto ha l'header uguale
-				// a quello che abbiamo spedito
-				if (memcmp((unsigned char *) &signatureread, (unsigned char *) &signaturewrite, sizeof(t_signature)) == 0)
-				{
-					DBG_N("STATE_WAIT_SERIAL_PACKET_ACK SIGNATURE OK.\n");
-					rval = serial_read_raw(serfd, sbufferread, signatureread.len);
-					if (rval < 0)
-					{
-						if (errno != EAGAIN && errno != EINTR)
-						{
-							DBG_E("ERROR: STATE_WAIT_SERIAL_PACKET_ACK\n");
-							state_next = STATE_RESET;
-							errornumbersMain++;
-						}
-					}
-					else
-					{
-						if (rval == 0)
-						{
-							DBG_E("STATE_WAIT_SERIAL_PACKET_ACK TIMEOUT\n");
-							state_next = STATE_RESET;
-							errornumbersMain++;
-						}
-						else
-						{
-							if (rval == (int) signatureread.len)
-							{
-								// Abbiamo letto tutto il pacchetto,
-								// verifichiamo che sia corretto!
-								if (memcmp(sbufferread, sbufferwrite, signatureread.len) == 0)
-								{
-									goodpackettx++;
-									DBG_I("STATE_WAIT_SERIAL_PACKET_ACK Good Packet: %d\n", goodpackettx);
-									state_next = STATE_WRITE_SERIAL_PACKET_SIGNATURE_MASTER;
-								}
-								else
-								{
-									DBG_E("ERROR ON STATE_WAIT_SERIAL_PACKET_ACK\n");
-									state_next = STATE_RESET;
-									serial_device_status(serfd);
-									errornumbersMain++;
-								}
-							}
-							else
-							{
-								DBG_E("STATE_WAIT_SERIAL_PACKET_ACK ERROR ON READING PACKET\n");
-								serial_device_status(serfd);
-								state_next = STATE_RESET;
-								errornumbersMain++;
-							}
-						}
-					}
-				}
-				else
-				{
-					DBG_E("STATE_WAIT_SERIAL_PACKET_ACK WRONG SIGNATURE\n");
-					serial_device_status(serfd);
-					state_next = STATE_RESET;
-					errornumbersMain++;
-				} 
-				break;
-
-			// ISSUE STATES
-			case STATE_RESET_SERIAL:
-				DBG_N("STATE_RESET_SERIAL\n");
-				rval = serial_device_reset(serfd, baudrate1, pre, post);
-				if (rval < 0)
-				{
-					if (errno != EAGAIN && errno != EINTR)
-					{
-						DBG_E("STATE_RESET_SERIAL ERROR\n");
-						goto out;
-					}
-				}
-				else
-				{
-					DBG_N("PORT RESETTED TO DEFAULT\n");
-				}
-				state_next = STATE_RESET;
-				break;
-
-			case STATE_RESET:
-				// Ogni volta che c'e' un'errore riduco il tempo di
-				// attesa...
-				if (timeout > 1000) timeout -= 1000; else timeout = TIMEOUT_MAIN_MS;
-				memset(sbufferread, 0, sizeof(sbufferread));
-				memset(sbufferwrite, 0, sizeof(sbufferwrite));
-				memset(&signatureread, 0, sizeof(t_signature));
-				memset(&signaturewrite, 0, sizeof(t_signature));
-				state_next = STATE_START;
-				goodpacketrx = 0;
-				goodpackettx = 0;
-				break;
-
-			case STATE_LAST:
-				// Deve essere l'ultimo!
-				break;
-		}
-
-		if (state != state_next)
+		DBG_I("Initialize pthread for statistics every %ld secs\n", monitor_period);
+		if (pthread_create(&monitorThread, NULL, monitor_pthread, NULL) != 0)
 		{
-			DBG_N("<LOOP> Changing state from %s to %s\n", state_name[state], state_name[state_next]);
-			state = state_next;
+			DBG_E("Cannot create thread for statistics\n");
+			goto out;
 		}
-		// Non consumiamo troppa CPU!!
-		usleep(TIMER_TICK);
 	}
 
-out:
-	pthread_mutex_destroy(&mutexLock);
+	DBG_N("START STATE MACHINE\n");
+	// La porta 1 gira nel thread principale finche' non si perde
+	engine_run(engine1);
 
+out:
 	close(ser1fd);
 	close(ser2fd);
-	return errornumbersMain;
+	print_portstats();
+	statetime_print_all();
+	save_results();
+	capture_close();
+	return (int) portstats_errors(&stats->c);
 }
 
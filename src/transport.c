@@ -0,0 +1,143 @@
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include "transport.h"
+#include "ec_types.h"
+#include "debug.h"
+
+DBG_MODULE(debuglevelDriver, "transport", DBG_ERROR)
+
+#define TRANSPORT_MAX_FD	1024
+
+typedef struct {
+	const t_transport_ops *ops;
+	unsigned int flags;
+	t_transport_stats stats;
+} t_transport_port;
+
+static t_transport_port ports[TRANSPORT_MAX_FD];
+static t_transport_stats stats_sink;
+
+// In ordine: il primo prefisso che corrisponde vince, tty e' l'ultimo
+static const t_transport_ops *transports[] = {
+	&transport_pty,
+	&transport_null,
+	&transport_unix,
+	&transport_tcp,
+	&transport_tty,
+};
+
+static int transport_match(const t_transport_ops *ops, const char *name)
+{
+	size_t len;
+
+	if (ops->prefix == NULL)
+		return 1;
+	len = strlen(ops->prefix);
+	return strncmp(name, ops->prefix, len) == 0 && (name[len] == '\0' || name[len] == ':');
+}
+
+int transport_open(const char *name, int baudrate)
+{
+	const t_transport_ops *ops = NULL;
+	unsigned int i;
+	int fd;
+
+	if (name == NULL)
+	{
+		DRIVER_ERROR("BAD PARAMETER\n");
+		return -ECERR_BADPARAM;
+	}
+
+	for (i = 0; i < ArraySize(transports); i++)
+	{
+		if (transport_match(transports[i], name))
+		{
+			ops = transports[i];
+			break;
+		}
+	}
+
+	fd = ops->open(name, baudrate);
+	if (fd < 0)
+		return fd;
+	if (fd >= TRANSPORT_MAX_FD)
+	{
+		DRIVER_ERROR("FD %d out of the transport table\n", fd);
+		close(fd);
+		return -ECERR_OUTOFMEM;
+	}
+
+	memset(&ports[fd], 0, sizeof(t_transport_port));
+	ports[fd].ops = ops;
+	DRIVER_NOISY("%s opened as %s FD: %d\n", name, ops->name, fd);
+	return fd;
+}
+
+void transport_close(int fd)
+{
+	if (fd < 0)
+		return;
+	if (fd < TRANSPORT_MAX_FD)
+		ports[fd].ops = NULL;
+	close(fd);
+}
+
+const t_transport_ops *transport_of(int fd)
+{
+	if (fd >= 0 && fd < TRANSPORT_MAX_FD && ports[fd].ops != NULL)
+		return ports[fd].ops;
+	return &transport_tty;
+}
+
+unsigned int transport_get_flags(int fd)
+{
+	if (fd >= 0 && fd < TRANSPORT_MAX_FD)
+		return ports[fd].flags;
+	return 0;
+}
+
+void transport_set_flags(int fd, unsigned int flags)
+{
+	if (fd >= 0 && fd < TRANSPORT_MAX_FD)
+		ports[fd].flags = flags;
+}
+
+t_transport_stats *transport_counters(int fd)
+{
+	if (fd >= 0 && fd < TRANSPORT_MAX_FD)
+		return &ports[fd].stats;
+	return &stats_sink;
+}
+
+void transport_get_stats(int fd, t_transport_stats *st)
+{
+	const t_transport_ops *ops = transport_of(fd);
+
+	*st = *transport_counters(fd);
+	if (ops->stats != NULL)
+		ops->stats(fd, st);
+}
+
+ssize_t transport_fd_readv(int fd, const struct iovec *iov, int iovcnt)
+{
+	return readv(fd, iov, iovcnt);
+}
+
+ssize_t transport_fd_writev(int fd, const struct iovec *iov, int iovcnt)
+{
+	return writev(fd, iov, iovcnt);
+}
+
+int transport_fd_wait(int fd, short events, int timeout_ms, short *revents)
+{
+	struct pollfd pfd;
+	int rval;
+
+	pfd.fd = fd;
+	pfd.events = events;
+	pfd.revents = 0;
+	rval = poll(&pfd, 1, timeout_ms);
+	*revents = pfd.revents;
+	return rval;
+}
@@ -0,0 +1,453 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pty.h>
+#include <pthread.h>
+#include <termios.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "vlink.h"
+#include "transport.h"
+#include "ec_types.h"
+#include "debug.h"
+
+DBG_MODULE(debuglevelDriver, "vlink", DBG_ERROR)
+
+#define VLINK_MAX	128
+// Byte consegnati in un colpo dalla linea simulata: ~1 msec di linea
+#define VLINK_CHUNK_MAX	256
+
+typedef enum {
+	VLINK_TYPE_PTY = 1,
+	VLINK_TYPE_NULL,
+	VLINK_TYPE_NULL_PACED,
+	VLINK_TYPE_UNIX,
+	VLINK_TYPE_TCP,
+} t_vlink_type;
+
+typedef struct {
+	t_vlink_type type;
+	char name[64];
+	int taken;          // ends already handed out
+	int end[2];         // ends of the user
+	int pump[2];        // paced: the other side of each end
+	int baudrate[2];
+} t_vlink;
+
+typedef struct {
+	t_vlink *link;
+	int dir;            // bytes written on end[dir] go to end[!dir]
+} t_vlink_pump;
+
+static t_vlink links[VLINK_MAX];
+static t_vlink_pump pumps[VLINK_MAX][2];
+static pthread_mutex_t vlink_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int vlink_prefix(const char *name, const char *prefix)
+{
+	size_t len = strlen(prefix);
+	return strncmp(name, prefix, len) == 0 && (name[len] == '\0' || name[len] == ':');
+}
+
+static t_vlink_type vlink_type(const char *name)
+{
+	if (name == NULL)
+		return 0;
+	if (strcmp(name, VLINK_PTY) == 0)
+		return VLINK_TYPE_PTY;
+	if (strcmp(name, VLINK_NULL) == 0)
+		return VLINK_TYPE_NULL;
+	if (strcmp(name, VLINK_NULL_PACED) == 0)
+		return VLINK_TYPE_NULL_PACED;
+	if (vlink_prefix(name, VLINK_UNIX))
+		return VLINK_TYPE_UNIX;
+	if (vlink_prefix(name, VLINK_TCP))
+		return VLINK_TYPE_TCP;
+	return 0;
+}
+
+static t_vlink *vlink_find(int fd, int *idx)
+{
+	int i, j;
+
+	for (i = 0; i < VLINK_MAX; i++)
+	{
+		if (links[i].type == VLINK_TYPE_PTY || links[i].taken == 0)
+			continue;
+		for (j = 0; j < links[i].taken; j++)
+		{
+			if (links[i].end[j] == fd)
+			{
+				*idx = j;
+				return &links[i];
+			}
+		}
+	}
+	return NULL;
+}
+
+static int vlink_set_baudrate(int fd, int baudrate)
+{
+	int idx;
+	t_vlink *link;
+
+	pthread_mutex_lock(&vlink_lock);
+	link = vlink_find(fd, &idx);
+	if (link != NULL)
+		__atomic_store_n(&link->baudrate[idx], baudrate, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&vlink_lock);
+	return link != NULL ? 0 : -ECERR_BADPARAM;
+}
+
+static int vlink_get_baudrate(int fd)
+{
+	int idx;
+	int rval = -1;
+	t_vlink *link;
+
+	pthread_mutex_lock(&vlink_lock);
+	link = vlink_find(fd, &idx);
+	if (link != NULL)
+		rval = __atomic_load_n(&link->baudrate[idx], __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&vlink_lock);
+	return rval;
+}
+
+static void timespec_add_ns(struct timespec *ts, int64_t ns)
+{
+	ns += ts->tv_nsec;
+	ts->tv_sec += ns / 1000000000L;
+	ts->tv_nsec = ns % 1000000000L;
+}
+
+/*
+ * Linea simulata in una direzione: i byte scritti su un capo arrivano
+ * all'altro solo dopo il loro tempo di linea alla velocita' di chi li
+ * ha spediti, uno dietro l'altro come su un UART.
+ */
+static void *vlink_pump_thread(void *data)
+{
+	t_vlink_pump *pump = data;
+	t_vlink *link = pump->link;
+	int src = link->pump[pump->dir];
+	int dst = link->pump[!pump->dir];
+	unsigned char buf[VLINK_CHUNK_MAX];
+	struct timespec line, now;
+	ssize_t len, sent, rval;
+	int baudrate;
+	int chunk;
+
+	clock_gettime(CLOCK_MONOTONIC, &line);
+	for (;;)
+	{
+		baudrate = __atomic_load_n(&link->baudrate[pump->dir], __ATOMIC_RELAXED);
+		chunk = baudrate / 10000;
+		if (chunk < 1)
+			chunk = 1;
+		if (chunk > VLINK_CHUNK_MAX)
+			chunk = VLINK_CHUNK_MAX;
+
+		len = read(src, buf, chunk);
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len <= 0)
+			break;
+
+		// La linea riparte da adesso se era ferma
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (now.tv_sec > line.tv_sec || (now.tv_sec == line.tv_sec && now.tv_nsec > line.tv_nsec))
+			line = now;
+		if (baudrate > 0)
+			timespec_add_ns(&line, (int64_t) len * 10 * 1000000000L / baudrate);
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &line, NULL) == EINTR)
+			;
+
+		for (sent = 0; sent < len; sent += rval)
+		{
+			rval = write(dst, buf + sent, len - sent);
+			if (rval < 0 && errno == EINTR)
+				rval = 0;
+			else
+			if (rval < 0)
+				goto out;
+		}
+	}
+
+out:
+	DRIVER_NOISY("Pump %d of %s exits\n", pump->dir, link->name);
+	shutdown(dst, SHUT_WR);
+	return NULL;
+}
+
+/*
+ * Coppia di socket connessi passando per il kernel come farebbero due
+ * processi: listen(), connect() e accept() sullo stesso indirizzo.
+ */
+static int vlink_socket_pair(int domain, struct sockaddr *addr, socklen_t addrlen, int end[2])
+{
+	int lfd, one = 1;
+
+	lfd = socket(domain, SOCK_STREAM, 0);
+	if (lfd < 0)
+		return -errno;
+	if (domain == AF_INET)
+		setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (bind(lfd, addr, addrlen) < 0 || listen(lfd, 1) < 0 ||
+		getsockname(lfd, addr, &addrlen) < 0)
+		goto error;
+
+	end[0] = socket(domain, SOCK_STREAM, 0);
+	if (end[0] < 0)
+		goto error;
+	if (connect(end[0], addr, addrlen) < 0)
+	{
+		close(end[0]);
+		goto error;
+	}
+	end[1] = accept(lfd, NULL, NULL);
+	if (end[1] < 0)
+	{
+		close(end[0]);
+		goto error;
+	}
+	close(lfd);
+
+	if (domain == AF_INET)
+	{
+		// I frame piccoli devono partire subito, come su una seriale
+		setsockopt(end[0], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		setsockopt(end[1], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	}
+	return 0;
+
+error:
+	one = -errno;
+	close(lfd);
+	return one;
+}
+
+static int vlink_unix_pair(const char *name, int end[2])
+{
+	struct sockaddr_un sun;
+	const char *path = strchr(name, ':');
+	socklen_t len;
+	int rval;
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	if (path != NULL && path[1] != '\0')
+	{
+		snprintf(sun.sun_path, sizeof(sun.sun_path), "%s", path + 1);
+		unlink(sun.sun_path);
+		len = sizeof(sun);
+	}
+	else
+	{
+		// Nome astratto: non lascia file in giro
+		len = offsetof(struct sockaddr_un, sun_path) + 1 +
+			snprintf(sun.sun_path + 1, sizeof(sun.sun_path) - 1, "testunit-%d-%p", getpid(), (void *) end);
+	}
+	rval = vlink_socket_pair(AF_UNIX, (struct sockaddr *) &sun, len, end);
+	if (sun.sun_path[0] != '\0')
+		unlink(sun.sun_path);
+	return rval;
+}
+
+static int vlink_tcp_pair(const char *name, int end[2])
+{
+	struct sockaddr_in sin;
+	const char *port = strchr(name, ':');
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sin.sin_port = htons(port != NULL ? strtol(port + 1, NULL, 10) : 0);
+	return vlink_socket_pair(AF_INET, (struct sockaddr *) &sin, sizeof(sin), end);
+}
+
+static int vlink_create(t_vlink *link, t_vlink_type type)
+{
+	struct termios term;
+	pthread_t thread;
+	int sv[2][2];
+	int rval;
+	int i;
+
+	switch (type)
+	{
+		case VLINK_TYPE_PTY:
+			if (openpty(&link->end[0], &link->end[1], NULL, NULL, NULL) < 0)
+				return -errno;
+			// Il capo master non deve elaborare nulla
+			tcgetattr(link->end[0], &term);
+			cfmakeraw(&term);
+			tcsetattr(link->end[0], TCSANOW, &term);
+			break;
+
+		case VLINK_TYPE_NULL:
+			if (socketpair(AF_UNIX, SOCK_STREAM, 0, link->end) < 0)
+				return -errno;
+			break;
+
+		case VLINK_TYPE_NULL_PACED:
+			if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv[0]) < 0)
+				return -errno;
+			if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv[1]) < 0)
+			{
+				close(sv[0][0]);
+				close(sv[0][1]);
+				return -errno;
+			}
+			for (i = 0; i < 2; i++)
+			{
+				link->end[i] = sv[i][0];
+				link->pump[i] = sv[i][1];
+			}
+			break;
+
+		case VLINK_TYPE_UNIX:
+			rval = vlink_unix_pair(link->name, link->end);
+			if (rval < 0)
+				return rval;
+			break;
+
+		case VLINK_TYPE_TCP:
+			rval = vlink_tcp_pair(link->name, link->end);
+			if (rval < 0)
+				return rval;
+			break;
+	}
+
+	link->type = type;
+	for (i = 0; i < 2; i++)
+		fcntl(link->end[i], F_SETFL, fcntl(link->end[i], F_GETFL) | O_NONBLOCK);
+
+	if (type == VLINK_TYPE_NULL_PACED)
+	{
+		for (i = 0; i < 2; i++)
+		{
+			pumps[link - links][i].link = link;
+			pumps[link - links][i].dir = i;
+			if (pthread_create(&thread, NULL, vlink_pump_thread, &pumps[link - links][i]) != 0)
+			{
+				DRIVER_ERROR("Cannot create the pump thread of %s\n", link->name);
+				return -ECERR_OUTOFMEM;
+			}
+			pthread_detach(thread);
+		}
+	}
+	return 0;
+}
+
+int vlink_open(const char *name, int baudrate)
+{
+	t_vlink_type type = vlink_type(name);
+	t_vlink *link = NULL;
+	int fd = -1;
+	int rval;
+	int i;
+
+	if (type == 0)
+	{
+		DRIVER_ERROR("BAD PARAMETER\n");
+		return -ECERR_BADPARAM;
+	}
+
+	pthread_mutex_lock(&vlink_lock);
+	// Il secondo capo di un link gia' aperto con lo stesso nome...
+	for (i = 0; i < VLINK_MAX; i++)
+	{
+		if (links[i].type == type && links[i].taken == 1 && strcmp(links[i].name, name) == 0)
+		{
+			link = &links[i];
+			break;
+		}
+	}
+	// ...oppure un link nuovo
+	if (link == NULL)
+	{
+		for (i = 0; i < VLINK_MAX && links[i].type != 0; i++)
+			;
+		if (i == VLINK_MAX)
+		{
+			DRIVER_ERROR("Too many virtual links\n");
+			pthread_mutex_unlock(&vlink_lock);
+			return -ECERR_OUTOFMEM;
+		}
+		link = &links[i];
+		snprintf(link->name, sizeof(link->name), "%s", name);
+		rval = vlink_create(link, type);
+		if (rval < 0)
+		{
+			DRIVER_ERROR("Cannot create virtual link %s: %d\n", name, rval);
+			memset(link, 0, sizeof(t_vlink));
+			pthread_mutex_unlock(&vlink_lock);
+			return rval;
+		}
+	}
+
+	link->baudrate[link->taken] = baudrate;
+	fd = link->end[link->taken++];
+	pthread_mutex_unlock(&vlink_lock);
+
+	DRIVER_NOISY("Virtual link %s: end %d FD: %d\n", name, link->taken - 1, fd);
+	return fd;
+}
+
+/*
+ * I capi dei link in memoria e dei socket non sono tty: la velocita'
+ * serve solo per i tempi di linea, non c'e' BREAK e il flush in
+ * ricezione butta quello che e' gia' arrivato.
+ */
+static int vlink_reset(int fd, int baudrate, int pre, int post)
+{
+	(void) pre;
+	(void) post;
+	return vlink_set_baudrate(fd, baudrate);
+}
+
+static int vlink_send_break(int fd)
+{
+	(void) fd;
+	return 0;
+}
+
+static void vlink_flush_rx(int fd)
+{
+	unsigned char buf[256];
+
+	while (read(fd, buf, sizeof(buf)) > 0)
+		;
+}
+
+static void vlink_flush_tx(int fd)
+{
+	(void) fd;
+}
+
+#define VLINK_SOCKET_OPS(n, p) {          \
+	.name = n,                            \
+	.prefix = p,                          \
+	.open = vlink_open,                   \
+	.reset = vlink_reset,                 \
+	.get_baudrate = vlink_get_baudrate,   \
+	.readv = transport_fd_readv,          \
+	.writev = transport_fd_writev,        \
+	.wait = transport_fd_wait,            \
+	.send_break = vlink_send_break,       \
+	.flush_rx = vlink_flush_rx,           \
+	.flush_tx = vlink_flush_tx,           \
+	.stats = NULL,                        \
+}
+
+const t_transport_ops transport_null = VLINK_SOCKET_OPS("null", VLINK_NULL);
+const t_transport_ops transport_unix = VLINK_SOCKET_OPS("unix", VLINK_UNIX);
+const t_transport_ops transport_tcp = VLINK_SOCKET_OPS("tcp", VLINK_TCP);
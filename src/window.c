@@ -0,0 +1,283 @@
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/uio.h>
+#include "window.h"
+#include "serial.h"
+#include "ec_types.h"
+#include "debug.h"
+
+DBG_MODULE(debuglevelDriver, "window", DBG_ERROR)
+
+// Elaborazione del peer oltre al tempo di linea
+#define WINDOW_TURNAROUND_MS	100L
+
+void window_init(t_window *w, int fd, t_ringbuf *rx, int window)
+{
+	memset(w, 0, sizeof(t_window));
+	w->fd = fd;
+	w->rx = rx;
+	w->window = window > 0 ? window : 1;
+	w->start_ms = serial_now_ms();
+}
+
+void window_reset(t_window *w)
+{
+	t_crc_type crc = w->crc;
+	window_init(w, w->fd, w->rx, w->window);
+	w->crc = crc;
+}
+
+static int window_trailer_len(t_window *w)
+{
+	return w->crc != CRC_NONE ? sizeof(t_trailer) : 0;
+}
+
+static void window_peek_signature(t_window *w, t_window_signature *sig)
+{
+	unsigned char scratch[sizeof(t_window_signature)];
+	// Copiata per averla allineata (ARM)
+	memcpy(sig, ringbuf_peek(w->rx, sizeof(t_window_signature), scratch),
+		sizeof(t_window_signature));
+}
+
+static int window_send_ack(t_window *w)
+{
+	t_window_signature ack;
+	struct iovec iov;
+
+	ack.header = SERIAL_WINDOW_ACK_HEADER;
+	ack.seq = w->expected;
+	ack.len = 0;
+	ack.footer = SERIAL_SIGNATURE_FOOTER;
+	iov.iov_base = &ack;
+	iov.iov_len = sizeof(ack);
+	w->acks++;
+	DRIVER_NOISY("ACK %u\n", ack.seq);
+	return serial_send_iov(w->fd, &iov, 1) == sizeof(ack) ? 0 : -ECERR_IO;
+}
+
+static int window_send_frame(t_window *w, uint32_t seq, const unsigned char *payload, int len)
+{
+	t_window_signature sig;
+	t_trailer trailer;
+	struct iovec iov[3];
+	int rval;
+
+	sig.header = SERIAL_WINDOW_DATA_HEADER;
+	sig.seq = seq;
+	sig.len = len;
+	sig.footer = SERIAL_SIGNATURE_FOOTER;
+	iov[0].iov_base = &sig;
+	iov[0].iov_len = sizeof(sig);
+	iov[1].iov_base = (void *) payload;
+	iov[1].iov_len = len;
+	if (w->crc != CRC_NONE)
+	{
+		trailer.crc = crc_compute(w->crc, 0, &sig, sizeof(sig));
+		trailer.crc = crc_compute(w->crc, trailer.crc, payload, len);
+	}
+	iov[2].iov_base = &trailer;
+	iov[2].iov_len = window_trailer_len(w);
+
+	DRIVER_NOISY("FRAME %u LEN %d\n", seq, len);
+	rval = serial_send_iov(w->fd, iov, 3);
+	if (rval != (int) (sizeof(sig) + len + iov[2].iov_len))
+	{
+		DRIVER_ERROR("Frame %u not sent: %d\n", seq, rval);
+		return rval < 0 ? rval : -ECERR_IO;
+	}
+	return 0;
+}
+
+int window_send(t_window *w, const unsigned char *payload, int len, int frames)
+{
+	t_window_signature ack;
+	uint32_t end;
+	int64_t progress;
+	long rto;
+	int stalls = 0;
+	int rval;
+
+	if (w == NULL || payload == NULL || len < 0 || len > WINDOW_MAX_PAYLOAD || frames <= 0)
+	{
+		DRIVER_ERROR("BAD PARAMETER\n");
+		return -ECERR_BADPARAM;
+	}
+
+	// Tutta la finestra in linea piu' l'ACK e l'elaborazione del peer
+	rto = serial_transfer_time(serial_get_baudrate(w->fd),
+		w->window * (sizeof(t_window_signature) + len + window_trailer_len(w)) +
+		sizeof(t_window_signature)) +
+		WINDOW_TURNAROUND_MS;
+
+	end = w->next + frames;
+	progress = serial_now_ms();
+	while (w->base != end)
+	{
+		// Riempiamo la finestra
+		while (w->next != end && (int) (w->next - w->base) < w->window)
+		{
+			rval = window_send_frame(w, w->next, payload, len);
+			if (rval < 0)
+				return rval;
+			w->next++;
+			w->frames++;
+		}
+
+		rval = serial_read_ring_until(w->fd, w->rx, sizeof(ack), progress + rto);
+		if (rval < 0)
+			return rval;
+		if (rval == sizeof(ack))
+		{
+			ringbuf_read(w->rx, (unsigned char *) &ack, sizeof(ack));
+			if (ack.header != SERIAL_WINDOW_ACK_HEADER || ack.footer != SERIAL_SIGNATURE_FOOTER)
+			{
+				DRIVER_ERROR("Bad ACK: 0x%08x 0x%08x\n", ack.header, ack.footer);
+				w->errors++;
+				return -ECERR_IO;
+			}
+			// ACK cumulativo: conferma tutti i frame prima di ack.seq
+			if ((int32_t) (ack.seq - w->base) > 0 && (int32_t) (ack.seq - w->next) <= 0)
+			{
+				w->bytes += (uint64_t) (ack.seq - w->base) * len;
+				w->base = ack.seq;
+				progress = serial_now_ms();
+				stalls = 0;
+			}
+			continue;
+		}
+
+		// Nessun progresso entro il timeout: go-back-N
+		if (++stalls > WINDOW_MAX_RETRIES)
+		{
+			DRIVER_ERROR("No ACK after %d retries, base %u\n", WINDOW_MAX_RETRIES, w->base);
+			w->errors++;
+			return -ETIMEDOUT;
+		}
+		DRIVER_VERBOSE("Timeout: resending from %u (%u frames)\n", w->base, w->next - w->base);
+		w->retransmits += w->next - w->base;
+		w->next = w->base;
+		progress = serial_now_ms();
+	}
+	return frames;
+}
+
+static int window_check_crc(t_window *w, int total)
+{
+	unsigned char scratch[sizeof(t_window_signature) + WINDOW_MAX_PAYLOAD + sizeof(t_trailer)];
+	const unsigned char *frame;
+
+	frame = ringbuf_peek(w->rx, total, scratch);
+	if (!protocol_trailer_ok(w->crc, frame, total - sizeof(t_trailer)))
+	{
+		DRIVER_ERROR("CRC ERROR\n");
+		return -ECERR_IO;
+	}
+	return 0;
+}
+
+int window_receive(t_window *w, int maxframes, long idle)
+{
+	t_window_signature sig;
+	int frames = 0;
+	int total;
+	int good;
+	int rval;
+
+	if (w == NULL || maxframes <= 0)
+	{
+		DRIVER_ERROR("BAD PARAMETER\n");
+		return -ECERR_BADPARAM;
+	}
+
+	while (frames < maxframes)
+	{
+		rval = serial_read_ring_until(w->fd, w->rx, sizeof(sig), serial_deadline_in(idle));
+		if (rval < 0)
+			return rval;
+		if (rval < (int) sizeof(sig))
+		{
+			DRIVER_VERBOSE("Line idle for %ld msecs\n", idle);
+			break;
+		}
+
+		window_peek_signature(w, &sig);
+		if (sig.header != SERIAL_WINDOW_DATA_HEADER || sig.footer != SERIAL_SIGNATURE_FOOTER ||
+			sig.len > WINDOW_MAX_PAYLOAD)
+		{
+			DRIVER_ERROR("Bad frame: 0x%08x 0x%08x LEN %u\n", sig.header, sig.footer, sig.len);
+			w->errors++;
+			return -ECERR_IO;
+		}
+
+		total = sizeof(sig) + sig.len + window_trailer_len(w);
+		rval = serial_read_ring_until(w->fd, w->rx, total,
+			serial_transfer_deadline(w->fd, sig.len, idle));
+		if (rval < 0)
+			return rval;
+		if (rval < total)
+		{
+			DRIVER_ERROR("Frame %u truncated: %d of %d\n", sig.seq, rval, total);
+			w->errors++;
+			return -ECERR_IO;
+		}
+		good = w->crc == CRC_NONE || window_check_crc(w, total) == 0;
+		ringbuf_consume(w->rx, total);
+
+		if (!good)
+		{
+			// Frame rovinato: lo trattiamo come perso, il mittente
+			// ripartira' da qui allo scadere del timeout
+			w->errors++;
+		}
+		else
+		if (sig.seq == w->expected)
+		{
+			w->expected++;
+			w->frames++;
+			w->bytes += sig.len;
+			frames++;
+		}
+		else
+		{
+			// Fuori sequenza (ritrasmissione o buco): lo scartiamo,
+			// l'ACK cumulativo dira' al mittente da dove ripartire
+			DRIVER_VERBOSE("Frame %u while expecting %u\n", sig.seq, w->expected);
+			w->duplicates++;
+		}
+
+		// Un solo ACK per tutti i frame gia' arrivati
+		if (ringbuf_used(w->rx) < sizeof(sig))
+		{
+			rval = window_send_ack(w);
+			if (rval < 0)
+				return rval;
+		}
+	}
+
+	// Eventuale ACK rimasto in sospeso
+	if (frames > 0 && ringbuf_used(w->rx) >= sizeof(sig))
+	{
+		rval = window_send_ack(w);
+		if (rval < 0)
+			return rval;
+	}
+	return frames;
+}
+
+double window_goodput(t_window *w)
+{
+	int64_t elapsed = serial_now_ms() - w->start_ms;
+	if (elapsed <= 0)
+		return 0;
+	return (double) w->bytes * 1000.0 / elapsed;
+}
+
+double window_efficiency(t_window *w, int baudrate)
+{
+	if (baudrate <= 0)
+		return 0;
+	// 10 bit per carattere sulla linea
+	return 100.0 * window_goodput(w) * 10.0 / baudrate;
+}